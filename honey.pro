@@ -169,6 +169,10 @@ HEADERS += src/qt/honeygui.h \
     src/qt/honeyaddressvalidator.h \
     src/addrman.h \
     src/base58.h \
+    src/bloom.h \
+    src/rpcjson.h \
+    src/notify.h \
+    src/addressindex.h \
     src/chainparams.h \
     src/chainparamsseeds.h \
     src/checkpoints.h \
@@ -275,6 +279,10 @@ SOURCES += src/qt/honey.cpp src/qt/honeygui.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/base58.cpp \
+    src/bloom.cpp \
+    src/rpcjson.cpp \
+    src/rest.cpp \
+    src/notify.cpp \
     src/db.cpp \
     src/walletdb.cpp \
     src/qt/clientmodel.cpp \
@@ -0,0 +1,168 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef HONEY_ADDRESSINDEX_H
+#define HONEY_ADDRESSINDEX_H
+
+#include <script.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <utility>
+#include <vector>
+
+/** Kinds of destination in address index keys */
+enum AddressIndexType
+{
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_KEY = 1,      // pay-to-pubkey and pay-to-pubkey-hash outputs, by key ID
+    ADDRESS_INDEX_SCRIPT = 2,   // pay-to-script-hash outputs, by script ID
+};
+
+/** An address history entry: an output paying the address, or an input
+ * spending such an output. Keys of one address sort by block height.
+ */
+struct CAddressIndexKey
+{
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    unsigned int nHeight;
+    unsigned int nTxPos;        // position of the transaction in its block
+    uint256 txhash;
+    unsigned int nIndex;        // output index, or input index when fSpending
+    bool fSpending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(unsigned char nAddressTypeIn, const uint160& hashAddressIn, unsigned int nHeightIn, unsigned int nTxPosIn,
+                     const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn)
+    {
+        nAddressType = nAddressTypeIn;
+        hashAddress = hashAddressIn;
+        nHeight = nHeightIn;
+        nTxPos = nTxPosIn;
+        txhash = txhashIn;
+        nIndex = nIndexIn;
+        fSpending = fSpendingIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nAddressType);
+        READWRITE(hashAddress);
+        READWRITE(BIGENDIAN(nHeight));
+        READWRITE(BIGENDIAN(nTxPos));
+        READWRITE(txhash);
+        READWRITE(BIGENDIAN(nIndex));
+        READWRITE(fSpending);
+    )
+
+    void SetNull()
+    {
+        nAddressType = ADDRESS_INDEX_NONE;
+        hashAddress = 0;
+        nHeight = 0;
+        nTxPos = 0;
+        txhash = 0;
+        nIndex = 0;
+        fSpending = false;
+    }
+};
+
+/** An unspent output paying an address */
+struct CAddressUnspentKey
+{
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey()
+    {
+        nAddressType = ADDRESS_INDEX_NONE;
+        hashAddress = 0;
+        txhash = 0;
+        nIndex = 0;
+    }
+
+    CAddressUnspentKey(unsigned char nAddressTypeIn, const uint160& hashAddressIn, const uint256& txhashIn, unsigned int nIndexIn)
+    {
+        nAddressType = nAddressTypeIn;
+        hashAddress = hashAddressIn;
+        txhash = txhashIn;
+        nIndex = nIndexIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nAddressType);
+        READWRITE(hashAddress);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    )
+};
+
+struct CAddressUnspentValue
+{
+    int64_t nValue;
+    CScript script;
+    int nHeight;
+
+    CAddressUnspentValue()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentValue(int64_t nValueIn, const CScript& scriptIn, int nHeightIn)
+    {
+        nValue = nValueIn;
+        script = scriptIn;
+        nHeight = nHeightIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    )
+
+    // A null value erases the unspent entry
+    void SetNull() { nValue = -1; script.clear(); nHeight = -1; }
+    bool IsNull() const { return (nValue == -1); }
+};
+
+typedef std::vector<std::pair<CAddressIndexKey, int64_t> > AddressIndexEntries;
+typedef std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > AddressUnspentEntries;
+
+/** Address index key of an output script: pay-to-pubkey outputs are indexed
+ * with pay-to-pubkey-hash ones, other non-P2SH scripts are not indexed */
+inline bool GetAddressIndexKey(const CTxDestination& dest, unsigned char& nAddressTypeRet, uint160& hashRet)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest))
+    {
+        nAddressTypeRet = ADDRESS_INDEX_KEY;
+        hashRet = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest))
+    {
+        nAddressTypeRet = ADDRESS_INDEX_SCRIPT;
+        hashRet = *scriptID;
+        return true;
+    }
+    return false;
+}
+
+inline bool GetAddressIndexKey(const CScript& scriptPubKey, unsigned char& nAddressTypeRet, uint160& hashRet)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+    return GetAddressIndexKey(dest, nAddressTypeRet, hashRet);
+}
+
+#endif // HONEY_ADDRESSINDEX_H
@@ -112,6 +112,36 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     vRandom[nRndPos2] = nId1;
 }
 
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    int& nEntry = vvNew[nUBucket][nUBucketPos];
+    if (nEntry == -1 && nId != -1)
+        indexNew.Added(nUBucket);
+    else if (nEntry != -1 && nId == -1)
+        indexNew.Removed(nUBucket);
+    nEntry = nId;
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    int& nEntry = vvTried[nKBucket][nKBucketPos];
+    if (nEntry == -1 && nId != -1)
+        indexTried.Added(nKBucket);
+    else if (nEntry != -1 && nId == -1)
+        indexTried.Removed(nKBucket);
+    nEntry = nId;
+}
+
+void CAddrMan::AddRecentlyGood(int nId)
+{
+    std::deque<int>::iterator it = std::find(vRecentlyGood.begin(), vRecentlyGood.end(), nId);
+    if (it != vRecentlyGood.end())
+        vRecentlyGood.erase(it);
+    vRecentlyGood.push_front(nId);
+    if (vRecentlyGood.size() > ADDRMAN_RECENTLY_GOOD_MAX)
+        vRecentlyGood.pop_back();
+}
+
 void CAddrMan::Delete(int nId)
 {
     assert(mapInfo.count(nId) != 0);
@@ -121,6 +151,9 @@ void CAddrMan::Delete(int nId)
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
+    std::deque<int>::iterator it = std::find(vRecentlyGood.begin(), vRecentlyGood.end(), nId);
+    if (it != vRecentlyGood.end())
+        vRecentlyGood.erase(it);
     mapAddr.erase(info);
     mapInfo.erase(nId);
     nNew--;
@@ -134,7 +167,7 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
         CAddrInfo& infoDelete = mapInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
-        vvNew[nUBucket][nUBucketPos] = -1;
+        SetNew(nUBucket, nUBucketPos, -1);
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
         }
@@ -147,7 +180,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
         int pos = info.GetBucketPosition(nKey, true, bucket);
         if (vvNew[bucket][pos] == nId) {
-            vvNew[bucket][pos] = -1;
+            SetNew(bucket, pos, -1);
             info.nRefCount--;
         }
     }
@@ -168,7 +201,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
-        vvTried[nKBucket][nKBucketPos] = -1;
+        SetTried(nKBucket, nKBucketPos, -1);
         nTried--;
 
         // find which new bucket it belongs to
@@ -179,12 +212,12 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
-        vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        SetNew(nUBucket, nUBucketPos, nIdEvict);
         nNew++;
     }
     assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
 }
@@ -209,6 +242,7 @@ void CAddrMan::Good_(const CService &addr, int64_t nTime)
     info.nLastTry = nTime;
     info.nTime = nTime;
     info.nAttempts = 0;
+    AddRecentlyGood(nId);
 
     // if it is already in the tried set, don't do anything else
     if (info.fInTried)
@@ -295,7 +329,7 @@ bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimeP
         if (fInsert) {
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
-            vvNew[nUBucket][nUBucketPos] = nId;
+            SetNew(nUBucket, nUBucketPos, nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -334,12 +368,11 @@ CAddress CAddrMan::Select_()
         // use a tried node
         double fChanceFactor = 1.0;
         while (1) {
-            int nKBucket = GetRandInt(ADDRMAN_TRIED_BUCKET_COUNT);
+            // pick a non-empty bucket, then scan it from a random position
+            int nKBucket = indexTried[GetRandInt(indexTried.size())];
             int nKBucketPos = GetRandInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand()) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand()) % ADDRMAN_BUCKET_SIZE;
-            }
+            while (vvTried[nKBucket][nKBucketPos] == -1)
+                nKBucketPos = (nKBucketPos + 1) % ADDRMAN_BUCKET_SIZE;
             int nId = vvTried[nKBucket][nKBucketPos];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
@@ -351,12 +384,11 @@ CAddress CAddrMan::Select_()
         // use a new node
         double fChanceFactor = 1.0;
         while (1) {
-            int nUBucket = GetRandInt(ADDRMAN_NEW_BUCKET_COUNT);
+            // pick a non-empty bucket, then scan it from a random position
+            int nUBucket = indexNew[GetRandInt(indexNew.size())];
             int nUBucketPos = GetRandInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand()) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand()) % ADDRMAN_BUCKET_SIZE;
-            }
+            while (vvNew[nUBucket][nUBucketPos] == -1)
+                nUBucketPos = (nUBucketPos + 1) % ADDRMAN_BUCKET_SIZE;
             int nId = vvNew[nUBucket][nUBucketPos];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
@@ -367,6 +399,16 @@ CAddress CAddrMan::Select_()
     }
 }
 
+CAddress CAddrMan::SelectRecentlyGood_()
+{
+    if (vRecentlyGood.empty())
+        return Select_();
+
+    int nId = vRecentlyGood[GetRandInt(vRecentlyGood.size())];
+    assert(mapInfo.count(nId) == 1);
+    return mapInfo[nId];
+}
+
 #ifdef DEBUG_ADDRMAN
 int CAddrMan::Check_()
 {
@@ -400,6 +442,7 @@ int CAddrMan::Check_()
     if (mapNew.size() != nNew) return -10;
 
     for (int n = 0; n < ADDRMAN_TRIED_BUCKET_COUNT; n++) {
+        int nSize = 0;
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
              if (vvTried[n][i] != -1) {
                  if (!setTried.count(vvTried[n][i]))
@@ -409,11 +452,15 @@ int CAddrMan::Check_()
                  if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
                      return -18;
                  setTried.erase(vvTried[n][i]);
+                 nSize++;
              }
         }
+        if (indexTried.GetBucketSize(n) != nSize)
+            return -20;
     }
 
     for (int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
+        int nSize = 0;
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
@@ -422,8 +469,11 @@ int CAddrMan::Check_()
                     return -19;
                 if (--mapNew[vvNew[n][i]] == 0)
                     mapNew.erase(vvNew[n][i]);
+                nSize++;
             }
         }
+        if (indexNew.GetBucketSize(n) != nSize)
+            return -21;
     }
 
     if (setTried.size())
@@ -10,6 +10,9 @@
 #include <timedata.h>
 #include <util.h>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <map>
 #include <vector>
 
@@ -158,6 +161,58 @@ public:
 // the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+// how many of the most recently good addresses to remember
+#define ADDRMAN_RECENTLY_GOOD_MAX 64
+
+/** Index of the non-empty buckets of one addrman table, so that an occupied
+ *  bucket can be picked at random in constant time however sparse the table is. */
+class CAddrBucketIndex
+{
+private:
+    // number of entries in each bucket
+    std::vector<int> vSize;
+
+    // position of each bucket in vNonEmpty, or -1 if it is empty
+    std::vector<int> vPos;
+
+    // all buckets holding at least one entry, in no particular order
+    std::vector<int> vNonEmpty;
+
+public:
+    void Clear(int nBuckets)
+    {
+        vSize.assign(nBuckets, 0);
+        vPos.assign(nBuckets, -1);
+        vNonEmpty.clear();
+    }
+
+    // An entry was stored in nBucket.
+    void Added(int nBucket)
+    {
+        if (vSize[nBucket]++ == 0) {
+            vPos[nBucket] = vNonEmpty.size();
+            vNonEmpty.push_back(nBucket);
+        }
+    }
+
+    // An entry was removed from nBucket.
+    void Removed(int nBucket)
+    {
+        assert(vSize[nBucket] > 0);
+        if (--vSize[nBucket] == 0) {
+            int nLast = vNonEmpty.back();
+            vNonEmpty[vPos[nBucket]] = nLast;
+            vPos[nLast] = vPos[nBucket];
+            vNonEmpty.pop_back();
+            vPos[nBucket] = -1;
+        }
+    }
+
+    int size() const { return vNonEmpty.size(); }
+    int operator[](int n) const { return vNonEmpty[n]; }
+    int GetBucketSize(int nBucket) const { return vSize[nBucket]; }
+};
+
 /** Stochastical (IP) address manager */
 class CAddrMan
 {
@@ -192,6 +247,16 @@ private:
     // list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    // non-empty "tried" and "new" buckets
+    CAddrBucketIndex indexTried;
+    CAddrBucketIndex indexNew;
+
+    // nIds most recently marked good, newest first
+    std::deque<int> vRecentlyGood;
+
+    // number of modifications so far, so unchanged tables need not be rewritten
+    uint64_t nChanges;
+
 protected:
 
     // Find an entry.
@@ -204,6 +269,13 @@ protected:
     // Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    // Store nId (or -1) at a position in a "new" or "tried" table, keeping the bucket indexes up to date.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
+    // Put nId at the front of the recently good list.
+    void AddRecentlyGood(int nId);
+
     // Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
@@ -226,6 +298,9 @@ protected:
     // nUnkBias determines how much to favor new addresses over tried ones (min=0, max=100)
     CAddress Select_();
 
+    // Select one of the addresses most recently marked good, or any address if there are none.
+    CAddress SelectRecentlyGood_();
+
 #ifdef DEBUG_ADDRMAN
     // Perform consistency check. Returns an error code or zero.
     int Check_();
@@ -302,11 +377,7 @@ public:
             }
         }
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            int nSize = 0;
-            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1)
-                    nSize++;
-            }
+            int nSize = indexNew.GetBucketSize(bucket);
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
@@ -351,7 +422,7 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
@@ -371,7 +442,7 @@ public:
                 vRandom.push_back(nIdCount);
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -391,7 +462,7 @@ public:
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -412,6 +483,17 @@ public:
             LogPrint("addrman", "addrman lost %i new and %i tried addresses due to collisions\n", nLostUnk, nLost);
         }
 
+        // Seed the recently good list with the tried entries that last succeeded most recently.
+        std::vector<std::pair<int64_t, int> > vGood;
+        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+            if (it->second.fInTried)
+                vGood.push_back(std::make_pair(it->second.nLastSuccess, it->first));
+        }
+        size_t nGood = std::min(vGood.size(), (size_t)ADDRMAN_RECENTLY_GOOD_MAX);
+        std::partial_sort(vGood.begin(), vGood.begin() + nGood, vGood.end(), std::greater<std::pair<int64_t, int> >());
+        for (size_t i = 0; i < nGood; i++)
+            vRecentlyGood.push_back(vGood[i].second);
+
         Check();
     }
 
@@ -434,6 +516,9 @@ public:
                 vvTried[bucket][entry] = -1;
             }
         }
+        indexNew.Clear(ADDRMAN_NEW_BUCKET_COUNT);
+        indexTried.Clear(ADDRMAN_TRIED_BUCKET_COUNT);
+        vRecentlyGood.clear();
 
         nIdCount = 0;
         nTried = 0;
@@ -442,6 +527,7 @@ public:
 
     CAddrMan()
     {
+        nChanges = 0;
         Clear();
     }
 
@@ -456,6 +542,13 @@ public:
         return vRandom.size();
     }
 
+    // Return a counter that changes whenever the tables are modified.
+    uint64_t GetChangeCount() const
+    {
+        LOCK(cs);
+        return nChanges;
+    }
+
     // Consistency check
     void Check()
     {
@@ -477,6 +570,7 @@ public:
             LOCK(cs);
             Check();
             fRet |= Add_(addr, source, nTimePenalty);
+            nChanges++;
             Check();
         }
         if (fRet)
@@ -493,6 +587,7 @@ public:
             Check();
             for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
                 nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+            nChanges++;
             Check();
         }
         if (nAdd)
@@ -507,6 +602,7 @@ public:
             LOCK(cs);
             Check();
             Good_(addr, nTime);
+            nChanges++;
             Check();
         }
     }
@@ -518,6 +614,7 @@ public:
             LOCK(cs);
             Check();
             Attempt_(addr, nTime);
+            nChanges++;
             Check();
         }
     }
@@ -538,6 +635,19 @@ public:
         return addrRet;
     }
 
+    // Choose one of the addresses we most recently had a working connection to.
+    CAddress SelectRecentlyGood()
+    {
+        CAddress addrRet;
+        {
+            LOCK(cs);
+            Check();
+            addrRet = SelectRecentlyGood_();
+            Check();
+        }
+        return addrRet;
+    }
+
     // Return a bunch of addresses, selected at random.
     std::vector<CAddress> GetAddr()
     {
@@ -558,6 +668,7 @@ public:
             LOCK(cs);
             Check();
             Connected_(addr, nTime);
+            nChanges++;
             Check();
         }
     }
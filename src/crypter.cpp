@@ -157,6 +157,7 @@ bool CCryptoKeyStore::Lock()
     {
         LOCK(cs_KeyStore);
         vMasterKey.clear();
+        mapSigningKeys.clear();
     }
 
     NotifyStatusChanged(this);
@@ -250,6 +251,40 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
     return false;
 }
 
+bool CCryptoKeyStore::SignHash(const CKeyID &address, const uint256 &hash, std::vector<unsigned char>& vchSig) const
+{
+    CSigningKey signer;
+    {
+        LOCK(cs_KeyStore);
+        SigningKeyMap::const_iterator mi = mapSigningKeys.find(address);
+        if (mi != mapSigningKeys.end())
+            signer = (*mi).second;
+    }
+
+    if (!signer.IsValid())
+    {
+        CKey key;
+        if (!GetKey(address, key) || !signer.Set(key))
+            return false;
+
+        LOCK(cs_KeyStore);
+        // Not if the wallet was locked meanwhile
+        if (!IsLocked())
+        {
+            if (mapSigningKeys.size() >= MAX_SIGNING_KEYS)
+            {
+                // Evict an arbitrary entry; the hash being signed is as good as random
+                SigningKeyMap::iterator it = mapSigningKeys.lower_bound(CKeyID(Hash160(hash.begin(), hash.end())));
+                mapSigningKeys.erase(it == mapSigningKeys.end() ? mapSigningKeys.begin() : it);
+            }
+            mapSigningKeys.insert(std::make_pair(address, signer));
+        }
+    }
+
+    // Signed outside cs_KeyStore, so several threads can sign with different keys
+    return signer.Sign(hash, vchSig);
+}
+
 bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
 {
     {
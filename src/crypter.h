@@ -127,6 +127,9 @@ public:
 bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext);
 bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext);
 
+// Maximum number of signing keys kept set up while the wallet is unlocked
+static const unsigned int MAX_SIGNING_KEYS = 1000;
+
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
  */
@@ -141,6 +144,13 @@ private:
     // if fUseCrypto is false, vMasterKey must be empty
     bool fUseCrypto;
 
+    // Keys already decrypted and set up for signing, so repeated signatures
+    // with the same key skip both steps. The secrets sit in OpenSSL's EC_KEY
+    // heap, which is not locked memory. Lock() empties the map, and each
+    // secret is cleared once the last signature in flight with it is done
+    typedef std::map<CKeyID, CSigningKey> SigningKeyMap;
+    mutable SigningKeyMap mapSigningKeys;
+
 protected:
     bool SetCrypted();
 
@@ -185,8 +195,20 @@ public:
         }
         return false;
     }
+    void RemoveKey(const CKeyID &address)
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted())
+        {
+            CBasicKeyStore::RemoveKey(address);
+            return;
+        }
+        mapCryptedKeys.erase(address);
+        mapSigningKeys.erase(address);
+    }
     bool GetKey(const CKeyID &address, CKey& keyOut) const;
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
+    bool SignHash(const CKeyID &address, const uint256 &hash, std::vector<unsigned char>& vchSig) const;
     void GetKeys(std::set<CKeyID> &setAddress) const
     {
         if (!IsCrypted())
@@ -134,6 +134,9 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
     return Hash160(vch.begin(), vch.end());
 }
 
+/** Fast non-cryptographic hash (MurmurHash3, x86_32 variant), used by bloom filters */
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pDataToHash, size_t nDataLen);
+
 typedef struct
 {
     SHA512_CTX ctxInner;
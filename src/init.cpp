@@ -10,6 +10,7 @@
 #include <txdb.h>
 #include <rpcserver.h>
 #include <net.h>
+#include <notify.h>
 #include <util.h>
 #include <ui_interface.h>
 #ifdef ENABLE_WALLET
@@ -90,6 +91,7 @@ void Shutdown()
     RenameThread("honey-shutoff");
     mempool.AddTransactionsUpdated(1);
     StopRPCThreads();
+    StopNotifications();
 #ifdef ENABLE_WALLET
     ShutdownRPCMining();
     if (pwalletMain)
@@ -163,6 +165,7 @@ std::string HelpMessage()
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -addressindex          " + _("Maintain an index of outputs and spends by address (default: 0)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
@@ -185,6 +188,9 @@ std::string HelpMessage()
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+    strUsage += "  -maxuploadtarget=<n>   " + _("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: 0)") + "\n";
+    strUsage += "  -maxuploadrate=<n>     " + _("Limit total upload rate to <n> KB/s, 0 = no limit (default: 0)") + "\n";
+    strUsage += "  -maxpeeruploadrate=<n> " + _("Limit upload rate to each peer to <n> KB/s, 0 = no limit (default: 0)") + "\n";
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -229,12 +235,26 @@ std::string HelpMessage()
         strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     }
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + _("Set the depth of the work queue to service RPC calls (default: 16)") + "\n";
+    strUsage += "  -rpcservertimeout=<n>  " + _("Timeout in seconds for idle RPC connections (default: 30)") + "\n";
+    strUsage += "  -rpcbatchthreads=<n>   " + _("Maximum number of calls of one batch request run in parallel (default: 4)") + "\n";
+    strUsage += "  -rest                  " + _("Accept public REST requests on the RPC port, from the hosts allowed by -rpcallowip (default: 0)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
+    strUsage += "  -pubhashblock=<addr>   " + _("Stream hashes of new best blocks to subscribers connecting to <addr> (loopback address:port)") + "\n";
+    strUsage += "  -pubrawblock=<addr>    " + _("Stream new best blocks to subscribers connecting to <addr>") + "\n";
+    strUsage += "  -pubhashtx=<addr>      " + _("Stream hashes of transactions accepted to the memory pool to subscribers connecting to <addr>") + "\n";
+    strUsage += "  -pubrawtx=<addr>       " + _("Stream transactions accepted to the memory pool to subscribers connecting to <addr>") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n";
     strUsage += "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n";
+    strUsage += "  -stakecombinethreshold=<amt> " + strprintf(_("Combine stake outputs smaller than <amt> when staking (default: %s)"), FormatMoney(DEFAULT_STAKE_COMBINE_THRESHOLD)) + "\n";
+    strUsage += "  -stakesplitthreshold=<amt> " + strprintf(_("Split stakes worth at least <amt> into several outputs (default: %s)"), FormatMoney(DEFAULT_STAKE_SPLIT_THRESHOLD)) + "\n";
+    strUsage += "  -stakesplitoutputs=<n> " + strprintf(_("Split such stakes into up to <n> outputs, at most %u (default: %u)"), MAX_STAKE_SPLIT_OUTPUTS, DEFAULT_STAKE_SPLIT_OUTPUTS) + "\n";
+    strUsage += "  -stakecombineminage=<n> " + _("Only combine stake outputs at least <n> seconds old (default: 0)") + "\n";
+    strUsage += "  -staketargetoutputs=<n> " + strprintf(_("Raise the stake thresholds so that large balances keep about <n> stake outputs, 0 = off (default: %u)"), DEFAULT_STAKE_TARGET_OUTPUTS) + "\n";
+    strUsage += "  -stakeconsolidate      " + _("Consolidate small stake outputs in the background while not staking (default: 0)") + "\n";
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
@@ -609,6 +629,10 @@ bool AppInit2(boost::thread_group& threadGroup)
         }
     }
 
+    CNode::SetMaxOutboundTarget(std::max((int64_t)0, GetArg("-maxuploadtarget", 0)) * 1024 * 1024);
+    CNode::SetMaxUploadRate(std::max((int64_t)0, GetArg("-maxuploadrate", 0)) * 1000,
+                            std::max((int64_t)0, GetArg("-maxpeeruploadrate", 0)) * 1000);
+
 #ifdef ENABLE_WALLET
     if (mapArgs.count("-reservebalance")) // ppcoin: reserve balance amount
     {
@@ -618,6 +642,17 @@ bool AppInit2(boost::thread_group& threadGroup)
             return false;
         }
     }
+
+    if (mapArgs.count("-stakecombinethreshold") && !ParseMoney(mapArgs["-stakecombinethreshold"], nStakeCombineThreshold))
+        return InitError(strprintf(_("Invalid amount for -stakecombinethreshold=<amount>: '%s'"), mapArgs["-stakecombinethreshold"]));
+    if (mapArgs.count("-stakesplitthreshold") && !ParseMoney(mapArgs["-stakesplitthreshold"], nStakeSplitThreshold))
+        return InitError(strprintf(_("Invalid amount for -stakesplitthreshold=<amount>: '%s'"), mapArgs["-stakesplitthreshold"]));
+    if (!ValidStakeThresholds(nStakeCombineThreshold, nStakeSplitThreshold))
+        return InitError(_("-stakesplitthreshold must be at least 1 and twice -stakecombinethreshold"));
+    nStakeCombineMinAge = std::max((int64_t)0, GetArg("-stakecombineminage", 0));
+    nStakeSplitOutputs = std::max((int64_t)1, std::min(GetArg("-stakesplitoutputs", DEFAULT_STAKE_SPLIT_OUTPUTS), (int64_t)MAX_STAKE_SPLIT_OUTPUTS));
+    nStakeTargetOutputs = std::max((int64_t)0, std::min(GetArg("-staketargetoutputs", DEFAULT_STAKE_TARGET_OUTPUTS), (int64_t)MAX_STAKE_TARGET_OUTPUTS));
+    fStakeConsolidate = GetBoolArg("-stakeconsolidate", false);
 #endif
 
     for (std::string strDest : mapMultiArgs["-seednode"])
@@ -650,6 +685,25 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    {
+        CTxDB txdb;
+        bool fIndexed = false;
+        txdb.ReadFlag("addressindex", fIndexed);
+        if (fAddressIndex && !fIndexed)
+        {
+            uiInterface.InitMessage(_("Building address index..."));
+            if (!BuildAddressIndex())
+                return InitError(_("Error building address index"));
+        }
+        else if (!fAddressIndex && fIndexed)
+        {
+            // A stale index would miss blocks connected while it was off
+            if (!txdb.WipeAddressIndex() || !txdb.WriteFlag("addressindex", false))
+                return InitError(_("Error removing address index"));
+        }
+    }
+
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false))
     {
         PrintBlockTree();
@@ -767,8 +821,12 @@ bool AppInit2(boost::thread_group& threadGroup)
             nStart = GetTimeMillis();
             pwalletMain->ScanForWalletTransactions(pindexRescan, true);
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(CBlockLocator(pindexBest));
-            nWalletDBUpdated++;
+            // An interrupted rescan resumes from the old best block next time
+            if (!ShutdownRequested())
+            {
+                pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+                nWalletDBUpdated++;
+            }
         }
     } // (!fDisableWallet)
 #else // ENABLE_WALLET
@@ -818,6 +876,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("mapAddressBook.size() = %u\n",  pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
+    std::string strNotifyError;
+    if (!StartNotifications(strNotifyError))
+        return InitError(strNotifyError);
+
     StartNode(threadGroup);
 #ifdef ENABLE_WALLET
     // InitRPCMining is needed here so getwork/getblocktemplate in the GUI debug console works properly.
@@ -843,6 +905,12 @@ bool AppInit2(boost::thread_group& threadGroup)
         // Add wallet transactions that aren't already in a block to mapTransactions
         pwalletMain->ReacceptWalletTransactions();
 
+        // Run a thread to commit queued wallet transactions
+        threadGroup.create_thread(boost::bind(&ThreadCommitWalletTx, pwalletMain));
+
+        // Run a thread to refill the keypool
+        threadGroup.create_thread(boost::bind(&ThreadKeyPoolRefill, pwalletMain));
+
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
     }
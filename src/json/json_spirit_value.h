@@ -10,6 +10,7 @@
 # pragma once
 #endif
 
+#include <utility>
 #include <vector>
 #include <map>
 #include <string>
@@ -51,9 +52,14 @@ namespace json_spirit
 
         Value_impl( const Value_impl& other );
 
+        /// Honey: Added move support, so arrays and objects do not deep copy
+        /// their members whenever the underlying vector grows
+        Value_impl( Value_impl&& other ) noexcept;
+
         bool operator==( const Value_impl& lhs ) const;
 
         Value_impl& operator=( const Value_impl& lhs );
+        Value_impl& operator=( Value_impl&& lhs ) noexcept;
 
         Value_type type() const;
 
@@ -307,6 +313,24 @@ namespace json_spirit
         return *this;
     }
 
+    template< class Config >
+    Value_impl< Config >::Value_impl( Value_impl< Config >&& other ) noexcept
+    :   type_( other.type_ )
+    ,   v_( std::move( other.v_ ) )
+    ,   is_uint64_( other.is_uint64_ )
+    {
+    }
+
+    template< class Config >
+    Value_impl< Config >& Value_impl< Config >::operator=( Value_impl&& lhs ) noexcept
+    {
+        type_ = lhs.type_;
+        v_ = std::move( lhs.v_ );
+        is_uint64_ = lhs.is_uint64_;
+
+        return *this;
+    }
+
     template< class Config >
     bool Value_impl< Config >::operator==( const Value_impl& lhs ) const
     {
@@ -7,6 +7,11 @@
 #include <txdb.h>
 #include <hash.h>
 
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+
 
 // Get time weight
 int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd)
@@ -59,9 +64,9 @@ static bool SelectBlockFromCandidates(std::vector<std::pair<int64_t, uint256> >&
     *pindexSelected = (const CBlockIndex*) 0;
     for (const std::pair<int64_t, uint256>& item : vSortedByTimestamp)
     {
-        if (!mapBlockIndex.count(item.second))
+        const CBlockIndex* pindex = LookupBlockIndex(item.second);
+        if (!pindex)
             return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
         if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
             break;
         if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
@@ -372,3 +377,138 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, con
 
     return CheckStakeKernelHash(pindexPrev, nBits, block, txindex.pos.nTxPos - txindex.pos.nBlockPos, txPrev, prevout, nTime, hashProofOfStake, targetProofOfStake);
 }
+
+// Kernel hashes per thread between looks at the shared work counter
+static const unsigned int KERNEL_INPUTS_PER_THREAD = 64;
+static const int MAX_KERNEL_THREADS = 8;
+
+static CCriticalSection cs_mapKernelInputs;
+static std::map<COutPoint, CKernelInput> mapKernelInputs;
+
+bool GetKernelInput(const CChainSnapshot& chain, const COutPoint& prevout, CKernelInput& input)
+{
+    bool fCached;
+    {
+        LOCK(cs_mapKernelInputs);
+        std::map<COutPoint, CKernelInput>::const_iterator mi = mapKernelInputs.find(prevout);
+        fCached = mi != mapKernelInputs.end();
+        if (fCached)
+            input = mi->second;
+    }
+
+    // A cached output may have been reorganized out of the main chain
+    const CBlockIndex* pindexFrom = fCached ? LookupBlockIndex(input.hashBlockFrom) : nullptr;
+    if (!chain.Contains(pindexFrom))
+    {
+        CTxDB txdb("r");
+        CTransaction txPrev;
+        CTxIndex txindex;
+        if (!txPrev.ReadFromDisk(txdb, prevout, txindex) || prevout.n >= txPrev.vout.size())
+            return false;
+
+        CBlock block;
+        if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            return false;
+
+        input.prevout = prevout;
+        input.nTimeTxPrev = txPrev.nTime;
+        input.nValue = txPrev.vout[prevout.n].nValue;
+        input.hashBlockFrom = block.GetHash();
+        pindexFrom = LookupBlockIndex(input.hashBlockFrom);
+        if (!chain.Contains(pindexFrom))
+            return false;
+
+        LOCK(cs_mapKernelInputs);
+        if (mapKernelInputs.size() >= MAX_KERNEL_INPUT_CACHE)
+            mapKernelInputs.clear();
+        mapKernelInputs[prevout] = input;
+    }
+
+    // Same depth rule as IsConfirmedInNPrevBlocks() in CheckKernel()
+    return chain.nHeight - pindexFrom->nHeight >= nStakeMinConfirmations - 1;
+}
+
+static void FindKernelsThread(const uint256& bnStakeModifierV2, const uint256& bnTargetPerCoin, const std::vector<CKernelInput>& vInputs,
+                              unsigned int nTimeBegin, unsigned int nTimeEnd, std::atomic<unsigned int>& nNext,
+                              CCriticalSection& cs_vHits, std::vector<CKernelHit>& vHits)
+{
+    std::vector<CKernelHit> vFound;
+    while (true)
+    {
+        const unsigned int nBegin = nNext.fetch_add(KERNEL_INPUTS_PER_THREAD);
+        if (nBegin >= vInputs.size())
+            break;
+        const unsigned int nEnd = std::min((unsigned int)vInputs.size(), nBegin + KERNEL_INPUTS_PER_THREAD);
+        for (unsigned int i = nBegin; i < nEnd; i++)
+        {
+            const CKernelInput& input = vInputs[i];
+            uint256 bnTarget = bnTargetPerCoin;
+            bnTarget *= uint256(input.nValue);
+
+            // The serialization CheckStakeKernelHashV2() hashes, with only
+            // the trailing nTimeTx changing from one time to the next
+            CDataStream ss(SER_GETHASH, 0);
+            ss << bnStakeModifierV2;
+            ss << input.nTimeTxPrev << input.prevout.hash << input.prevout.n << (unsigned int)0;
+            std::vector<unsigned char> vchData(ss.begin(), ss.end());
+            unsigned char* pchTime = &vchData[vchData.size() - 4];
+
+            // Staking times are STAKE_TIMESTAMP_MASK aligned and can't precede the input
+            uint64_t nTimeFirst = std::max(nTimeBegin, input.nTimeTxPrev);
+            nTimeFirst = (nTimeFirst + STAKE_TIMESTAMP_MASK) & ~(uint64_t)STAKE_TIMESTAMP_MASK;
+            for (uint64_t nTime64 = nTimeFirst; nTime64 <= nTimeEnd; nTime64 += STAKE_TIMESTAMP_MASK + 1)
+            {
+                const unsigned int nTime = nTime64;
+                pchTime[0] = nTime;
+                pchTime[1] = nTime >> 8;
+                pchTime[2] = nTime >> 16;
+                pchTime[3] = nTime >> 24;
+                uint256 hashProofOfStake = HashBlake2s(vchData.begin(), vchData.end());
+                if (hashProofOfStake > bnTarget)
+                    continue;
+
+                CKernelHit hit;
+                hit.nInput = i;
+                hit.nTime = nTime;
+                hit.hashProofOfStake = hashProofOfStake;
+                hit.targetProofOfStake = bnTarget;
+                vFound.push_back(hit);
+            }
+        }
+    }
+
+    LOCK(cs_vHits);
+    vHits.insert(vHits.end(), vFound.begin(), vFound.end());
+}
+
+void FindKernels(const CBlockIndex* pindexPrev, unsigned int nBits, const std::vector<CKernelInput>& vInputs,
+                 unsigned int nTimeBegin, unsigned int nTimeEnd, std::vector<CKernelHit>& vHits)
+{
+    vHits.clear();
+
+    bool fOverflow = false;
+    uint256 bnTargetPerCoin;
+    bnTargetPerCoin.SetCompact(nBits, nullptr, &fOverflow);
+    if (fOverflow || vInputs.empty() || nTimeBegin > nTimeEnd)
+        return;
+
+    std::atomic<unsigned int> nNext(0);
+    CCriticalSection cs_vHits;
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_KERNEL_THREADS));
+    nThreads = std::min(nThreads, (int)((vInputs.size() + KERNEL_INPUTS_PER_THREAD - 1) / KERNEL_INPUTS_PER_THREAD));
+    if (nThreads <= 1)
+        FindKernelsThread(pindexPrev->bnStakeModifierV2, bnTargetPerCoin, vInputs, nTimeBegin, nTimeEnd, nNext, cs_vHits, vHits);
+    else
+    {
+        boost::thread_group threadKernel;
+        for (int i = 0; i < nThreads; i++)
+            threadKernel.create_thread(boost::bind(&FindKernelsThread, boost::cref(pindexPrev->bnStakeModifierV2), boost::cref(bnTargetPerCoin),
+                                                   boost::cref(vInputs), nTimeBegin, nTimeEnd, boost::ref(nNext), boost::ref(cs_vHits), boost::ref(vHits)));
+        threadKernel.join_all();
+    }
+
+    std::sort(vHits.begin(), vHits.end(), [](const CKernelHit& a, const CKernelHit& b) {
+        return a.nTime < b.nTime || (a.nTime == b.nTime && a.nInput < b.nInput);
+    });
+}
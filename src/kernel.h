@@ -40,4 +40,38 @@ int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd);
 // Convenient for searching a kernel
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime = nullptr);
 
+// Outputs remembered by GetKernelInput(); the cache starts over when full
+static const unsigned int MAX_KERNEL_INPUT_CACHE = 500000;
+
+// What the kernel hash needs to know about a staked output
+class CKernelInput
+{
+public:
+    COutPoint prevout;
+    unsigned int nTimeTxPrev;
+    int64_t nValue;
+    uint256 hashBlockFrom;
+};
+
+// A kernel found by FindKernels()
+class CKernelHit
+{
+public:
+    unsigned int nInput;        // index into the inputs searched
+    unsigned int nTime;
+    uint256 hashProofOfStake;
+    uint256 targetProofOfStake;
+};
+
+// Look up an output for kernel searches on top of chain's best block. Reads
+// the disk only the first time an output is seen. Fails like CheckKernel()
+// for unknown outputs and ones short of the minimum confirmations.
+bool GetKernelInput(const CChainSnapshot& chain, const COutPoint& prevout, CKernelInput& input);
+
+// Evaluate the kernel of every input at every STAKE_TIMESTAMP_MASK aligned
+// time in [nTimeBegin, nTimeEnd] on top of pindexPrev, with the work spread
+// over several threads. Hits are returned ordered by time.
+void FindKernels(const CBlockIndex* pindexPrev, unsigned int nBits, const std::vector<CKernelInput>& vInputs,
+                 unsigned int nTimeBegin, unsigned int nTimeEnd, std::vector<CKernelHit>& vHits);
+
 #endif // PPCOIN_KERNEL_H
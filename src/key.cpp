@@ -7,6 +7,8 @@
 #include <openssl/rand.h>
 #include <openssl/obj_mac.h>
 
+#include <boost/thread/mutex.hpp>
+
 #include <key.h>
 
 
@@ -487,6 +489,30 @@ bool CKey::Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
     return key.Sign(hash, vchSig);
 }
 
+struct CSigningKey::Context
+{
+    CECKey key;
+    boost::mutex mutex;
+};
+
+bool CSigningKey::Set(const CKey& key) {
+    if (!key.IsValid()) {
+        pctx.reset();
+        return false;
+    }
+    std::shared_ptr<Context> pctxNew = std::make_shared<Context>();
+    pctxNew->key.SetSecretBytes(key.begin());
+    pctx = pctxNew;
+    return true;
+}
+
+bool CSigningKey::Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
+    if (!pctx)
+        return false;
+    boost::mutex::scoped_lock lock(pctx->mutex);
+    return pctx->key.Sign(hash, vchSig);
+}
+
 bool CKey::SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig) const {
     if (!fValid)
         return false;
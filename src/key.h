@@ -5,6 +5,7 @@
 #ifndef HONEY_KEY_H
 #define HONEY_KEY_H
 
+#include <memory>
 #include <vector>
 
 #include <allocators.h>
@@ -279,6 +280,27 @@ public:
     static bool CheckSignatureElement(const unsigned char *vch, int len, bool half);
 };
 
+/** A private key with its OpenSSL key set up once, for signing many hashes
+ * with the same key. Copies share the set-up key, and signatures made through
+ * copies on several threads are serialized. The secret lives in OpenSSL's
+ * heap, not in locked memory, until the last copy is destroyed.
+ */
+class CSigningKey
+{
+private:
+    struct Context;
+    std::shared_ptr<Context> pctx;
+
+public:
+    // Set up the OpenSSL key for key, which must be valid.
+    bool Set(const CKey& key);
+
+    bool IsValid() const { return pctx != nullptr; }
+
+    // Create a DER-serialized signature, as CKey::Sign does.
+    bool Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const;
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
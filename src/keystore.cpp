@@ -15,6 +15,14 @@ bool CKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
     return true;
 }
 
+bool CKeyStore::SignHash(const CKeyID &address, const uint256 &hash, std::vector<unsigned char>& vchSig) const
+{
+    CKey key;
+    if (!GetKey(address, key))
+        return false;
+    return key.Sign(hash, vchSig);
+}
+
 bool CKeyStore::AddKey(const CKey &key) {
     return AddKeyPubKey(key, key.GetPubKey());
 }
@@ -30,6 +30,9 @@ public:
     virtual void GetKeys(std::set<CKeyID> &setAddress) const =0;
     virtual bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
 
+    // Sign a hash with the key for address.
+    virtual bool SignHash(const CKeyID &address, const uint256 &hash, std::vector<unsigned char>& vchSig) const;
+
     // Support for BIP 0013 : see https://en.bitcoin.it/wiki/BIP_0013
     virtual bool AddCScript(const CScript& redeemScript) =0;
     virtual bool HaveCScript(const CScriptID &hash) const =0;
@@ -83,6 +86,12 @@ public:
         }
         return false;
     }
+    // Take back a key added to the store, e.g. when writing it out failed
+    virtual void RemoveKey(const CKeyID &address)
+    {
+        LOCK(cs_KeyStore);
+        mapKeys.erase(address);
+    }
     virtual bool AddCScript(const CScript& redeemScript);
     virtual bool HaveCScript(const CScriptID &hash) const;
     virtual bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const;
@@ -15,6 +15,7 @@
 #include <init.h>
 #include <kernel.h>
 #include <net.h>
+#include <notify.h>
 #include <txdb.h>
 #include <txmempool.h>
 #include <ui_interface.h>
@@ -36,6 +37,7 @@ CCriticalSection cs_main;
 CTxMemPool mempool;
 
 std::map<uint256, CBlockIndex*> mapBlockIndex;
+CCriticalSection cs_mapBlockIndex;
 std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 
 uint256 bnProofOfStakeLimit(~uint256(0) >> 20);
@@ -59,6 +61,7 @@ int64_t nTimeBestReceived = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fHaveGUI = false;
+bool fAddressIndex = false;
 
 struct COrphanBlock {
     uint256 hashBlock;
@@ -238,6 +241,8 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 // CTransaction and CTxIndex
 //
 
+std::atomic<uint64_t> CTransaction::nHashesComputed(0);
+
 bool CTransaction::ReadFromDisk(CTxDB& txdb, const uint256& hash, CTxIndex& txindexRet)
 {
     SetNull();
@@ -651,6 +656,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
     }
     }
 
+    int64_t nFeePerKB = 0;
     {
         CTxDB txdb("r");
 
@@ -688,6 +694,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
 
         int64_t nFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
         unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        nFeePerKB = nFees * 1000 / std::max(nSize, 1u);
 
         // Don't accept it if it can't get into a block
         int64_t txMinFee = GetMinFee(tx, 1000, GMF_RELAY, nSize);
@@ -742,9 +749,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
     }
 
     // Store transaction in memory
-    pool.addUnchecked(hash, tx);
+    pool.addUnchecked(hash, tx, nFeePerKB);
 
     SyncWithWallets(tx, nullptr);
+    NotifyTransactionAccepted(tx);
 
     LogPrint("mempool", "AcceptToMemoryPool : accepted %s (poolsz %u)\n",
            hash.ToString(),
@@ -850,23 +858,19 @@ int CTxIndex::GetDepthInMainChain() const
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 {
+    // Needs no cs_main: the mempool has its own lock, and txdb reads only
+    // see committed batches
+    if (mempool.lookup(hash, tx))
+        return true;
+
+    CTxDB txdb("r");
+    CTxIndex txindex;
+    if (tx.ReadFromDisk(txdb, hash, txindex))
     {
-        LOCK(cs_main);
-        {
-            if (mempool.lookup(hash, tx))
-            {
-                return true;
-            }
-        }
-        CTxDB txdb("r");
-        CTxIndex txindex;
-        if (tx.ReadFromDisk(txdb, hash, txindex))
-        {
-            CBlock block;
-            if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-                hashBlock = block.GetHash();
-            return true;
-        }
+        CBlock block;
+        if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            hashBlock = block.GetHash();
+        return true;
     }
     return false;
 }
@@ -894,6 +898,102 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return pblockindex;
 }
 
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    // Every insert takes cs_mapBlockIndex (and cs_main once the node runs),
+    // so lookups must go through here or find(), never operator[]. Entries
+    // added since startup are complete before they are inserted
+    LOCK(cs_mapBlockIndex);
+    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    return mi == mapBlockIndex.end() ? nullptr : mi->second;
+}
+
+static std::shared_ptr<const CChainSnapshot> chainSnapshot = std::make_shared<const CChainSnapshot>();
+// Publishing a snapshot takes the mutex, so waiters can't miss a change
+static boost::mutex mutexChainSnapshot;
+static boost::condition_variable cvChainSnapshot;
+
+void UpdateChainSnapshot(const CBlockIndex* pindexNew)
+{
+    std::shared_ptr<const CChainSnapshot> snapshotOld = GetChainSnapshot();
+    std::shared_ptr<CChainSnapshot> snapshot = std::make_shared<CChainSnapshot>();
+    if (pindexNew)
+    {
+        snapshot->pindexBest = pindexNew;
+        snapshot->hashBestChain = pindexNew->GetBlockHash();
+        snapshot->nHeight = pindexNew->nHeight;
+        snapshot->nMoneySupply = pindexNew->nMoneySupply;
+        snapshot->nChainTrust = pindexNew->nChainTrust;
+
+        // Blocks above the fork with the previous snapshot, tip first
+        std::vector<const CBlockIndex*> vNew;
+        const CBlockIndex* pindexFork = pindexNew;
+        while (pindexFork && !snapshotOld->Contains(pindexFork))
+        {
+            vNew.push_back(pindexFork);
+            pindexFork = pindexFork->pprev;
+        }
+
+        // Share the full chunks below the fork, copy the rest of its chunk
+        const int nFork = pindexFork ? pindexFork->nHeight : -1;
+        const size_t nShared = (nFork + 1) / CChainSnapshot::CHUNK_SIZE;
+        snapshot->vChunks.assign(snapshotOld->vChunks.begin(), snapshotOld->vChunks.begin() + nShared);
+        std::vector<const CBlockIndex*> vChunk;
+        vChunk.reserve(CChainSnapshot::CHUNK_SIZE);
+        if (nShared < snapshotOld->vChunks.size())
+        {
+            const std::vector<const CBlockIndex*>& vOld = *snapshotOld->vChunks[nShared];
+            vChunk.assign(vOld.begin(), vOld.begin() + (nFork + 1 - nShared * CChainSnapshot::CHUNK_SIZE));
+        }
+        for (const CBlockIndex* pindex : reverse_iterate(vNew))
+        {
+            vChunk.push_back(pindex);
+            if (vChunk.size() == (size_t)CChainSnapshot::CHUNK_SIZE)
+            {
+                snapshot->vChunks.push_back(std::make_shared<const std::vector<const CBlockIndex*> >(std::move(vChunk)));
+                vChunk.clear();
+                vChunk.reserve(CChainSnapshot::CHUNK_SIZE);
+            }
+        }
+        if (!vChunk.empty())
+            snapshot->vChunks.push_back(std::make_shared<const std::vector<const CBlockIndex*> >(std::move(vChunk)));
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(mutexChainSnapshot);
+        std::atomic_store(&chainSnapshot, std::shared_ptr<const CChainSnapshot>(snapshot));
+    }
+    cvChainSnapshot.notify_all();
+}
+
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot()
+{
+    return std::atomic_load(&chainSnapshot);
+}
+
+std::shared_ptr<const CChainSnapshot> WaitForChainSnapshot(const std::function<bool(const CChainSnapshot&)>& fnDone, int64_t nTimeoutMillis)
+{
+    boost::unique_lock<boost::mutex> lock(mutexChainSnapshot);
+    const boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(nTimeoutMillis);
+    std::shared_ptr<const CChainSnapshot> snapshot = GetChainSnapshot();
+    while (!fnDone(*snapshot))
+    {
+        if (nTimeoutMillis <= 0)
+            cvChainSnapshot.wait(lock);
+        else if (cvChainSnapshot.wait_until(lock, deadline) == boost::cv_status::timeout)
+            return GetChainSnapshot();
+        snapshot = GetChainSnapshot();
+    }
+    return snapshot;
+}
+
+void WakeChainSnapshotWaiters()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutexChainSnapshot);
+    }
+    cvChainSnapshot.notify_all();
+}
+
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
 {
     if (!fReadTransactions)
@@ -1399,12 +1499,103 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256
     return true;
 }
 
+// Address index changes made by connecting tx at nHeight: a history entry
+// for each output to an address and each input spending one, and the
+// unspent outputs added and removed. mapInputs holds the spent outputs.
+static void GetAddressIndexChanges(const CTransaction& tx, const MapPrevTx& mapInputs, int nHeight, unsigned int nTxPos,
+                                   AddressIndexEntries& vAddressIndex, AddressUnspentEntries& vAddressUnspent)
+{
+    const uint256 hashTx = tx.GetHash();
+    unsigned char nAddressType;
+    uint160 hashAddress;
+
+    if (!tx.IsCoinBase())
+    {
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+        {
+            const COutPoint& prevout = tx.vin[i].prevout;
+            MapPrevTx::const_iterator mi = mapInputs.find(prevout.hash);
+            if (mi == mapInputs.end() || prevout.n >= (*mi).second.second.vout.size())
+                continue;
+            const CTxOut& prev = (*mi).second.second.vout[prevout.n];
+            if (!GetAddressIndexKey(prev.scriptPubKey, nAddressType, hashAddress))
+                continue;
+            vAddressIndex.push_back(std::make_pair(CAddressIndexKey(nAddressType, hashAddress, nHeight, nTxPos, hashTx, i, true), -prev.nValue));
+            vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(nAddressType, hashAddress, prevout.hash, prevout.n), CAddressUnspentValue()));
+        }
+    }
+
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CTxOut& txout = tx.vout[i];
+        if (!GetAddressIndexKey(txout.scriptPubKey, nAddressType, hashAddress))
+            continue;
+        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(nAddressType, hashAddress, nHeight, nTxPos, hashTx, i, false), txout.nValue));
+        vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(nAddressType, hashAddress, hashTx, i), CAddressUnspentValue(txout.nValue, txout.scriptPubKey, nHeight)));
+    }
+}
+
+// Height of the block holding a transaction
+static int GetTxIndexHeight(const CTxIndex& txindex)
+{
+    CBlock block;
+    if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+        return -1;
+    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    if (mi == mapBlockIndex.end())
+        return -1;
+    return (*mi).second->nHeight;
+}
+
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    AddressIndexEntries vAddressIndex;
+    AddressUnspentEntries vAddressUnspent;
+
     // Disconnect in reverse order
     for (int i = vtx.size()-1; i >= 0; i--)
+    {
+        if (fAddressIndex)
+        {
+            // Fetched before the inputs are released; a spend of an earlier
+            // transaction of this block still finds it in the index
+            MapPrevTx mapInputs;
+            bool fInvalid;
+            if (!vtx[i].IsCoinBase() && !vtx[i].FetchInputs(txdb, std::map<uint256, CTxIndex>(), true, false, mapInputs, fInvalid))
+                return error("DisconnectBlock() : FetchInputs failed for address index");
+
+            AddressIndexEntries vTxIndex;
+            AddressUnspentEntries vTxUnspent;
+            GetAddressIndexChanges(vtx[i], mapInputs, pindex->nHeight, i, vTxIndex, vTxUnspent);
+            vAddressIndex.insert(vAddressIndex.end(), vTxIndex.begin(), vTxIndex.end());
+
+            // Undo in reverse: created outputs go away, spent ones come back
+            for (AddressUnspentEntries::iterator it = vTxUnspent.begin(); it != vTxUnspent.end(); ++it)
+            {
+                CAddressUnspentKey& key = (*it).first;
+                if (!(*it).second.IsNull())
+                    (*it).second.SetNull();
+                else
+                {
+                    const std::pair<CTxIndex, CTransaction>& prev = mapInputs[key.txhash];
+                    const CTxOut& txout = prev.second.vout[key.nIndex];
+                    (*it).second = CAddressUnspentValue(txout.nValue, txout.scriptPubKey, GetTxIndexHeight(prev.first));
+                }
+                vAddressUnspent.push_back(*it);
+            }
+        }
+
         if (!vtx[i].DisconnectInputs(txdb))
             return false;
+    }
+
+    if (fAddressIndex)
+    {
+        if (!txdb.EraseAddressIndex(vAddressIndex))
+            return error("DisconnectBlock() : EraseAddressIndex failed");
+        if (!txdb.UpdateAddressUnspentIndex(vAddressUnspent))
+            return error("DisconnectBlock() : UpdateAddressUnspentIndex failed");
+    }
 
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
@@ -1447,6 +1638,8 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
 
     std::map<uint256, CTxIndex> mapQueuedChanges;
+    AddressIndexEntries vAddressIndex;
+    AddressUnspentEntries vAddressUnspent;
     int64_t nFees = 0;
     int64_t nValueIn = 0;
     int64_t nValueOut = 0;
@@ -1512,6 +1705,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
                 return false;
         }
 
+        if (fAddressIndex && !fJustCheck)
+            GetAddressIndexChanges(tx, mapInputs, pindex->nHeight, &tx - &vtx[0], vAddressIndex, vAddressUnspent);
+
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
 
@@ -1537,9 +1733,15 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return DoS(100, error("ConnectBlock() : coinstake pays too much(actual=%d vs calculated=%d)", nStakeReward, nCalculatedStakeReward));
     }
 
-    // ppcoin: track money supply and mint amount info
-    pindex->nMint = nValueOut - nValueIn + nFees;
-    pindex->nMoneySupply = (pindex->pprev? pindex->pprev->nMoneySupply : 0) + nValueOut - nValueIn;
+    // ppcoin: track money supply and mint amount info. RPC reads them without
+    // cs_main for blocks in the chain snapshot, so a block connected again
+    // after a reorg must leave its (equal) values untouched
+    int64_t nMint = nValueOut - nValueIn + nFees;
+    int64_t nMoneySupply = (pindex->pprev? pindex->pprev->nMoneySupply : 0) + nValueOut - nValueIn;
+    if (pindex->nMint != nMint)
+        pindex->nMint = nMint;
+    if (pindex->nMoneySupply != nMoneySupply)
+        pindex->nMoneySupply = nMoneySupply;
     if (!txdb.WriteBlockIndex(CDiskBlockIndex(pindex)))
         return error("Connect() : WriteBlockIndex for pindex failed");
 
@@ -1553,6 +1755,15 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
+    // Address index records go into the same batch as the tx index
+    if (fAddressIndex)
+    {
+        if (!txdb.WriteAddressIndex(vAddressIndex))
+            return error("ConnectBlock() : WriteAddressIndex failed");
+        if (!txdb.UpdateAddressUnspentIndex(vAddressUnspent))
+            return error("ConnectBlock() : UpdateAddressUnspentIndex failed");
+    }
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1777,6 +1988,8 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    UpdateChainSnapshot(pindexBest);
+    NotifyBlockConnected(*this);
 
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
@@ -1899,10 +2112,13 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     pindexNew->bnStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, IsProofOfWork() ? hash : vtx[1].vin[0].prevout.hash);
 
     // Add to mapBlockIndex
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
+    {
+        LOCK(cs_mapBlockIndex);
+        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
+        pindexNew->phashBlock = &((*mi).first);
+    }
     if (pindexNew->IsProofOfStake())
         setStakeSeen.insert(std::make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-    pindexNew->phashBlock = &((*mi).first);
 
     // Write to disk block index
     CTxDB txdb;
@@ -2164,8 +2380,8 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 
     // Check for duplicate
     uint256 hash = pblock->GetHash();
-    if (mapBlockIndex.count(hash))
-        return error("ProcessBlock() : already have block %d %s", mapBlockIndex[hash]->nHeight, hash.ToString());
+    if (const CBlockIndex* pindexHave = LookupBlockIndex(hash))
+        return error("ProcessBlock() : already have block %d %s", pindexHave->nHeight, hash.ToString());
     if (mapOrphanBlocks.count(hash))
         return error("ProcessBlock() : already have block (orphan) %s", hash.ToString());
 
@@ -2318,6 +2534,7 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
                 // make sure coinstake would meet timestamp protocol
                 //    as it would be the same as the block timestamp
                 vtx[0].nTime = nTime = txCoinStake.nTime;
+                vtx[0].InvalidateHash();
 
                 // we have to make sure that we have no future timestamps in
                 //    our transactions set
@@ -2425,6 +2642,32 @@ FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszM
     return file;
 }
 
+bool ReadRawBlockFromDisk(std::string& strRaw, const CBlockIndex* pindex)
+{
+    // CBlock::WriteToDisk puts the message start and the size in front of the block
+    if (pindex->nBlockPos < 8)
+        return error("ReadRawBlockFromDisk() : bad block position");
+    CAutoFile filein = CAutoFile(OpenBlockFile(pindex->nFile, pindex->nBlockPos - 8, "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadRawBlockFromDisk() : OpenBlockFile failed");
+
+    MessageStartChars pchMessageStart;
+    unsigned int nSize;
+    try {
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+    }
+    catch (std::exception &e) {
+        return error("%s() : I/O error", __PRETTY_FUNCTION__);
+    }
+    if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0 || nSize > MAX_BLOCK_SIZE)
+        return error("ReadRawBlockFromDisk() : bad block header");
+
+    strRaw.resize(nSize);
+    if (nSize > 0 && fread(&strRaw[0], 1, nSize, filein) != nSize)
+        return error("ReadRawBlockFromDisk() : fread failed");
+    return true;
+}
+
 static unsigned int nCurrentBlockFile = 1;
 
 FILE* AppendBlockFile(unsigned int& nFileRet)
@@ -2482,10 +2725,65 @@ bool LoadBlockIndex(bool fAllowNew)
         if (!block.AddToBlockIndex(nFile, nBlockPos, Params().HashGenesisBlock()))
             return error("LoadBlockIndex() : genesis block not accepted");
     }
+    else
+        UpdateChainSnapshot(pindexBest);
 
     return true;
 }
 
+// Build the address index from the main chain, for -addressindex turned on
+// with blocks already connected. Logs the time taken per block range.
+bool BuildAddressIndex()
+{
+    LOCK(cs_main);
+    CTxDB txdb;
+    if (!txdb.WipeAddressIndex())
+        return error("BuildAddressIndex() : failed to remove old entries");
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nLastLog = nStart;
+    uint64_t nEntries = 0;
+    int nBlocks = 0;
+    for (CBlockIndex* pindex = pindexGenesisBlock; pindex; pindex = pindex->pnext)
+    {
+        if (ShutdownRequested())
+            return false;
+
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("BuildAddressIndex() : ReadFromDisk failed at height %d", pindex->nHeight);
+
+        AddressIndexEntries vAddressIndex;
+        AddressUnspentEntries vAddressUnspent;
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+        {
+            CTransaction& tx = block.vtx[i];
+            MapPrevTx mapInputs;
+            bool fInvalid;
+            if (!tx.IsCoinBase() && !tx.FetchInputs(txdb, std::map<uint256, CTxIndex>(), true, false, mapInputs, fInvalid))
+                return error("BuildAddressIndex() : FetchInputs failed for %s", tx.GetHash().ToString());
+            GetAddressIndexChanges(tx, mapInputs, pindex->nHeight, i, vAddressIndex, vAddressUnspent);
+        }
+
+        txdb.TxnBegin();
+        if (!txdb.WriteAddressIndex(vAddressIndex) || !txdb.UpdateAddressUnspentIndex(vAddressUnspent) || !txdb.TxnCommit())
+            return error("BuildAddressIndex() : write failed at height %d", pindex->nHeight);
+        nEntries += vAddressIndex.size();
+        nBlocks++;
+
+        if (GetTimeMillis() - nLastLog > 10000)
+        {
+            nLastLog = GetTimeMillis();
+            LogPrintf("BuildAddressIndex() : height %d, %u entries, %dms\n", pindex->nHeight, nEntries, nLastLog - nStart);
+        }
+    }
+
+    if (!txdb.WriteFlag("addressindex", true))
+        return false;
+    LogPrintf("BuildAddressIndex() : indexed %d blocks, %u entries in %dms\n", nBlocks, nEntries, GetTimeMillis() - nStart);
+    return true;
+}
+
 
 
 void PrintBlockTree()
@@ -2747,6 +3045,7 @@ void static ProcessGetData(CNode* pfrom)
 
     LOCK(cs_main);
 
+    pfrom->fGetDataDeferred = false;
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -2755,6 +3054,30 @@ void static ProcessGetData(CNode* pfrom)
         const CInv &inv = *it;
         {
             boost::this_thread::interruption_point();
+
+            // Historic blocks are served at lower priority than relay: they
+            // wait while upload bandwidth is scarce, and stop altogether once
+            // the -maxuploadtarget budget left is needed for new blocks
+            if (inv.type == MSG_BLOCK)
+            {
+                std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                if (mi != mapBlockIndex.end() && pindexBest &&
+                    pindexBest->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)
+                {
+                    if (CNode::OutboundTargetReached(true))
+                    {
+                        LogPrint("net", "historical block serving limit reached, disconnect peer %s\n", pfrom->addrName);
+                        pfrom->fDisconnect = true;
+                        break;
+                    }
+                    if (CNode::IsUploadBandwidthScarce())
+                    {
+                        pfrom->fGetDataDeferred = true;
+                        break;
+                    }
+                }
+            }
+
             it++;
 
             if (inv.type == MSG_BLOCK)
@@ -3063,7 +3386,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 // In case we are on a very long side-chain, it is possible that we already have
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
                 // this situation and push another getblocks to continue.
-                PushGetBlocks(pfrom, mapBlockIndex[inv.hash], uint256(0));
+                PushGetBlocks(pfrom, LookupBlockIndex(inv.hash), uint256(0));
                 if (fDebug)
                     LogPrintf("force request: %s\n", inv.ToString());
             }
@@ -3401,8 +3724,10 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
-    // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return fOk;
+    // this maintains the order of responses. Historic blocks waiting for
+    // upload bandwidth only hold up further getdata, not the peer's other
+    // messages.
+    if (!pfrom->vRecvGetData.empty() && !pfrom->fGetDataDeferred) return fOk;
 
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
@@ -3422,6 +3747,9 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        if (pfrom->IsGetDataWaiting())
+            break;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -3603,38 +3931,62 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: inventory
         //
         std::vector<CInv> vInv;
-        std::vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            for (const CInv& inv : pto->vInventoryToSend)
-            {
-                if (pto->setInventoryKnown.count(inv))
-                    continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+            // Blocks are announced as soon as we have them
+            for (const uint256& hash : pto->vInventoryBlockToSend)
+            {
+                vInv.push_back(CInv(MSG_BLOCK, hash));
+                if (vInv.size() >= 1000)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
+                }
+            }
+            pto->vInventoryBlockToSend.clear();
 
-                    if (fTrickleWait)
+            // Transactions are batched on a per-peer Poisson timer, which hides
+            // their origin and keeps inv messages large. Outbound peers are
+            // less likely to be spies, so they get a shorter delay.
+            int64_t nNow = GetTimeMicros();
+            if (pto->nNextInvSend < nNow && !pto->setInventoryTxToSend.empty())
+            {
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+
+                // Highest fee rate first, so the bounded batch carries what
+                // miners will want. Transactions that left the pool since
+                // they were queued are dropped.
+                std::vector<std::pair<int64_t, uint256> > vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                {
+                    LOCK(mempool.cs);
+                    for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); )
                     {
-                        vInvWait.push_back(inv);
-                        continue;
+                        if (!mempool.mapTx.count(*it))
+                        {
+                            pto->setInventoryTxToSend.erase(it++);
+                            continue;
+                        }
+                        std::map<uint256, int64_t>::const_iterator mi = mempool.mapFeePerKB.find(*it);
+                        vInvTx.push_back(std::make_pair(mi == mempool.mapFeePerKB.end() ? 0 : -(*mi).second, *it));
+                        ++it;
                     }
                 }
+                std::sort(vInvTx.begin(), vInvTx.end());
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                unsigned int nRelayedTransactions = 0;
+                for (const std::pair<int64_t, uint256>& item : vInvTx)
                 {
-                    vInv.push_back(inv);
+                    if (nRelayedTransactions >= INVENTORY_BROADCAST_MAX)
+                        break;
+                    const uint256& hash = item.second;
+                    pto->setInventoryTxToSend.erase(hash);
+                    if (pto->filterInventoryKnown.contains(hash))
+                        continue;
+                    nRelayedTransactions++;
+                    pto->filterInventoryKnown.insert(hash);
+                    vInv.push_back(CInv(MSG_TX, hash));
                     if (vInv.size() >= 1000)
                     {
                         pto->PushMessage("inv", vInv);
@@ -3642,7 +3994,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
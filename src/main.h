@@ -14,8 +14,11 @@
 #include <hash.h>
 #include <uint256.h>
 
+#include <atomic>
+#include <functional>
 #include <limits>
 #include <list>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 
@@ -63,6 +66,7 @@ extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern CCriticalSection cs_mapBlockIndex; // held to insert into mapBlockIndex, see LookupBlockIndex()
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 extern CBlockIndex* pindexGenesisBlock;
 extern int nStakeMinConfirmations;
@@ -84,6 +88,7 @@ extern bool fReindex;
 struct COrphanBlock;
 extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 extern bool fHaveGUI;
+extern bool fAddressIndex;
 
 // Settings
 extern bool fUseFastIndex;
@@ -119,9 +124,14 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+/** Read a block's bytes as stored on disk, which are also its network serialization */
+bool ReadRawBlockFromDisk(std::string& strRaw, const CBlockIndex* pindex);
 bool LoadBlockIndex(bool fAllowNew=true);
+bool BuildAddressIndex();
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Find a block index entry by hash without holding cs_main */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<fs::path> vImportFiles);
@@ -226,13 +236,22 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+private:
+    // memory only: hash of a finalized transaction
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
+public:
+    // Transaction hashes computed so far, cached or not (for benchmarks)
+    static std::atomic<uint64_t> nHashesComputed;
+
     CTransaction()
     {
         SetNull();
     }
 
     CTransaction(int nVersion, unsigned int nTime, const std::vector<CTxIn>& vin, const std::vector<CTxOut>& vout, unsigned int nLockTime)
-        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), nDoS(0)
+        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), nDoS(0), fHashCached(false)
     {
     }
 
@@ -244,6 +263,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            UpdateHash();
     )
 
     void SetNull()
@@ -254,6 +275,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -263,9 +285,40 @@ public:
 
     uint256 GetHash() const
     {
+        if (fHashCached)
+        {
+#ifdef DEBUG_HASHCACHE
+            // a finalized transaction was modified without InvalidateHash()
+            assert(hashCached == SerializeHash(*this));
+#endif
+            return hashCached;
+        }
+        nHashesComputed.fetch_add(1, std::memory_order_relaxed);
         return SerializeHash(*this);
     }
 
+    /** Finalize the transaction: compute its hash once and return the cached
+        value from GetHash() from now on.  Deserialized transactions are
+        finalized automatically; code that builds a transaction calls this
+        once construction and signing are complete.
+     */
+    void UpdateHash() const
+    {
+        fHashCached = false;
+        nHashesComputed.fetch_add(1, std::memory_order_relaxed);
+        hashCached = SerializeHash(*this);
+        fHashCached = true;
+    }
+
+    /** Drop the cached hash.  Must be called after modifying a transaction
+        that may have been finalized (deserialized or UpdateHash()'d).
+        Compile with -DDEBUG_HASHCACHE to have GetHash() assert on a stale hash.
+     */
+    void InvalidateHash() const
+    {
+        fHashCached = false;
+    }
+
     bool IsCoinBase() const
     {
         return (vin.size() == 1 && vin[0].prevout.IsNull() && vout.size() >= 1);
@@ -597,6 +650,12 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+private:
+    // memory only: header hash of a finalized block
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
+public:
     CBlock()
     {
         SetNull();
@@ -623,6 +682,8 @@ public:
             const_cast<CBlock*>(this)->vtx.clear();
             const_cast<CBlock*>(this)->vchBlockSig.clear();
         }
+        if (fRead)
+            UpdateHash();
     )
 
     void SetNull()
@@ -637,6 +698,7 @@ public:
         vchBlockSig.clear();
         vMerkleTree.clear();
         nDoS = 0;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -651,9 +713,33 @@ public:
 
     uint256 GetPoWHash() const
     {
+        if (fHashCached)
+        {
+#ifdef DEBUG_HASHCACHE
+            // a finalized header was modified without InvalidateHash()
+            assert(hashCached == HashBlake2s(BEGIN(nVersion), END(nNonce)));
+#endif
+            return hashCached;
+        }
         return HashBlake2s(BEGIN(nVersion), END(nNonce));
     }
 
+    /** Finalize the header: cache its hash until InvalidateHash() is called.
+        Deserialized blocks are finalized automatically; blocks being built or
+        mined are not, as their header keeps changing.
+     */
+    void UpdateHash() const
+    {
+        hashCached = HashBlake2s(BEGIN(nVersion), END(nNonce));
+        fHashCached = true;
+    }
+
+    /** Drop the cached header hash after modifying a finalized block. */
+    void InvalidateHash() const
+    {
+        fHashCached = false;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -1298,6 +1384,75 @@ public:
 
 
 
+/** Immutable view of the best chain, published after every change of tip.
+ * Read-only RPC calls work from one of these instead of holding cs_main:
+ * block index entries never move or go away, so the pointers stay valid,
+ * and main chain membership is answered from the snapshot, not pnext.
+ */
+class CChainSnapshot
+{
+public:
+    static const int CHUNK_SIZE = 4096;
+
+    const CBlockIndex* pindexBest;
+    uint256 hashBestChain;
+    int nHeight;
+    int64_t nMoneySupply;
+    uint256 nChainTrust;
+
+    CChainSnapshot()
+    {
+        pindexBest = nullptr;
+        hashBestChain = 0;
+        nHeight = -1;
+        nMoneySupply = 0;
+        nChainTrust = 0;
+    }
+
+    /** Main chain block at nHeightIn, or nullptr if there is none */
+    const CBlockIndex* operator[](int nHeightIn) const
+    {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return nullptr;
+        return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE];
+    }
+
+    bool Contains(const CBlockIndex* pindex) const
+    {
+        return pindex && (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Successor of a main chain block, or nullptr at the tip */
+    const CBlockIndex* Next(const CBlockIndex* pindex) const
+    {
+        return Contains(pindex) ? (*this)[pindex->nHeight + 1] : nullptr;
+    }
+
+    /** Confirmations of a block, 0 if it is not in the main chain */
+    int GetDepth(const CBlockIndex* pindex) const
+    {
+        return Contains(pindex) ? nHeight - pindex->nHeight + 1 : 0;
+    }
+
+private:
+    // Full chunks are shared between successive snapshots, so publishing
+    // a new tip only copies the last partial chunk
+    std::vector<std::shared_ptr<const std::vector<const CBlockIndex*> > > vChunks;
+
+    friend void UpdateChainSnapshot(const CBlockIndex* pindexNew);
+};
+
+/** Publish a snapshot of the chain ending at pindexNew (nullptr for an empty one), called with cs_main held */
+void UpdateChainSnapshot(const CBlockIndex* pindexNew);
+/** Latest published chain snapshot, never nullptr */
+std::shared_ptr<const CChainSnapshot> GetChainSnapshot();
+/** Block until fnDone accepts the published snapshot, or nTimeoutMillis pass
+ * (0 waits without limit). Returns the latest snapshot either way. fnDone is
+ * called with an internal lock held and must not block. */
+std::shared_ptr<const CChainSnapshot> WaitForChainSnapshot(const std::function<bool(const CChainSnapshot&)>& fnDone, int64_t nTimeoutMillis);
+/** Make every WaitForChainSnapshot() re-check its condition, e.g. at shutdown */
+void WakeChainSnapshotWaiters();
+
 class CWalletInterface {
 protected:
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, bool fConnect) =0;
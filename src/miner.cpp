@@ -85,41 +85,75 @@ public:
     }
 };
 
-// CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
-CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees)
+void CTemplateMerkleTree::push_back(const uint256& hash)
 {
-    // Create new block
-    std::unique_ptr<CBlock> pblock(new CBlock());
-    if (!pblock.get())
-        return nullptr;
+    vLevels[0].push_back(hash);
+    size_t nIndex = vLevels[0].size() - 1;
+    for (size_t nLevel = 0; vLevels[nLevel].size() > 1; nLevel++)
+    {
+        if (vLevels.size() == nLevel + 1)
+            vLevels.push_back(std::vector<uint256>());
+        const std::vector<uint256>& vLevel = vLevels[nLevel];
+        std::vector<uint256>& vParent = vLevels[nLevel + 1];
+        nIndex /= 2;
+        if (vParent.size() <= nIndex)
+            vParent.resize(nIndex + 1);
+        if (nIndex == 0)
+            continue;
+        // An odd node out is paired with itself, as in BuildMerkleTree()
+        const uint256& left = vLevel[nIndex * 2];
+        const uint256& right = vLevel[std::min(nIndex * 2 + 1, vLevel.size() - 1)];
+        vParent[nIndex] = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+    }
+}
 
-    CBlockIndex* pindexPrev = pindexBest;
-    int nHeight = pindexPrev->nHeight + 1;
+std::vector<uint256> CTemplateMerkleTree::GetFirstBranch() const
+{
+    std::vector<uint256> vBranch;
+    for (size_t nLevel = 0; nLevel < vLevels.size() && vLevels[nLevel].size() > 1; nLevel++)
+        vBranch.push_back(vLevels[nLevel][1]);
+    return vBranch;
+}
 
-    // Create coinbase tx
-    CTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
+bool CTxSelection::GetChosenOutputValue(const COutPoint& prevout, int64_t& nValue) const
+{
+    AssertLockHeld(mempool.cs);
+    // mapTestPool also holds the chain transactions the selection spends from
+    if (!setChosen.count(prevout.hash))
+        return false;
+    std::map<uint256, CTransaction>::const_iterator mi = mempool.mapTx.find(prevout.hash);
+    if (mi == mempool.mapTx.end() || prevout.n >= (*mi).second.vout.size())
+        return false;
+    nValue = (*mi).second.vout[prevout.n].nValue;
+    return true;
+}
 
-    if (!fProofOfStake)
-    {
-        CPubKey pubkey;
-        if (!reservekey.GetReservedKey(pubkey))
-            return nullptr;
-        txNew.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
-    }
-    else
-    {
-        // Height first in coinbase required for block.version=2
-        txNew.vin[0].scriptSig = (CScript() << nHeight) + COINBASE_FLAGS;
-        assert(txNew.vin[0].scriptSig.size() <= 100);
+static CTxSelection txSelection; // guarded by cs_main
 
-        txNew.vout[0].SetEmpty();
+// Bring txSelection up to date for a block on top of pindexPrev, taking
+// transactions with nTime up to nTimeLimit
+static void UpdateTxSelection(CBlockIndex* pindexPrev, int64_t nTimeLimit)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    CTxSelection& selection = txSelection;
+    const uint256 hashPrevBlock = pindexPrev->GetBlockHash();
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    if (selection.hashPrevBlock == hashPrevBlock && selection.nTransactionsUpdated == nTransactionsUpdated && !selection.fRetry)
+        return;
+
+    bool fRebuild = selection.hashPrevBlock != hashPrevBlock;
+    for (unsigned int i = 0; i < selection.vtx.size() && !fRebuild; i++)
+        fRebuild = !mempool.mapTx.count(selection.vtx[i].GetHash());
+    if (fRebuild)
+    {
+        selection.SetNull();
+        selection.hashPrevBlock = hashPrevBlock;
     }
+    selection.nTransactionsUpdated = nTransactionsUpdated;
+    selection.fRetry = false;
 
-    // Add our coinbase tx as first transaction
-    pblock->vtx.push_back(txNew);
+    const int nHeight = pindexPrev->nHeight + 1;
 
     // Largest block you're willing to create:
     unsigned int nBlockMaxSize = GetArg("-blockmaxsize", MAX_BLOCK_SIZE_GEN/2);
@@ -140,183 +174,239 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
     if (mapArgs.count("-mintxfee"))
         ParseMoney(mapArgs["-mintxfee"], nMinTxFee);
 
-    pblock->nBits = GetNextTargetRequired(pindexPrev, fProofOfStake);
-
-    // Collect memory pool transactions into the block
-    int64_t nFees = 0;
-    {
-        LOCK2(cs_main, mempool.cs);
-        CTxDB txdb("r");
+    CTxDB txdb("r");
 
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
+    // Priority order to process transactions
+    std::list<COrphan> vOrphan; // list memory doesn't move
+    std::map<uint256, std::vector<COrphan*> > mapDependers;
 
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (std::map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+    // This vector will be sorted into a priority queue:
+    std::vector<TxPriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (std::map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+    {
+        CTransaction& tx = (*mi).second;
+        if (tx.IsCoinBase() || tx.IsCoinStake() || selection.setSeen.count((*mi).first) || !IsFinalTx(tx, nHeight))
+            continue;
+
+        COrphan* porphan = nullptr;
+        int64_t nTotalIn = 0;
+        bool fMissingInputs = false;
+        for (const CTxIn& txin : tx.vin)
         {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            // Already chosen
+            int64_t nValueChosen;
+            if (selection.GetChosenOutputValue(txin.prevout, nValueChosen))
+            {
+                nTotalIn += nValueChosen;
                 continue;
+            }
 
-            COrphan* porphan = nullptr;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            for (const CTxIn& txin : tx.vin)
+            // Read prev transaction
+            CTransaction txPrev;
+            CTxIndex txindex;
+            if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
             {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
+                // This should never happen; all transactions in the memory
+                // pool should connect to either transactions in the chain
+                // or other transactions in the memory pool.
+                if (!mempool.mapTx.count(txin.prevout.hash))
                 {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
+                    LogPrintf("ERROR: mempool transaction missing input\n");
+                    if (fDebug) assert("mempool transaction missing input" == 0);
+                    fMissingInputs = true;
+                    if (porphan)
+                        vOrphan.pop_back();
+                    break;
+                }
 
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                    continue;
+                // Has to wait for dependencies
+                if (!porphan)
+                {
+                    // Use list for automatic deletion
+                    vOrphan.push_back(COrphan(&tx));
+                    porphan = &vOrphan.back();
                 }
-                int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+                mapDependers[txin.prevout.hash].push_back(porphan);
+                porphan->setDependsOn.insert(txin.prevout.hash);
+                nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
+                continue;
             }
-            if (fMissingInputs) continue;
+            int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
+            nTotalIn += nValueIn;
+        }
+        if (fMissingInputs)
+        {
+            selection.setSeen.insert((*mi).first);
+            continue;
+        }
 
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        // Priority is sum(valuein * age) / txsize
+        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
+        // This is a more accurate fee-per-kilobyte than is used by the client code, because the
+        // client code rounds up the size to the nearest 1K. That's good, because it gives an
+        // incentive to create smaller transactions.
+        double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
 
-            if (porphan)
-            {
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dFeePerKb, &(*mi).second));
+        if (porphan)
+        {
+            porphan->dFeePerKb = dFeePerKb;
         }
+        else
+            vecPriority.push_back(TxPriority(dFeePerKb, &(*mi).second));
+    }
 
-        // Collect transactions into block
-        std::map<uint256, CTxIndex> mapTestPool;
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-
-        TxPriorityCompare comparer;
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+    // Collect transactions into block
+    TxPriorityCompare comparer;
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dFeePerKb = vecPriority.front().get<0>();
-            CTransaction& tx = *(vecPriority.front().get<1>());
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        double dFeePerKb = vecPriority.front().get<0>();
+        CTransaction& tx = *(vecPriority.front().get<1>());
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        // Timestamp limit, the only reason to look at a transaction again
+        if (tx.nTime > nTimeLimit)
+        {
+            selection.fRetry = true;
+            continue;
+        }
+        uint256 hash = tx.GetHash();
+        selection.setSeen.insert(hash);
+
+        // Size limits
+        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        if (selection.nBlockSize + nTxSize >= nBlockMaxSize)
+            continue;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (selection.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Transaction fee
+        int64_t nMinFee = GetMinFee(tx, selection.nBlockSize, GMF_BLOCK);
+
+        // Skip free transactions if we're past the minimum block size:
+        if ((dFeePerKb < nMinTxFee) && (selection.nBlockSize + nTxSize >= nBlockMinSize))
+            continue;
+
+        // Connecting shouldn't fail due to dependency on other memory pool transactions
+        // because we're already processing them in order of dependency
+        std::map<uint256, CTxIndex> mapTestPoolTmp(selection.mapTestPool);
+        MapPrevTx mapInputs;
+        bool fInvalid;
+        if (!tx.FetchInputs(txdb, mapTestPoolTmp, false, true, mapInputs, fInvalid))
+            continue;
+
+        int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
+        if (nTxFees < nMinFee)
+            continue;
+
+        nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
+        if (selection.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
+            continue;
+        mapTestPoolTmp[hash] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
+        std::swap(selection.mapTestPool, mapTestPoolTmp);
+
+        // Added
+        selection.vtx.push_back(tx);
+        selection.setChosen.insert(hash);
+        selection.merkle.push_back(hash);
+        selection.nBlockSize += nTxSize;
+        selection.nBlockSigOps += nTxSigOps;
+        selection.nFees += nTxFees;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        if (fDebug && GetBoolArg("-printpriority", false))
+        {
+            LogPrintf("feeperkb %.1f txid %s\n",
+                   dFeePerKb, hash.ToString());
+        }
 
-            // Timestamp limit
-            if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
-                continue;
+        // Add transactions that depend on this one to the priority queue
+        if (mapDependers.count(hash))
+        {
+            for (COrphan* porphan : mapDependers[hash])
+            {
+                if (!porphan->setDependsOn.empty())
+                {
+                    porphan->setDependsOn.erase(hash);
+                    if (porphan->setDependsOn.empty())
+                    {
+                        vecPriority.push_back(TxPriority(porphan->dFeePerKb, porphan->ptx));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    }
+                }
+            }
+        }
+    }
 
-            // Transaction fee
-            int64_t nMinFee = GetMinFee(tx, nBlockSize, GMF_BLOCK);
+    if (fDebug && GetBoolArg("-printpriority", false))
+        LogPrintf("CreateNewBlock(): total size %u\n", selection.nBlockSize);
+}
 
-            // Skip free transactions if we're past the minimum block size:
-            if ((dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+// CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
+CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees, std::vector<uint256>* pvCoinbaseBranch)
+{
+    // Create new block
+    std::unique_ptr<CBlock> pblock(new CBlock());
+    if (!pblock.get())
+        return nullptr;
 
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            std::map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            MapPrevTx mapInputs;
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapTestPoolTmp, false, true, mapInputs, fInvalid))
-                continue;
+    CBlockIndex* pindexPrev = pindexBest;
+    int nHeight = pindexPrev->nHeight + 1;
 
-            int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
-            if (nTxFees < nMinFee)
-                continue;
+    // Create coinbase tx
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
 
-            nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    if (!fProofOfStake)
+    {
+        CPubKey pubkey;
+        if (!reservekey.GetReservedKey(pubkey))
+            return nullptr;
+        txNew.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
+    }
+    else
+    {
+        // Height first in coinbase required for block.version=2
+        txNew.vin[0].scriptSig = (CScript() << nHeight) + COINBASE_FLAGS;
+        assert(txNew.vin[0].scriptSig.size() <= 100);
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
-                continue;
-            mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
-            std::swap(mapTestPool, mapTestPoolTmp);
+        txNew.vout[0].SetEmpty();
+    }
 
-            // Added
-            pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+    // Add our coinbase tx as first transaction
+    pblock->vtx.push_back(txNew);
 
-            if (fDebug && GetBoolArg("-printpriority", false))
-            {
-                LogPrintf("feeperkb %.1f txid %s\n",
-                       dFeePerKb, tx.GetHash().ToString());
-            }
+    pblock->nBits = GetNextTargetRequired(pindexPrev, fProofOfStake);
 
-            // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
-            {
-                for (COrphan* porphan : mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+    // Collect memory pool transactions into the block
+    int64_t nFees = 0;
+    {
+        LOCK2(cs_main, mempool.cs);
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
+        UpdateTxSelection(pindexPrev, fProofOfStake ? (int64_t)pblock->vtx[0].nTime : GetAdjustedTime());
+        pblock->vtx.insert(pblock->vtx.end(), txSelection.vtx.begin(), txSelection.vtx.end());
+        nFees = txSelection.nFees;
+        if (pvCoinbaseBranch)
+            *pvCoinbaseBranch = txSelection.merkle.GetFirstBranch();
 
-        if (fDebug && GetBoolArg("-printpriority", false))
-            LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        nLastBlockTx = txSelection.vtx.size();
+        nLastBlockSize = txSelection.nBlockSize;
 
         if (!fProofOfStake)
             pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(nFees);
@@ -336,7 +426,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
 }
 
 
-void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseBranch)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
@@ -349,9 +439,13 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+    pblock->vtx[0].InvalidateHash();
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
 
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    if (pvCoinbaseBranch)
+        pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(pblock->vtx[0].GetHash(), *pvCoinbaseBranch, 0);
+    else
+        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
 
@@ -450,7 +544,10 @@ bool CheckStake(CBlock* pblock, CWallet& wallet)
         return error("CheckStake() : %s is not a proof-of-stake block", hashBlock.GetHex());
 
     // verify hash target and signature of coinstake tx
-    if (!CheckProofOfStake(mapBlockIndex[pblock->hashPrevBlock], pblock->vtx[1], pblock->nBits, proofHash, hashTarget))
+    CBlockIndex* pindexPrev = LookupBlockIndex(pblock->hashPrevBlock);
+    if (!pindexPrev)
+        return error("CheckStake() : previous block %s not found", pblock->hashPrevBlock.GetHex());
+    if (!CheckProofOfStake(pindexPrev, pblock->vtx[1], pblock->nBits, proofHash, hashTarget))
         return error("CheckStake() : proof-of-stake checking failed");
 
     //// debug print
@@ -531,6 +628,10 @@ void ThreadStakeMiner(CWallet *pwallet)
             MilliSleep(500);
         }
         else
+        {
+            // Nothing to stake, a good time to tidy up small outputs
+            pwallet->ConsolidateStakeOutputs();
             MilliSleep(nMinerSleep);
+        }
     }
 }
@@ -9,11 +9,75 @@
 #include <main.h>
 #include <wallet.h>
 
-/* Generate a new block, without valid proof-of-work */
-CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake=false, int64_t* pFees = 0);
+/** Merkle tree of a block whose first transaction is still to be filled in.
+ * Appending a transaction rehashes only its path to the root, and the branch
+ * of the first transaction is available without hashing. */
+class CTemplateMerkleTree
+{
+public:
+    CTemplateMerkleTree() { clear(); }
 
-/** Modify the extranonce in a block */
-void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+    void clear() { vLevels.assign(1, std::vector<uint256>(1)); }
+    void push_back(const uint256& hash);
+    /** Branch of the first transaction, for CBlock::CheckMerkleBranch(hash, branch, 0) */
+    std::vector<uint256> GetFirstBranch() const;
+
+private:
+    // Level 0 holds the transaction hashes. Nodes above the first
+    // transaction depend on it and are never computed.
+    std::vector<std::vector<uint256> > vLevels;
+};
+
+/** Memory pool transactions chosen for a block on top of hashPrevBlock.
+ * Rebuilt when the best block changes or a chosen transaction leaves the
+ * pool; otherwise only transactions not seen before are looked at. */
+class CTxSelection
+{
+public:
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated;
+    bool fRetry;                                // transactions were skipped as too new
+    std::vector<CTransaction> vtx;
+    std::set<uint256> setSeen;                  // chosen or rejected for this block
+    std::set<uint256> setChosen;                // hashes of vtx
+    std::map<uint256, CTxIndex> mapTestPool;    // outputs spent and created by vtx
+    CTemplateMerkleTree merkle;                 // coinbase and vtx
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    int64_t nFees;
+
+    CTxSelection()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        hashPrevBlock = 0;
+        nTransactionsUpdated = 0;
+        fRetry = false;
+        vtx.clear();
+        setSeen.clear();
+        setChosen.clear();
+        mapTestPool.clear();
+        merkle.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+    }
+
+    /** Value of an output of a chosen transaction, false if prevout isn't one */
+    bool GetChosenOutputValue(const COutPoint& prevout, int64_t& nValue) const;
+};
+
+/* Generate a new block, without valid proof-of-work. The memory pool
+   transactions come from a selection shared by all callers, which is only
+   extended while the best block stays the same. */
+CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake=false, int64_t* pFees = 0, std::vector<uint256>* pvCoinbaseBranch = nullptr);
+
+/** Modify the extranonce in a block. With the coinbase branch returned by
+ * CreateNewBlock the merkle root is updated without rebuilding the tree. */
+void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseBranch = nullptr);
 
 /** Do mining precalculation */
 void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash1);
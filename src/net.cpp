@@ -11,6 +11,8 @@
 #include <addrman.h>
 #include <ui_interface.h>
 
+#include <math.h>
+
 #ifdef WIN32
 #include <string.h>
 #endif
@@ -31,6 +33,15 @@
 
 static const int MAX_OUTBOUND_CONNECTIONS = 16;
 
+// Maximum number of outbound connection attempts run in parallel
+static const int MAX_CONNECT_BATCH = 8;
+
+// Number of acceptable addresses compared when choosing where to connect
+static const int CONNECT_CANDIDATES = 3;
+
+// Maximum number of addresses to keep connect statistics for
+static const unsigned int MAX_CONNECT_STATS = 10000;
+
 bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = nullptr, const char *strDest = nullptr, bool fOneShot = false);
 
 
@@ -72,6 +83,19 @@ CCriticalSection cs_vAddedNodes;
 
 static CSemaphore *semOutbound = nullptr;
 
+/** Outcome of our outbound connection attempts to one address */
+struct CConnectStats
+{
+    int64_t nLatency;   // smoothed time to connect in ms, over successful attempts
+    int nSuccess;       // number of successful attempts
+    int nFailure;       // number of failed attempts since the last success
+
+    CConnectStats() : nLatency(0), nSuccess(0), nFailure(0) {}
+};
+
+static CCriticalSection cs_mapConnectStats;
+static std::map<CService, CConnectStats> mapConnectStats;
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -312,6 +336,11 @@ void AddressCurrentlyConnected(const CService& addr)
 
 uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
+CTokenBucket CNode::sendBucketTotal;
+uint64_t CNode::nMaxPeerUploadRate = 0;
+uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
+uint64_t CNode::nMaxOutboundCycleStartTime = 0;
+uint64_t CNode::nMaxOutboundLimit = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
 
@@ -346,6 +375,34 @@ CNode* FindNode(const CService& addr)
     return nullptr;
 }
 
+static void RecordConnectAttempt(const CService& addr, bool fSuccess, int64_t nMillis)
+{
+    LOCK(cs_mapConnectStats);
+    if (mapConnectStats.size() >= MAX_CONNECT_STATS && !mapConnectStats.count(addr))
+        mapConnectStats.erase(mapConnectStats.begin());
+
+    CConnectStats& stats = mapConnectStats[addr];
+    if (fSuccess) {
+        stats.nLatency = stats.nSuccess ? (stats.nLatency * 3 + nMillis) / 4 : nMillis;
+        stats.nSuccess++;
+        stats.nFailure = 0;
+    } else {
+        stats.nFailure++;
+    }
+}
+
+// Expected cost in ms of connecting to addr: its measured latency (half the
+// timeout if unknown), plus a full timeout for every failure since the last success.
+static int64_t GetConnectScore(const CService& addr)
+{
+    LOCK(cs_mapConnectStats);
+    std::map<CService, CConnectStats>::const_iterator it = mapConnectStats.find(addr);
+    if (it == mapConnectStats.end())
+        return nConnectTimeout / 2;
+    const CConnectStats& stats = it->second;
+    return (stats.nSuccess ? stats.nLatency : nConnectTimeout / 2) + (int64_t)stats.nFailure * nConnectTimeout;
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
 {
     if (pszDest == nullptr) {
@@ -370,10 +427,13 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
     // Connect
     SOCKET hSocket;
     bool proxyConnectionFailed = false;
+    int64_t nStart = GetTimeMillis();
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
         addrman.Attempt(addrConnect);
+        if (!pszDest)
+            RecordConnectAttempt(addrConnect, true, GetTimeMillis() - nStart);
 
         LogPrint("net", "connected %s\n", pszDest ? pszDest : addrConnect.ToString());
 
@@ -402,6 +462,8 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         // If connecting to the node failed, and failure is not caused by a problem connecting to
         // the proxy, mark this as an attempt.
         addrman.Attempt(addrConnect);
+        if (!pszDest)
+            RecordConnectAttempt(addrConnect, false, GetTimeMillis() - nStart);
     }
 
     return nullptr;
@@ -614,16 +676,20 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 void SocketSendData(CNode *pnode)
 {
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    uint64_t nAllowance = pnode->GetSendAllowance();
 
-    while (it != pnode->vSendMsg.end()) {
+    while (it != pnode->vSendMsg.end() && nAllowance > 0) {
         const CSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nToSend = std::min((uint64_t)(data.size() - pnode->nSendOffset), nAllowance);
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
             pnode->nSendOffset += nBytes;
+            pnode->sendBucket.Consume(nBytes);
             pnode->RecordBytesSent(nBytes);
+            nAllowance -= nBytes;
             if (pnode->nSendOffset == data.size()) {
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
@@ -654,6 +720,11 @@ void SocketSendData(CNode *pnode)
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 static std::list<CNode*> vNodesDisconnected;
 
 void ThreadSocketHandler()
@@ -756,9 +827,12 @@ void ThreadSocketHandler()
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
                     if (lockSend) {
-                        // do not read, if draining write queue
-                        if (!pnode->vSendMsg.empty())
-                            FD_SET(pnode->hSocket, &fdsetSend);
+                        // do not read, if draining write queue; while the
+                        // upload rate limit is exhausted wait for the timeout
+                        if (!pnode->vSendMsg.empty()) {
+                            if (pnode->GetSendAllowance() > 0)
+                                FD_SET(pnode->hSocket, &fdsetSend);
+                        }
                         else
                             FD_SET(pnode->hSocket, &fdsetRecv);
                         FD_SET(pnode->hSocket, &fdsetError);
@@ -1129,10 +1203,17 @@ void ThreadDNSAddressSeed()
 
 void DumpAddresses()
 {
+    // Don't rewrite peers.dat if nothing changed since the last flush
+    static uint64_t nLastChanges = 0;
+    uint64_t nChanges = addrman.GetChangeCount();
+    if (nChanges == nLastChanges)
+        return;
+
     int64_t nStart = GetTimeMillis();
 
     CAddrDB adb;
-    adb.Write(addrman);
+    if (adb.Write(addrman))
+        nLastChanges = nChanges;
 
     LogPrint("net", "Flushed %d addresses to peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
@@ -1156,6 +1237,53 @@ void static ProcessOneShot()
     }
 }
 
+// Choose an address to connect to based on most recently seen.  Among the first
+// few acceptable candidates, prefer the one that has connected fastest before.
+static CAddress SelectOutboundAddress(const std::set<std::vector<unsigned char> >& setConnected, int nOutbound, int64_t nANow)
+{
+    CAddress addrConnect;
+    int64_t nBestScore = 0;
+    int nCandidates = 0;
+    int nTries = 0;
+    while (true)
+    {
+        // With next to no outbound connections (e.g. right after startup) try the
+        // peers we most recently had working connections to first.
+        CAddress addr = (nOutbound < 2 && nTries < 10) ? addrman.SelectRecentlyGood() : addrman.Select();
+
+        // if we selected an invalid address, restart
+        if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
+            break;
+
+        // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
+        // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
+        // already-connected network ranges, ...) before trying new addrman addresses.
+        nTries++;
+        if (nTries > 100)
+            break;
+
+        if (IsLimited(addr))
+            continue;
+
+        // only consider very recently tried nodes after 30 failed attempts
+        if (nANow - addr.nLastTry < 600 && nTries < 30)
+            continue;
+
+        // do not allow non-default ports, unless after 50 invalid addresses selected already
+        if (addr.GetPort() != Params().GetDefaultPort() && nTries < 5)
+            continue;
+
+        int64_t nScore = GetConnectScore(addr);
+        if (!addrConnect.IsValid() || nScore < nBestScore) {
+            addrConnect = addr;
+            nBestScore = nScore;
+        }
+        if (++nCandidates >= CONNECT_CANDIDATES)
+            break;
+    }
+    return addrConnect;
+}
+
 void ThreadOpenConnections()
 {
     // Connect to specific addresses
@@ -1198,11 +1326,6 @@ void ThreadOpenConnections()
             }
         }
 
-        //
-        // Choose an address to connect to based on most recently seen
-        //
-        CAddress addrConnect;
-
         // Only connect out to one peer per network group (/16 for IPv4).
         // Do this here so we don't have to critsect vNodes inside mapAddresses critsect.
         int nOutbound = 0;
@@ -1219,39 +1342,42 @@ void ThreadOpenConnections()
 
         int64_t nANow = GetAdjustedTime();
 
-        int nTries = 0;
-        while (true)
+        // Take every free outbound slot (up to MAX_CONNECT_BATCH) and pick an
+        // address for each, so that all of them can be connected in parallel.
+        CSemaphoreGrant vGrant[MAX_CONNECT_BATCH];
+        std::vector<CAddress> vConnect;
+        grant.MoveTo(vGrant[0]);
+        while (vConnect.size() < MAX_CONNECT_BATCH)
         {
-            CAddress addr = addrman.Select();
-
-            // if we selected an invalid address, restart
-            if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
-                break;
+            if (!vConnect.empty()) {
+                CSemaphoreGrant grantNext(*semOutbound, true);
+                if (!grantNext)
+                    break;
+                grantNext.MoveTo(vGrant[vConnect.size()]);
+            }
 
-            // If we didn't find an appropriate destination after trying 100 addresses fetched from addrman,
-            // stop this loop, and let the outer loop run again (which sleeps, adds seed nodes, recalculates
-            // already-connected network ranges, ...) before trying new addrman addresses.
-            nTries++;
-            if (nTries > 100)
+            CAddress addrConnect = SelectOutboundAddress(setConnected, nOutbound, nANow);
+            if (!addrConnect.IsValid())
                 break;
-
-            if (IsLimited(addr))
-                continue;
-
-            // only consider very recently tried nodes after 30 failed attempts
-            if (nANow - addr.nLastTry < 600 && nTries < 30)
-                continue;
-
-            // do not allow non-default ports, unless after 50 invalid addresses selected already
-            if (addr.GetPort() != Params().GetDefaultPort() && nTries < 5)
-                continue;
-
-            addrConnect = addr;
-            break;
+            setConnected.insert(addrConnect.GetGroup());
+            vConnect.push_back(addrConnect);
         }
 
-        if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+        if (vConnect.size() == 1) {
+            OpenNetworkConnection(vConnect[0], &vGrant[0]);
+        } else if (vConnect.size() > 1) {
+            // Each attempt blocks for up to nConnectTimeout, so run them side by side
+            boost::thread_group threadConnect;
+            for (unsigned int i = 0; i < vConnect.size(); i++)
+                threadConnect.create_thread(boost::bind(&OpenNetworkConnection, vConnect[i], &vGrant[i], (const char*)nullptr, false));
+            try {
+                threadConnect.join_all();
+            } catch (boost::thread_interrupted) {
+                threadConnect.interrupt_all();
+                threadConnect.join_all();
+                throw;
+            }
+        }
     }
 }
 
@@ -1437,7 +1563,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if ((!pnode->vRecvGetData.empty() && !pnode->fGetDataDeferred) || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete() && !pnode->IsGetDataWaiting()))
                         {
                             fSleep = false;
                         }
@@ -1733,6 +1859,118 @@ void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+    sendBucketTotal.Consume(bytes);
+
+    uint64_t now = GetTime();
+    if (nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME < now)
+    {
+        // timeframe expired, reset cycle
+        nMaxOutboundCycleStartTime = now;
+        nMaxOutboundTotalBytesSentInCycle = 0;
+    }
+
+    nMaxOutboundTotalBytesSentInCycle += bytes;
+}
+
+void CNode::SetMaxOutboundTarget(uint64_t nLimit)
+{
+    LOCK(cs_totalBytesSent);
+    uint64_t nRecommendedMinimum = (MAX_UPLOAD_TIMEFRAME / GetTargetSpacing(nBestHeight)) * UPLOAD_TARGET_BLOCK_RESERVE;
+    nMaxOutboundLimit = nLimit;
+
+    if (nLimit > 0 && nLimit < nRecommendedMinimum)
+        LogPrintf("Max outbound target is very small (%s bytes) and will be overshot. Recommended minimum is %s bytes.\n", nMaxOutboundLimit, nRecommendedMinimum);
+}
+
+uint64_t CNode::GetMaxOutboundTarget()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundLimit;
+}
+
+uint64_t CNode::GetMaxOutboundTimeframe()
+{
+    return MAX_UPLOAD_TIMEFRAME;
+}
+
+uint64_t CNode::GetMaxOutboundTimeLeftInCycle()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    if (nMaxOutboundCycleStartTime == 0)
+        return MAX_UPLOAD_TIMEFRAME;
+
+    uint64_t cycleEndTime = nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME;
+    uint64_t now = GetTime();
+    return (cycleEndTime < now) ? 0 : cycleEndTime - now;
+}
+
+bool CNode::OutboundTargetReached(bool fHistoricalBlockServingLimit)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return false;
+
+    if (fHistoricalBlockServingLimit)
+    {
+        // keep a large enough buffer to at least relay each block once
+        uint64_t timeLeftInCycle = GetMaxOutboundTimeLeftInCycle();
+        uint64_t buffer = timeLeftInCycle / GetTargetSpacing(nBestHeight) * UPLOAD_TARGET_BLOCK_RESERVE;
+        if (buffer >= nMaxOutboundLimit || nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit - buffer)
+            return true;
+    }
+    else if (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit)
+        return true;
+
+    return false;
+}
+
+uint64_t CNode::GetOutboundTargetBytesLeft()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
+}
+
+void CNode::SetMaxUploadRate(uint64_t nTotalRate, uint64_t nPeerRate)
+{
+    LOCK(cs_totalBytesSent);
+    sendBucketTotal.SetRate(nTotalRate);
+    nMaxPeerUploadRate = nPeerRate;
+}
+
+uint64_t CNode::GetMaxUploadRate()
+{
+    LOCK(cs_totalBytesSent);
+    return sendBucketTotal.GetRate();
+}
+
+uint64_t CNode::GetMaxPeerUploadRate()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxPeerUploadRate;
+}
+
+bool CNode::IsUploadBandwidthScarce()
+{
+    LOCK(cs_totalBytesSent);
+    return sendBucketTotal.IsBelow(GetTimeMicros(), 0.5);
+}
+
+// requires LOCK(cs_vSend)
+uint64_t CNode::GetSendAllowance()
+{
+    int64_t nNow = GetTimeMicros();
+    uint64_t nAllowance = sendBucket.Available(nNow);
+    {
+        LOCK(cs_totalBytesSent);
+        nAllowance = std::min(nAllowance, sendBucketTotal.Available(nNow));
+    }
+    return nAllowance;
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -1763,10 +2001,14 @@ bool CAddrDB::Write(const CAddrMan& addr)
     RAND_bytes((unsigned char *)&randv, sizeof(randv));
     std::string tmpfn = strprintf("peers.dat.%04x", randv);
 
-    // serialize addresses, checksum data up to that point, then append csum
+    // serialize addresses, checksum data up to that point, then append csum.
+    // Only taking this in-memory snapshot holds addrman's lock; hashing,
+    // writing, fsync and rename below all run without it.
     CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
     ssPeers << FLATDATA(Params().MessageStart());
+    int64_t nStart = GetTimeMillis();
     ssPeers << addr;
+    LogPrint("net", "Serialized addrman snapshot (%u bytes) in %dms\n", ssPeers.size(), GetTimeMillis() - nStart);
     uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
     ssPeers << hash;
 
@@ -6,6 +6,7 @@
 #define HONEY_NET_H
 
 #include <deque>
+#include <limits>
 #include <boost/array.hpp>
 #include <boost/signals2/signal.hpp>
 #include <openssl/rand.h>
@@ -15,6 +16,7 @@
 #include <arpa/inet.h>
 #endif
 
+#include <bloom.h>
 #include <mruset.h>
 #include <netbase.h>
 #include <protocol.h>
@@ -31,6 +33,23 @@ extern int nBestHeight;
 static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
 static const int TIMEOUT_INTERVAL = 20 * 60;
+/** Average delay between trickled transaction inventory announcements, in seconds.
+ *  Outbound peers get half this delay; block announcements are never delayed. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transaction announcements per trickle, bounding the
+ *  relay rate to about 7 transactions per second per peer. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
+/** Number of recent announcements remembered per peer in filterInventoryKnown. */
+static const unsigned int INVENTORY_KNOWN_MAX = 50000;
+/** Transactions queued for announcement to one peer; more are not queued. */
+static const unsigned int INVENTORY_TX_TO_SEND_MAX = 10000;
+/** Length of the -maxuploadtarget accounting cycle, in seconds. */
+static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** Bytes kept back per block expected in the rest of the cycle, so that hitting
+ *  -maxuploadtarget stops historic block serving before it stops block relay. */
+static const uint64_t UPLOAD_TARGET_BLOCK_RESERVE = 200000;
+/** Blocks older than this (relative to the best block) are historic for serving purposes, in seconds. */
+static const int64_t HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
@@ -48,6 +67,8 @@ bool BindListenPort(const CService &bindAddr, std::string& strError=REF(std::str
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
 // Signals for message handling
 struct CNodeSignals
@@ -59,6 +80,61 @@ struct CNodeSignals
 CNodeSignals& GetNodeSignals();
 
 
+/** Token bucket used to shape upload bandwidth. It refills at nRate bytes per
+ *  second up to one second worth of tokens; a rate of 0 means unlimited.
+ */
+class CTokenBucket
+{
+private:
+    uint64_t nRate;
+    uint64_t nTokens;
+    int64_t nLastRefill;
+
+    void Refill(int64_t nNow)
+    {
+        if (nNow > nLastRefill)
+        {
+            nTokens = std::min(nRate, nTokens + (uint64_t)((nNow - nLastRefill) * nRate / 1000000));
+            nLastRefill = nNow;
+        }
+    }
+
+public:
+    CTokenBucket() : nRate(0), nTokens(0), nLastRefill(0) { }
+
+    void SetRate(uint64_t nRateIn)
+    {
+        nRate = nRateIn;
+        nTokens = nRateIn;
+        nLastRefill = GetTimeMicros();
+    }
+
+    uint64_t GetRate() const { return nRate; }
+    bool IsLimited() const { return nRate != 0; }
+
+    /** Number of bytes that may be sent now */
+    uint64_t Available(int64_t nNow)
+    {
+        if (!IsLimited())
+            return std::numeric_limits<uint64_t>::max();
+        Refill(nNow);
+        return nTokens;
+    }
+
+    /** True if less than the given share of the bucket is left */
+    bool IsBelow(int64_t nNow, double dFraction)
+    {
+        return IsLimited() && Available(nNow) < nRate * dFraction;
+    }
+
+    void Consume(uint64_t nBytes)
+    {
+        if (IsLimited())
+            nTokens -= std::min(nBytes, nTokens);
+    }
+};
+
+
 enum
 {
     LOCAL_NONE,   // unknown
@@ -212,6 +288,8 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    bool fGetDataDeferred; // historic block requests waiting for upload bandwidth
+    CTokenBucket sendBucket; // requires LOCK(cs_vSend)
     CSemaphoreGrant grantOutbound;
     int nRefCount;
 protected:
@@ -236,10 +314,15 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
-    std::vector<CInv> vInventoryToSend;
+    CRollingBloomFilter filterInventoryKnown;
+    // Transactions still to be announced, sent in fee rate order on the
+    // peer's own Poisson timer (nNextInvSend) rather than as they arrive.
+    std::set<uint256> setInventoryTxToSend;
+    // Blocks still to be announced; these are never delayed.
+    std::vector<uint256> vInventoryBlockToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
+    int64_t nNextInvSend;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -253,7 +336,7 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000), filterInventoryKnown(INVENTORY_KNOWN_MAX, 0.000001)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -274,6 +357,8 @@ public:
         fNetworkNode = false;
         fSuccessfullyConnected = false;
         fDisconnect = false;
+        fGetDataDeferred = false;
+        sendBucket.SetRate(GetMaxPeerUploadRate());
         nRefCount = 0;
         nSendSize = 0;
         nSendOffset = 0;
@@ -284,7 +369,7 @@ public:
         fStartSync = false;
         fGetAddr = false;
         nMisbehavior = 0;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
+        nNextInvSend = 0;
         nPingNonceSent = 0;
         nPingUsecStart = 0;
         nPingUsecTime = 0;
@@ -311,6 +396,13 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Upload shaping, protected by cs_totalBytesSent
+    static CTokenBucket sendBucketTotal;
+    static uint64_t nMaxPeerUploadRate;
+    static uint64_t nMaxOutboundTotalBytesSentInCycle;
+    static uint64_t nMaxOutboundCycleStartTime;
+    static uint64_t nMaxOutboundLimit;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -371,11 +463,19 @@ public:
     }
 
 
+    // A getdata message that has to wait behind historic block requests
+    // deferred for upload bandwidth, to keep responses in order
+    bool IsGetDataWaiting() const
+    {
+        return fGetDataDeferred && !vRecvGetData.empty() && !vRecvMsg.empty() &&
+               vRecvMsg.front().complete() && vRecvMsg.front().hdr.GetCommand() == "getdata";
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -383,8 +483,15 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            // Blocks are always queued: a getblocks reply has to repeat hashes
+            // the peer was already told about when it asks again after a stall
+            if (inv.type == MSG_TX)
+            {
+                if (!filterInventoryKnown.contains(inv.hash) && setInventoryTxToSend.size() < INVENTORY_TX_TO_SEND_MAX)
+                    setInventoryTxToSend.insert(inv.hash);
+            }
+            else if (inv.type == MSG_BLOCK)
+                vInventoryBlockToSend.push_back(inv.hash);
         }
     }
 
@@ -656,6 +763,27 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Daily upload budget (-maxuploadtarget), in bytes per MAX_UPLOAD_TIMEFRAME; 0 = unlimited
+    static void SetMaxOutboundTarget(uint64_t nLimit);
+    static uint64_t GetMaxOutboundTarget();
+    static uint64_t GetMaxOutboundTimeframe();
+    // If fHistoricalBlockServingLimit is set, also keeps a reserve for
+    // relaying the new blocks expected during the rest of the cycle
+    static bool OutboundTargetReached(bool fHistoricalBlockServingLimit);
+    static uint64_t GetOutboundTargetBytesLeft();
+    static uint64_t GetMaxOutboundTimeLeftInCycle();
+
+    // Upload rate limits (-maxuploadrate, -maxpeeruploadrate), in bytes per second; 0 = unlimited
+    static void SetMaxUploadRate(uint64_t nTotalRate, uint64_t nPeerRate);
+    static uint64_t GetMaxUploadRate();
+    static uint64_t GetMaxPeerUploadRate();
+    // True while the global bucket is below half full: historic blocks wait,
+    // leaving the rest for block and transaction relay
+    static bool IsUploadBandwidthScarce();
+
+    // requires LOCK(cs_vSend)
+    uint64_t GetSendAllowance();
 };
 
 inline void RelayInventory(const CInv& inv)
@@ -0,0 +1,351 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <notify.h>
+#include <main.h>
+#include <netbase.h>
+#include <ui_interface.h>
+#include <util.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+
+// Publishing only serializes the message and hands it to the notify thread,
+// which does all socket I/O. Subscribers never slow down block or transaction
+// processing: one that can't keep up is disconnected.
+
+enum NotifyTopic {
+    NOTIFY_HASHBLOCK,
+    NOTIFY_HASHTX,
+    NOTIFY_RAWBLOCK,
+    NOTIFY_RAWTX,
+    NOTIFY_TOPIC_COUNT
+};
+
+static const struct {
+    const char* pszArg;
+    const char* pszTopic;
+} notify_topics[NOTIFY_TOPIC_COUNT] = {
+    { "-pubhashblock", "hashblock" },
+    { "-pubhashtx",    "hashtx" },
+    { "-pubrawblock",  "rawblock" },
+    { "-pubrawtx",     "rawtx" },
+};
+
+typedef std::shared_ptr<const std::string> NotifyBuffer;
+
+class CNotifySubscriber : public boost::enable_shared_from_this<CNotifySubscriber>
+{
+public:
+    boost::asio::ip::tcp::socket socket;
+
+    explicit CNotifySubscriber(boost::asio::io_service& io_service) : socket(io_service), nQueuedBytes(0), fClosed(false)
+    {
+    }
+
+    void Start()
+    {
+        // Subscribers have nothing to say, reading only notices them leaving
+        socket.async_read_some(boost::asio::buffer(pchRead),
+                               boost::bind(&CNotifySubscriber::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void Send(const NotifyBuffer& msg)
+    {
+        if (fClosed)
+            return;
+        if (nQueuedBytes + msg->size() > MAX_NOTIFY_QUEUE_BYTES)
+        {
+            LogPrint("notify", "Notification subscriber %s too slow, disconnecting\n", strPeer);
+            Close();
+            return;
+        }
+        queue.push_back(msg);
+        nQueuedBytes += msg->size();
+        if (queue.size() == 1)
+            StartWrite();
+    }
+
+    bool IsClosed() const { return fClosed; }
+
+    void Close()
+    {
+        if (fClosed)
+            return;
+        fClosed = true;
+        queue.clear();
+        nQueuedBytes = 0;
+        boost::system::error_code ec;
+        socket.close(ec);
+    }
+
+    std::string strPeer;
+
+private:
+    std::deque<NotifyBuffer> queue;
+    size_t nQueuedBytes;
+    bool fClosed;
+    char pchRead[64];
+
+    void StartWrite()
+    {
+        boost::asio::async_write(socket, boost::asio::buffer(*queue.front()),
+                                 boost::bind(&CNotifySubscriber::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        if (fClosed)
+            return;
+        if (error)
+        {
+            Close();
+            return;
+        }
+        nQueuedBytes -= queue.front()->size();
+        queue.pop_front();
+        if (!queue.empty())
+            StartWrite();
+    }
+
+    void HandleRead(const boost::system::error_code& error)
+    {
+        if (fClosed)
+            return;
+        if (error)
+        {
+            LogPrint("notify", "Notification subscriber %s disconnected\n", strPeer);
+            Close();
+            return;
+        }
+        Start();
+    }
+};
+
+/** One listening address and the topics published on it */
+class CNotifyPublisher : public boost::enable_shared_from_this<CNotifyPublisher>
+{
+public:
+    boost::asio::ip::tcp::acceptor acceptor;
+    bool fTopics[NOTIFY_TOPIC_COUNT];
+
+    explicit CNotifyPublisher(boost::asio::io_service& io_serviceIn) : acceptor(io_serviceIn), io_service(io_serviceIn)
+    {
+        std::fill(fTopics, fTopics + NOTIFY_TOPIC_COUNT, false);
+    }
+
+    void Accept()
+    {
+        boost::shared_ptr<CNotifySubscriber> sub(new CNotifySubscriber(io_service));
+        acceptor.async_accept(sub->socket,
+                              boost::bind(&CNotifyPublisher::HandleAccept, shared_from_this(), sub, boost::asio::placeholders::error));
+    }
+
+    void Publish(NotifyTopic topic, const NotifyBuffer& msg)
+    {
+        if (!fTopics[topic])
+            return;
+        for (std::list<boost::shared_ptr<CNotifySubscriber> >::iterator it = subscribers.begin(); it != subscribers.end(); )
+        {
+            (*it)->Send(msg);
+            if ((*it)->IsClosed())
+                it = subscribers.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void Close()
+    {
+        boost::system::error_code ec;
+        acceptor.close(ec);
+        for (boost::shared_ptr<CNotifySubscriber>& sub : subscribers)
+            sub->Close();
+        subscribers.clear();
+    }
+
+private:
+    boost::asio::io_service& io_service;
+    std::list<boost::shared_ptr<CNotifySubscriber> > subscribers;
+
+    void HandleAccept(boost::shared_ptr<CNotifySubscriber> sub, const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted || !acceptor.is_open())
+            return;
+        if (!error)
+        {
+            boost::system::error_code ec;
+            sub->strPeer = sub->socket.remote_endpoint(ec).address().to_string();
+            sub->socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+            LogPrint("notify", "Notification subscriber %s connected\n", sub->strPeer);
+            sub->Start();
+            subscribers.remove_if([](const boost::shared_ptr<CNotifySubscriber>& s) { return s->IsClosed(); });
+            subscribers.push_back(sub);
+        }
+        Accept();
+    }
+};
+
+// notify_io_service and vPublishers are set up and torn down under
+// cs_notify; vPublishers is only used on the notify thread in between.
+static boost::mutex cs_notify;
+static boost::asio::io_service* notify_io_service = nullptr;
+static boost::thread* notify_thread = nullptr;
+static std::vector<boost::shared_ptr<CNotifyPublisher> > vPublishers;
+static std::atomic<bool> fTopicEnabled[NOTIFY_TOPIC_COUNT];
+static std::atomic<uint32_t> nTopicSequence[NOTIFY_TOPIC_COUNT];
+
+static void Publish(NotifyTopic topic, std::vector<unsigned char>& vchBody)
+{
+    CNotifyMessage msg;
+    msg.strTopic = notify_topics[topic].pszTopic;
+    msg.vchBody.swap(vchBody);
+    msg.nSequence = nTopicSequence[topic]++;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << msg;
+    NotifyBuffer buffer = std::make_shared<const std::string>(ss.begin(), ss.end());
+
+    boost::lock_guard<boost::mutex> lock(cs_notify);
+    if (notify_io_service == nullptr)
+        return;
+    notify_io_service->post([topic, buffer]() {
+        for (boost::shared_ptr<CNotifyPublisher>& publisher : vPublishers)
+            publisher->Publish(topic, buffer);
+    });
+}
+
+static void PublishHash(NotifyTopic topic, const uint256& hash)
+{
+    std::vector<unsigned char> vchBody(hash.begin(), hash.end());
+    std::reverse(vchBody.begin(), vchBody.end());
+    Publish(topic, vchBody);
+}
+
+template<typename T>
+static void PublishRaw(NotifyTopic topic, const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    std::vector<unsigned char> vchBody(ss.begin(), ss.end());
+    Publish(topic, vchBody);
+}
+
+void NotifyBlockConnected(const CBlock& block)
+{
+    if (fTopicEnabled[NOTIFY_HASHBLOCK])
+        PublishHash(NOTIFY_HASHBLOCK, block.GetHash());
+    if (fTopicEnabled[NOTIFY_RAWBLOCK])
+        PublishRaw(NOTIFY_RAWBLOCK, block);
+}
+
+void NotifyTransactionAccepted(const CTransaction& tx)
+{
+    if (fTopicEnabled[NOTIFY_HASHTX])
+        PublishHash(NOTIFY_HASHTX, tx.GetHash());
+    if (fTopicEnabled[NOTIFY_RAWTX])
+        PublishRaw(NOTIFY_RAWTX, tx);
+}
+
+bool StartNotifications(std::string& strError)
+{
+    // Topics naming the same address share its listener
+    std::map<CService, std::vector<int> > mapAddressTopics;
+    for (int i = 0; i < NOTIFY_TOPIC_COUNT; i++)
+    {
+        if (!mapArgs.count(notify_topics[i].pszArg))
+            continue;
+        const std::string& strAddress = mapArgs[notify_topics[i].pszArg];
+        CService addr;
+        if (!LookupNumeric(strAddress.c_str(), addr) || addr.GetPort() == 0 || !addr.IsLocal())
+        {
+            strError = strprintf(_("%s needs a loopback address and port, like 127.0.0.1:15720: '%s'"), notify_topics[i].pszArg, strAddress);
+            return false;
+        }
+        mapAddressTopics[addr].push_back(i);
+    }
+    if (mapAddressTopics.empty())
+        return true;
+
+    boost::asio::io_service* io_service = new boost::asio::io_service();
+    std::vector<boost::shared_ptr<CNotifyPublisher> > vNew;
+    for (const std::pair<const CService, std::vector<int> >& item : mapAddressTopics)
+    {
+        boost::shared_ptr<CNotifyPublisher> publisher(new CNotifyPublisher(*io_service));
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(item.first.ToStringIP()), item.first.GetPort());
+        try
+        {
+            publisher->acceptor.open(endpoint.protocol());
+            publisher->acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+            publisher->acceptor.bind(endpoint);
+            publisher->acceptor.listen(boost::asio::socket_base::max_connections);
+        }
+        catch (boost::system::system_error& e)
+        {
+            strError = strprintf(_("Unable to listen for notification subscribers on %s: %s"), item.first.ToString(), e.what());
+            vNew.clear();
+            publisher.reset();
+            delete io_service;
+            return false;
+        }
+        for (int i : item.second)
+            publisher->fTopics[i] = true;
+        vNew.push_back(publisher);
+        LogPrintf("Publishing notifications on %s\n", item.first.ToString());
+    }
+    for (boost::shared_ptr<CNotifyPublisher>& publisher : vNew)
+        publisher->Accept();
+
+    boost::lock_guard<boost::mutex> lock(cs_notify);
+    vPublishers.swap(vNew);
+    notify_io_service = io_service;
+    // StopNotifications() may reset notify_io_service before the thread runs
+    notify_thread = new boost::thread([io_service]() {
+        RenameThread("honey-notify");
+        io_service->run();
+    });
+    for (const std::pair<const CService, std::vector<int> >& item : mapAddressTopics)
+        for (int i : item.second)
+            fTopicEnabled[i] = true;
+    return true;
+}
+
+void StopNotifications()
+{
+    for (int i = 0; i < NOTIFY_TOPIC_COUNT; i++)
+        fTopicEnabled[i] = false;
+
+    boost::asio::io_service* io_service;
+    boost::thread* thread;
+    {
+        boost::lock_guard<boost::mutex> lock(cs_notify);
+        if (notify_io_service == nullptr)
+            return;
+        io_service = notify_io_service;
+        thread = notify_thread;
+        notify_io_service = nullptr;
+        notify_thread = nullptr;
+    }
+
+    // Closing on the notify thread keeps the publishers single threaded
+    io_service->post([]() {
+        for (boost::shared_ptr<CNotifyPublisher>& publisher : vPublishers)
+            publisher->Close();
+    });
+    io_service->post([io_service]() { io_service->stop(); });
+    thread->join();
+    delete thread;
+    vPublishers.clear();
+    delete io_service;
+}
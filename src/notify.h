@@ -0,0 +1,55 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef HONEY_NOTIFY_H
+#define HONEY_NOTIFY_H
+
+#include <serialize.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CTransaction;
+
+/** Bytes queued for one subscriber before it is disconnected as too slow */
+static const size_t MAX_NOTIFY_QUEUE_BYTES = 16 * 1024 * 1024;
+
+/**
+ * One notification on a subscriber stream. The stream is nothing but these
+ * messages back to back, in network serialization:
+ *   topic      "hashblock", "hashtx", "rawblock" or "rawtx"
+ *   body       a hash (32 bytes, in the byte order of its hex form) or a
+ *              serialized block or transaction
+ *   sequence   counts the messages of the topic, gaps mean lost messages
+ */
+class CNotifyMessage
+{
+public:
+    std::string strTopic;
+    std::vector<unsigned char> vchBody;
+    uint32_t nSequence;
+
+    CNotifyMessage() : nSequence(0) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(strTopic);
+        READWRITE(vchBody);
+        READWRITE(nSequence);
+    )
+};
+
+/** Listen on the addresses given by -pubhashblock, -pubhashtx, -pubrawblock
+ * and -pubrawtx. Returns false with strError set if one can't be used. */
+bool StartNotifications(std::string& strError);
+void StopNotifications();
+
+/** New best block, called from SetBestChain */
+void NotifyBlockConnected(const CBlock& block);
+/** New memory pool transaction, called from AcceptToMemoryPool */
+void NotifyTransactionAccepted(const CTransaction& tx);
+
+#endif // HONEY_NOTIFY_H
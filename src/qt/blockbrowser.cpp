@@ -14,7 +14,7 @@ const CBlockIndex* getBlockIndex(qint64 height)
 {
     std::string hex = getBlockHash(height);
     uint256 hash(hex);
-    return mapBlockIndex[hash];
+    return LookupBlockIndex(hash);
 }
 
 std::string getBlockHash(qint64 Height)
@@ -26,7 +26,7 @@ std::string getBlockHash(qint64 Height)
     if (desiredheight < 0 || desiredheight > nBestHeight)
         return 0;
 
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
+    CBlockIndex* pblockindex = pindexBest;
     while (pblockindex->nHeight > desiredheight)
         pblockindex = pblockindex->pprev;
     return  pblockindex->GetBlockHash().GetHex(); // pblockindex->phashBlock->GetHex();
@@ -37,10 +37,9 @@ qint64 getBlockTime(qint64 Height)
     std::string strHash = getBlockHash(Height);
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         return 0;
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     return pblockindex->nTime;
 }
 
@@ -49,10 +48,9 @@ std::string getBlockMerkle(qint64 Height)
     std::string strHash = getBlockHash(Height);
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         return 0;
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     return pblockindex->hashMerkleRoot.ToString();//.substr(0,10).c_str();
 }
 
@@ -61,10 +59,9 @@ qint64 getBlocknBits(qint64 Height)
     std::string strHash = getBlockHash(Height);
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         return 0;
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     return pblockindex->nBits;
 }
 
@@ -73,10 +70,9 @@ qint64 getBlockNonce(qint64 Height)
     std::string strHash = getBlockHash(Height);
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         return 0;
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     return pblockindex->nNonce;
 }
 
@@ -111,10 +107,9 @@ double getMoneySupply(qint64 Height)
      std::string strHash = getBlockHash(Height);
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
     return 0;
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     if (Height == 0)
     return 0;
 	else
@@ -297,7 +292,7 @@ void BlockBrowser::updateExplorer(bool block)
      uint256 hashBlock = 0;
      if (GetTransaction(hash, tx, hashBlock))
      {
-         CBlockIndex* pblockindex = mapBlockIndex[hashBlock];
+         CBlockIndex* pblockindex = LookupBlockIndex(hashBlock);
          if (!pblockindex)
              ui->heightBox->setValue(nBestHeight);
          else
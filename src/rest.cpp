@@ -0,0 +1,272 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpcserver.h>
+#include <rpcjson.h>
+#include <main.h>
+#include <util.h>
+
+#include <boost/algorithm/string.hpp>
+
+// Unauthenticated read-only access to chain data (-rest). Requests run on the
+// RPC worker threads without cs_main, like the thread safe RPC calls.
+
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& result);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& entry);
+
+static const unsigned int MAX_REST_HEADERS_RESULTS = 2000;
+
+enum RetFormat {
+    RF_UNDEF,
+    RF_BINARY,
+    RF_HEX,
+    RF_JSON,
+};
+
+static const struct {
+    enum RetFormat rf;
+    const char* name;
+    const char* contentType;
+} rf_names[] = {
+    { RF_BINARY, "bin",  "application/octet-stream" },
+    { RF_HEX,    "hex",  "text/plain" },
+    { RF_JSON,   "json", "application/json" },
+};
+
+class CRESTReply
+{
+public:
+    int nStatus;
+    std::string strBody;
+    std::string strContentType;
+};
+
+static bool RESTError(CRESTReply& reply, int nStatus, const std::string& strMessage)
+{
+    reply.nStatus = nStatus;
+    reply.strBody = strMessage + "\r\n";
+    reply.strContentType = "text/plain";
+    return false;
+}
+
+/** Split "<param>.<format>" and return the format, RF_UNDEF if unknown */
+static RetFormat ParseDataFormat(std::string& strParam, const std::string& strReq)
+{
+    size_t nPos = strReq.rfind('.');
+    if (nPos == std::string::npos)
+    {
+        strParam = strReq;
+        return RF_UNDEF;
+    }
+
+    strParam = strReq.substr(0, nPos);
+    const std::string strSuffix = strReq.substr(nPos + 1);
+    for (unsigned int i = 0; i < ARRAYLEN(rf_names); i++)
+        if (strSuffix == rf_names[i].name)
+            return rf_names[i].rf;
+    return RF_UNDEF;
+}
+
+static std::string AvailableDataFormatsString()
+{
+    std::string strFormats;
+    for (unsigned int i = 0; i < ARRAYLEN(rf_names); i++)
+        strFormats += std::string(i ? ", " : "") + "." + rf_names[i].name;
+    return strFormats;
+}
+
+static bool ParseHashStr(const std::string& strHash, uint256& hash)
+{
+    if (strHash.size() != 64 || !IsHex(strHash))
+        return false;
+    hash.SetHex(strHash);
+    return true;
+}
+
+static void SetBody(CRESTReply& reply, RetFormat rf, std::string& strData)
+{
+    reply.nStatus = HTTP_OK;
+    for (unsigned int i = 0; i < ARRAYLEN(rf_names); i++)
+        if (rf_names[i].rf == rf)
+            reply.strContentType = rf_names[i].contentType;
+    if (rf == RF_HEX)
+        reply.strBody = HexStr(strData.begin(), strData.end()) + "\n";
+    else
+        reply.strBody.swap(strData);
+}
+
+static bool rest_block(CRESTReply& reply, const std::string& strURIPart, bool fShowTxDetails)
+{
+    std::string strHash;
+    const RetFormat rf = ParseDataFormat(strHash, strURIPart);
+    if (rf == RF_UNDEF)
+        return RESTError(reply, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    uint256 hash;
+    if (!ParseHashStr(strHash, hash))
+        return RESTError(reply, HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+
+    const CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (!pindex)
+        return RESTError(reply, HTTP_NOT_FOUND, strHash + " not found");
+
+    if (rf == RF_JSON)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex, true))
+            return RESTError(reply, HTTP_NOT_FOUND, strHash + " not available");
+        CJSONWriter writer;
+        blockToJSON(block, pindex, fShowTxDetails, writer);
+        writer.str() += "\n";
+        SetBody(reply, rf, writer.str());
+        return true;
+    }
+
+    // Binary and hex replies are the bytes from the block file, never parsed
+    std::string strRaw;
+    if (!ReadRawBlockFromDisk(strRaw, pindex))
+        return RESTError(reply, HTTP_NOT_FOUND, strHash + " not available");
+    SetBody(reply, rf, strRaw);
+    return true;
+}
+
+static bool rest_tx(CRESTReply& reply, const std::string& strURIPart)
+{
+    std::string strHash;
+    const RetFormat rf = ParseDataFormat(strHash, strURIPart);
+    if (rf == RF_UNDEF)
+        return RESTError(reply, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    uint256 hash;
+    if (!ParseHashStr(strHash, hash))
+        return RESTError(reply, HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock))
+        return RESTError(reply, HTTP_NOT_FOUND, strHash + " not found");
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer;
+        writer.BeginObject();
+        TxToJSON(tx, hashBlock, writer);
+        writer.EndObject();
+        writer.str() += "\n";
+        SetBody(reply, rf, writer.str());
+        return true;
+    }
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    std::string strData = ssTx.str();
+    SetBody(reply, rf, strData);
+    return true;
+}
+
+static bool rest_headers(CRESTReply& reply, const std::string& strURIPart)
+{
+    std::string strParam;
+    const RetFormat rf = ParseDataFormat(strParam, strURIPart);
+    if (rf == RF_UNDEF)
+        return RESTError(reply, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    std::vector<std::string> vPath;
+    boost::split(vPath, strParam, boost::is_any_of("/"));
+    if (vPath.size() != 2)
+        return RESTError(reply, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    long nCount = strtol(vPath[0].c_str(), nullptr, 10);
+    if (nCount < 1 || nCount > (long)MAX_REST_HEADERS_RESULTS)
+        return RESTError(reply, HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", vPath[0]));
+
+    uint256 hash;
+    if (!ParseHashStr(vPath[1], hash))
+        return RESTError(reply, HTTP_BAD_REQUEST, "Invalid hash: " + vPath[1]);
+
+    // Headers follow the main chain from the given block on
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    std::vector<const CBlockIndex*> vHeaders;
+    const CBlockIndex* pindex = LookupBlockIndex(hash);
+    while (pindex && chain->Contains(pindex) && (long)vHeaders.size() < nCount)
+    {
+        vHeaders.push_back(pindex);
+        pindex = chain->Next(pindex);
+    }
+
+    if (rf == RF_JSON)
+    {
+        CJSONWriter writer;
+        writer.BeginArray();
+        for (const CBlockIndex* pindexHeader : vHeaders)
+        {
+            writer.BeginObject();
+            writer.Pair("hash", pindexHeader->GetBlockHash().GetHex());
+            writer.Pair("confirmations", chain->GetDepth(pindexHeader));
+            writer.Pair("height", pindexHeader->nHeight);
+            writer.Pair("version", pindexHeader->nVersion);
+            writer.Pair("merkleroot", pindexHeader->hashMerkleRoot.GetHex());
+            writer.Pair("time", (int64_t)pindexHeader->GetBlockTime());
+            writer.Pair("nonce", (uint64_t)pindexHeader->nNonce);
+            writer.Pair("bits", strprintf("%08x", pindexHeader->nBits));
+            writer.Pair("difficulty", GetDifficulty(pindexHeader));
+            writer.Pair("chaintrust", leftTrim(pindexHeader->nChainTrust.GetHex(), '0'));
+            if (pindexHeader->pprev)
+                writer.Pair("previousblockhash", pindexHeader->pprev->GetBlockHash().GetHex());
+            if (const CBlockIndex* pindexNext = chain->Next(pindexHeader))
+                writer.Pair("nextblockhash", pindexNext->GetBlockHash().GetHex());
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.str() += "\n";
+        SetBody(reply, rf, writer.str());
+        return true;
+    }
+
+    // 80 byte headers back to back
+    CDataStream ssHeader(SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+    for (const CBlockIndex* pindexHeader : vHeaders)
+        ssHeader << pindexHeader->GetBlockHeader();
+    std::string strData = ssHeader.str();
+    SetBody(reply, rf, strData);
+    return true;
+}
+
+static const struct {
+    const char* prefix;
+    bool (*handler)(CRESTReply& reply, const std::string& strURIPart);
+} uri_prefixes[] = {
+    { "/rest/block/notxdetails/", [](CRESTReply& reply, const std::string& strURIPart) { return rest_block(reply, strURIPart, false); } },
+    { "/rest/block/",             [](CRESTReply& reply, const std::string& strURIPart) { return rest_block(reply, strURIPart, true); } },
+    { "/rest/tx/",                rest_tx },
+    { "/rest/headers/",           rest_headers },
+};
+
+int HandleRESTRequest(const std::string& strURI, std::string& strBody, std::string& strContentType)
+{
+    CRESTReply reply;
+    try
+    {
+        // Query strings carry nothing for us
+        std::string strPath = strURI.substr(0, strURI.find('?'));
+        bool fFound = false;
+        for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes) && !fFound; i++)
+        {
+            if (boost::starts_with(strPath, uri_prefixes[i].prefix))
+            {
+                fFound = true;
+                uri_prefixes[i].handler(reply, strPath.substr(strlen(uri_prefixes[i].prefix)));
+            }
+        }
+        if (!fFound)
+            RESTError(reply, HTTP_NOT_FOUND, "not found");
+    }
+    catch (std::exception& e)
+    {
+        RESTError(reply, HTTP_INTERNAL_SERVER_ERROR, e.what());
+    }
+    strBody.swap(reply.strBody);
+    strContentType = reply.strContentType;
+    return reply.nStatus;
+}
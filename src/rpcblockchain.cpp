@@ -3,13 +3,16 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <base58.h>
 #include <rpcserver.h>
+#include <rpcjson.h>
 #include <main.h>
+#include <txdb.h>
 #include <kernel.h>
 #include <checkpoints.h>
 
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& entry);
 
 double GetDifficulty(const CBlockIndex* blockindex)
 {
@@ -17,10 +20,11 @@ double GetDifficulty(const CBlockIndex* blockindex)
     // minimum difficulty = 1.0.
     if (blockindex == nullptr)
     {
-        if (pindexBest == nullptr)
+        const CBlockIndex* pindexTip = GetChainSnapshot()->pindexBest;
+        if (pindexTip == nullptr)
             return 1.0;
         else
-            blockindex = GetLastBlockIndex(pindexBest, false);
+            blockindex = GetLastBlockIndex(pindexTip, false);
     }
 
     int nShift = (blockindex->nBits >> 24) & 0xff;
@@ -102,58 +106,71 @@ double GetPoSKernelPS()
     return result;
 }
 
-json_spirit::Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONWriter& result)
 {
-    json_spirit::Object result;
-    result.push_back(json_spirit::Pair("hash", block.GetHash().GetHex()));
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    int64_t nMint;
+    if (chain->Contains(blockindex))
+    {
+        // ConnectBlock set it before the snapshot was published, and never
+        // changes it for a block that is connected again
+        nMint = blockindex->nMint;
+    }
+    else
+    {
+        // a side-chain block may be getting connected by a reorg right now
+        LOCK(cs_main);
+        nMint = blockindex->nMint;
+    }
+
+    result.BeginObject();
+    result.Pair("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (blockindex->IsInMainChain())
-        confirmations = nBestHeight - blockindex->nHeight + 1;
-    result.push_back(json_spirit::Pair("confirmations", confirmations));
-    result.push_back(json_spirit::Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(json_spirit::Pair("height", blockindex->nHeight));
-    result.push_back(json_spirit::Pair("version", block.nVersion));
-    result.push_back(json_spirit::Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    result.push_back(json_spirit::Pair("mint", ValueFromAmount(blockindex->nMint)));
-    result.push_back(json_spirit::Pair("time", (int64_t)block.GetBlockTime()));
-    result.push_back(json_spirit::Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(json_spirit::Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(json_spirit::Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(json_spirit::Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
-    result.push_back(json_spirit::Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
+    if (chain->Contains(blockindex))
+        confirmations = chain->GetDepth(blockindex);
+    result.Pair("confirmations", confirmations);
+    result.Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    result.Pair("height", blockindex->nHeight);
+    result.Pair("version", block.nVersion);
+    result.Pair("merkleroot", block.hashMerkleRoot.GetHex());
+    result.Pair("mint", ValueFromAmount(nMint));
+    result.Pair("time", (int64_t)block.GetBlockTime());
+    result.Pair("nonce", (uint64_t)block.nNonce);
+    result.Pair("bits", strprintf("%08x", block.nBits));
+    result.Pair("difficulty", GetDifficulty(blockindex));
+    result.Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0'));
+    result.Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0'));
     if (blockindex->pprev)
-        result.push_back(json_spirit::Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(json_spirit::Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-
-    result.push_back(json_spirit::Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
-    result.push_back(json_spirit::Pair("proofhash", blockindex->hashProof.GetHex()));
-    result.push_back(json_spirit::Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
-    result.push_back(json_spirit::Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
-    result.push_back(json_spirit::Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
-    json_spirit::Array txinfo;
+        result.Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    if (const CBlockIndex* pindexNext = chain->Next(blockindex))
+        result.Pair("nextblockhash", pindexNext->GetBlockHash().GetHex());
+
+    result.Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": ""));
+    result.Pair("proofhash", blockindex->hashProof.GetHex());
+    result.Pair("entropybit", (int)blockindex->GetStakeEntropyBit());
+    result.Pair("modifier", strprintf("%016x", blockindex->nStakeModifier));
+    result.Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex());
+    result.Key("tx");
+    result.BeginArray();
     for (const CTransaction& tx : block.vtx)
     {
         if (fPrintTransactionDetail)
         {
-            json_spirit::Object entry;
-
-            entry.push_back(json_spirit::Pair("txid", tx.GetHash().GetHex()));
-            TxToJSON(tx, 0, entry);
-
-            txinfo.push_back(entry);
+            result.BeginObject();
+            result.Pair("txid", tx.GetHash().GetHex());
+            TxToJSON(tx, 0, result);
+            result.EndObject();
         }
         else
-            txinfo.push_back(tx.GetHash().GetHex());
+            result.Write(tx.GetHash().GetHex());
     }
-
-    result.push_back(json_spirit::Pair("tx", txinfo));
+    result.EndArray();
 
     if (block.IsProofOfStake())
-        result.push_back(json_spirit::Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+        result.Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
 
-    return result;
+    result.EndObject();
 }
 
 json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp)
@@ -163,7 +180,7 @@ json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    return GetChainSnapshot()->hashBestChain.GetHex();
 }
 
 json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp)
@@ -173,7 +190,53 @@ json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainSnapshot()->nHeight;
+}
+
+// Waits hold a worker thread but no locks; shutdown ends them early
+static std::shared_ptr<const CChainSnapshot> WaitForTip(const std::function<bool(const CChainSnapshot&)>& fnDone, int64_t nTimeoutMillis)
+{
+    if (nTimeoutMillis < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+    return WaitForChainSnapshot([&fnDone](const CChainSnapshot& chain) { return !IsRPCRunning() || fnDone(chain); }, nTimeoutMillis);
+}
+
+static json_spirit::Object TipToJSON(const CChainSnapshot& chain)
+{
+    json_spirit::Object ret;
+    ret.push_back(json_spirit::Pair("hash", chain.hashBestChain.GetHex()));
+    ret.push_back(json_spirit::Pair("height", chain.nHeight));
+    return ret;
+}
+
+json_spirit::Value waitfornewblock(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw std::runtime_error(
+            "waitfornewblock [timeout=0]\n"
+            "Waits for the best block to change, then returns its hash and height.\n"
+            "[timeout] is in milliseconds, 0 waits indefinitely.\n"
+            "Returns the current best block when the timeout expires.");
+
+    int64_t nTimeout = params.size() > 0 ? params[0].get_int64() : 0;
+    const uint256 hashStart = GetChainSnapshot()->hashBestChain;
+    std::shared_ptr<const CChainSnapshot> chain = WaitForTip([&hashStart](const CChainSnapshot& c) { return c.hashBestChain != hashStart; }, nTimeout);
+    return TipToJSON(*chain);
+}
+
+json_spirit::Value waitforblock(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw std::runtime_error(
+            "waitforblock <blockhash> [timeout=0]\n"
+            "Waits until <blockhash> is the best block, then returns its hash and height.\n"
+            "[timeout] is in milliseconds, 0 waits indefinitely.\n"
+            "Returns the current best block when the timeout expires.");
+
+    uint256 hash(params[0].get_str());
+    int64_t nTimeout = params.size() > 1 ? params[1].get_int64() : 0;
+    std::shared_ptr<const CChainSnapshot> chain = WaitForTip([&hash](const CChainSnapshot& c) { return c.hashBestChain == hash; }, nTimeout);
+    return TipToJSON(*chain);
 }
 
 
@@ -186,7 +249,7 @@ json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp)
 
     json_spirit::Object obj;
     obj.push_back(json_spirit::Pair("proof-of-work",        GetDifficulty()));
-    obj.push_back(json_spirit::Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(pindexBest, true))));
+    obj.push_back(json_spirit::Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(GetChainSnapshot()->pindexBest, true))));
     return obj;
 }
 
@@ -216,14 +279,14 @@ json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp)
             "Returns hash of block in best-block-chain at <index>.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    const CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (!pblockindex)
         throw std::runtime_error("Block number out of range.");
 
-    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
-    return pblockindex->phashBlock->GetHex();
+    return pblockindex->GetBlockHash().GetHex();
 }
 
-json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp)
+void getblock(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw std::runtime_error(
@@ -234,17 +297,17 @@ json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
-json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp)
+void getblockbynumber(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw std::runtime_error(
@@ -253,20 +316,14 @@ json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp
             "Returns details of a block with given block-number.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    const CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (!pblockindex)
         throw std::runtime_error("Block number out of range.");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
-
-    pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
 // ppcoin: get information of sync-checkpoint
@@ -288,3 +345,151 @@ json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp)
 
     return result;
 }
+
+static void AddressIndexKeyFromParam(const json_spirit::Value& param, unsigned char& nAddressType, uint160& hashAddress)
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex");
+
+    CHoneyAddress address(param.get_str());
+    if (!address.IsValid() || !GetAddressIndexKey(address.Get(), nAddressType, hashAddress))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Honey address");
+}
+
+json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "getaddressbalance <address>\n"
+            "Returns the confirmed balance of <address> and the total it has received.\n"
+            "Requires -addressindex.");
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    AddressIndexKeyFromParam(params[0], nAddressType, hashAddress);
+
+    CTxDB txdb("r");
+    AddressUnspentEntries vUnspent;
+    if (!txdb.ReadAddressUnspentIndex(nAddressType, hashAddress, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+    AddressIndexEntries vHistory;
+    if (!txdb.ReadAddressIndex(nAddressType, hashAddress, vHistory))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    int64_t nBalance = 0;
+    for (const auto& entry : vUnspent)
+        nBalance += entry.second.nValue;
+    int64_t nReceived = 0;
+    for (const auto& entry : vHistory)
+        if (entry.second > 0)
+            nReceived += entry.second;
+
+    json_spirit::Object result;
+    result.push_back(json_spirit::Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(json_spirit::Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+json_spirit::Value getaddresstxids(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw std::runtime_error(
+            "getaddresstxids <address> [start] [end]\n"
+            "Returns the ids of transactions paying or spending from <address>,\n"
+            "oldest first, optionally limited to blocks from height [start] to [end].\n"
+            "Requires -addressindex.");
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    AddressIndexKeyFromParam(params[0], nAddressType, hashAddress);
+
+    int nStart = params.size() > 1 ? params[1].get_int() : 0;
+    int nEnd = params.size() > 2 ? params[2].get_int() : 0;
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+
+    AddressIndexEntries vHistory;
+    if (!CTxDB("r").ReadAddressIndex(nAddressType, hashAddress, vHistory, nStart, nEnd))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    // Entries of one transaction are adjacent, as keys sort by height and block position
+    json_spirit::Array result;
+    uint256 hashLast = 0;
+    for (const auto& entry : vHistory)
+    {
+        if (entry.first.txhash == hashLast)
+            continue;
+        hashLast = entry.first.txhash;
+        result.push_back(hashLast.GetHex());
+    }
+    return result;
+}
+
+json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw std::runtime_error(
+            "getaddresshistory <address> [count=100] [skip=0]\n"
+            "Returns up to [count] outputs paying and inputs spending from <address>,\n"
+            "newest first, skipping the [skip] most recent ones.\n"
+            "Requires -addressindex.");
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    AddressIndexKeyFromParam(params[0], nAddressType, hashAddress);
+
+    int nCount = params.size() > 1 ? params[1].get_int() : 100;
+    int nSkip = params.size() > 2 ? params[2].get_int() : 0;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nSkip < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+
+    AddressIndexEntries vHistory;
+    if (!CTxDB("r").ReadAddressIndex(nAddressType, hashAddress, vHistory))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    json_spirit::Array result;
+    for (int i = (int)vHistory.size() - 1 - nSkip; i >= 0 && (int)result.size() < nCount; i--)
+    {
+        const CAddressIndexKey& key = vHistory[i].first;
+        json_spirit::Object entry;
+        entry.push_back(json_spirit::Pair("txid", key.txhash.GetHex()));
+        entry.push_back(json_spirit::Pair("height", (int)key.nHeight));
+        entry.push_back(json_spirit::Pair("index", (int)key.nIndex));
+        entry.push_back(json_spirit::Pair("spending", key.fSpending));
+        entry.push_back(json_spirit::Pair("amount", ValueFromAmount(vHistory[i].second)));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "getaddressutxos <address>\n"
+            "Returns the confirmed unspent outputs paying <address>.\n"
+            "Requires -addressindex.");
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    AddressIndexKeyFromParam(params[0], nAddressType, hashAddress);
+
+    AddressUnspentEntries vUnspent;
+    if (!CTxDB("r").ReadAddressUnspentIndex(nAddressType, hashAddress, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    json_spirit::Array result;
+    for (const auto& entry : vUnspent)
+    {
+        json_spirit::Object utxo;
+        utxo.push_back(json_spirit::Pair("txid", entry.first.txhash.GetHex()));
+        utxo.push_back(json_spirit::Pair("vout", (int)entry.first.nIndex));
+        utxo.push_back(json_spirit::Pair("scriptPubKey", HexStr(entry.second.script.begin(), entry.second.script.end())));
+        utxo.push_back(json_spirit::Pair("amount", ValueFromAmount(entry.second.nValue)));
+        utxo.push_back(json_spirit::Pair("height", entry.second.nHeight));
+        result.push_back(utxo);
+    }
+    return result;
+}
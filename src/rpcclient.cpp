@@ -120,7 +120,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblock", 1 },
     { "getblockbynumber", 0 },
     { "getblockbynumber", 1 },
+    { "getaddresstxids", 1 },
+    { "getaddresstxids", 2 },
+    { "getaddresshistory", 1 },
+    { "getaddresshistory", 2 },
     { "getblockhash", 0 },
+    { "waitfornewblock", 0 },
+    { "waitforblock", 1 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -136,6 +142,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendmany", 2 },
     { "reservebalance", 0 },
     { "reservebalance", 1 },
+    { "setstakingconfig", 0 },
     { "addmultisigaddress", 0 },
     { "addmultisigaddress", 1 },
     { "listunspent", 0 },
@@ -150,6 +157,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importprivkey", 2 },
     { "checkkernel", 0 },
     { "checkkernel", 1 },
+    { "checkkernels", 0 },
+    { "checkkernels", 1 },
+    { "checkkernels", 2 },
 };
 
 class CRPCConvertTable
@@ -122,6 +122,8 @@ json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp)
     if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key");
     if (fWalletUnlockStakingOnly)
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Wallet is unlocked for staking only.");
+    if (fRescan && pwalletMain->IsScanning())
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort the rescan or wait.");
 
     CKey key = vchSecret.GetKey();
     CPubKey pubkey = key.GetPubKey();
@@ -143,16 +145,32 @@ json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+    // The rescan takes the locks itself, only while applying what it found
+    if (fRescan) {
+        if (pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Key imported, but another rescan is running. Rescan again once it finishes.");
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return json_spirit::Value::null;
 }
 
+json_spirit::Value abortrescan(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "abortrescan\n"
+            "Stops the current wallet rescan triggered by importprivkey or importwallet.\n"
+            "Returns true if a rescan was running.");
+
+    if (!pwalletMain->IsScanning())
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
+
 json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -161,72 +179,81 @@ json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp)
             "Imports keys from a wallet dump file (see dumpwallet).");
 
     EnsureWalletIsUnlocked();
+    if (pwalletMain->IsScanning())
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort the rescan or wait.");
 
     std::ifstream file;
     file.open(params[0].get_str().c_str());
     if (!file.is_open())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
-    int64_t nTimeBegin = pindexBest->nTime;
-
     bool fGood = true;
+    CBlockIndex *pindex;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    while (file.good()) {
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-        CHoneySecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-        CKey key = vchSecret.GetKey();
-        CPubKey pubkey = key.GetPubKey();
-        CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
-            LogPrintf("Skipping import of %s (key already present)\n", CHoneyAddress(keyid).ToString());
-            continue;
-        }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
+        int64_t nTimeBegin = pindexBest->nTime;
+
+        while (file.good()) {
+            std::string line;
+            std::getline(file, line);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::vector<std::string> vstr;
+            boost::split(vstr, line, boost::is_any_of(" "));
+            if (vstr.size() < 2)
+                continue;
+            CHoneySecret vchSecret;
+            if (!vchSecret.SetString(vstr[0]))
+                continue;
+            CKey key = vchSecret.GetKey();
+            CPubKey pubkey = key.GetPubKey();
+            CKeyID keyid = pubkey.GetID();
+            if (pwalletMain->HaveKey(keyid)) {
+                LogPrintf("Skipping import of %s (key already present)\n", CHoneyAddress(keyid).ToString());
+                continue;
             }
+            int64_t nTime = DecodeDumpTime(vstr[1]);
+            std::string strLabel;
+            bool fLabel = true;
+            for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+                if (boost::algorithm::starts_with(vstr[nStr], "#"))
+                    break;
+                if (vstr[nStr] == "change=1")
+                    fLabel = false;
+                if (vstr[nStr] == "reserve=1")
+                    fLabel = false;
+                if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+                    strLabel = DecodeDumpString(vstr[nStr].substr(6));
+                    fLabel = true;
+                }
+            }
+            LogPrintf("Importing %s...\n", CHoneyAddress(keyid).ToString());
+            if (!pwalletMain->AddKey(key)) {
+                fGood = false;
+                continue;
+            }
+            pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
+            if (fLabel)
+                pwalletMain->SetAddressBookName(keyid, strLabel);
+            nTimeBegin = std::min(nTimeBegin, nTime);
         }
-        LogPrintf("Importing %s...\n", CHoneyAddress(keyid).ToString());
-        if (!pwalletMain->AddKey(key)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBookName(keyid, strLabel);
-        nTimeBegin = std::min(nTimeBegin, nTime);
-    }
-    file.close();
+        file.close();
 
-    CBlockIndex *pindex = pindexBest;
-    while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
-        pindex = pindex->pprev;
+        pindex = pindexBest;
+        while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
+            pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
+
+        LogPrintf("Rescanning last %i blocks\n", pindexBest->nHeight - pindex->nHeight + 1);
+    }
 
-    LogPrintf("Rescanning last %i blocks\n", pindexBest->nHeight - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
+    // The rescan takes the locks itself, only while applying what it found
+    if (pwalletMain->ScanForWalletTransactions(pindex) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Keys imported, but another rescan is running. Rescan again once it finishes.");
     pwalletMain->ReacceptWalletTransactions();
     pwalletMain->MarkDirty();
 
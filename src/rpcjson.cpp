@@ -0,0 +1,411 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpcjson.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits>
+
+static const char* const pszHexUpper = "0123456789ABCDEF";
+
+void CJSONWriter::WriteString(const std::string& str)
+{
+    strOut.reserve(strOut.size() + str.size() + 2);
+    strOut += '"';
+    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+    {
+        unsigned char c = *it;
+        switch (c)
+        {
+        case '"':  strOut += "\\\""; break;
+        case '\\': strOut += "\\\\"; break;
+        case '\b': strOut += "\\b"; break;
+        case '\f': strOut += "\\f"; break;
+        case '\n': strOut += "\\n"; break;
+        case '\r': strOut += "\\r"; break;
+        case '\t': strOut += "\\t"; break;
+        default:
+            // json_spirit escapes everything iswprint() rejects in the C locale
+            if (c >= 0x20 && c < 0x7f)
+                strOut += (char)c;
+            else
+            {
+                strOut += "\\u00";
+                strOut += pszHexUpper[c >> 4];
+                strOut += pszHexUpper[c & 0xf];
+            }
+        }
+    }
+    strOut += '"';
+}
+
+void CJSONWriter::Key(const std::string& strKey)
+{
+    Separator();
+    WriteString(strKey);
+    strOut += ':';
+}
+
+void CJSONWriter::Write(const std::string& str)
+{
+    Separator();
+    WriteString(str);
+    fNeedComma = true;
+}
+
+void CJSONWriter::Write(const char* psz)
+{
+    Write(std::string(psz));
+}
+
+void CJSONWriter::Write(bool f)
+{
+    Separator();
+    strOut += f ? "true" : "false";
+    fNeedComma = true;
+}
+
+void CJSONWriter::Write(int64_t n)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lld", (long long)n);
+    Separator();
+    strOut += buf;
+    fNeedComma = true;
+}
+
+void CJSONWriter::Write(uint64_t n)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)n);
+    Separator();
+    strOut += buf;
+    fNeedComma = true;
+}
+
+void CJSONWriter::Write(double d)
+{
+    char buf[384];
+    snprintf(buf, sizeof(buf), "%.8f", d);
+    Separator();
+    strOut += buf;
+    fNeedComma = true;
+}
+
+void CJSONWriter::Write(const json_spirit::Value& value)
+{
+    switch (value.type())
+    {
+    case json_spirit::obj_type:
+    {
+        BeginObject();
+        const json_spirit::Object& obj = value.get_obj();
+        for (json_spirit::Object::const_iterator it = obj.begin(); it != obj.end(); ++it)
+        {
+            Key(it->name_);
+            Write(it->value_);
+        }
+        EndObject();
+        break;
+    }
+    case json_spirit::array_type:
+    {
+        BeginArray();
+        const json_spirit::Array& arr = value.get_array();
+        for (json_spirit::Array::const_iterator it = arr.begin(); it != arr.end(); ++it)
+            Write(*it);
+        EndArray();
+        break;
+    }
+    case json_spirit::str_type:  Write(value.get_str()); break;
+    case json_spirit::bool_type: Write(value.get_bool()); break;
+    case json_spirit::int_type:
+        if (value.is_uint64())
+            Write(value.get_uint64());
+        else
+            Write(value.get_int64());
+        break;
+    case json_spirit::real_type: Write(value.get_real()); break;
+    case json_spirit::null_type: WriteNull(); break;
+    }
+}
+
+namespace {
+
+/** Recursive descent parser producing json_spirit values */
+class CJSONParser
+{
+public:
+    CJSONParser(const char* pbeginIn, const char* pendIn) : p(pbeginIn), pend(pendIn), nDepth(0) {}
+
+    bool ParseDocument(json_spirit::Value& value)
+    {
+        if (!ParseValue(value))
+            return false;
+        SkipSpace();
+        return p == pend;
+    }
+
+private:
+    const char* p;
+    const char* pend;
+    int nDepth;
+
+    // Deeper nesting than this is never legitimate RPC input
+    static const int MAX_DEPTH = 512;
+
+    void SkipSpace()
+    {
+        while (p != pend && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    }
+
+    bool Literal(const char* psz)
+    {
+        size_t n = strlen(psz);
+        if ((size_t)(pend - p) < n || memcmp(p, psz, n) != 0)
+            return false;
+        p += n;
+        return true;
+    }
+
+    bool ParseValue(json_spirit::Value& value)
+    {
+        SkipSpace();
+        if (p == pend)
+            return false;
+        switch (*p)
+        {
+        case '{': return ParseObject(value);
+        case '[': return ParseArray(value);
+        case '"':
+        {
+            std::string str;
+            if (!ParseString(str))
+                return false;
+            value = json_spirit::Value(str);
+            return true;
+        }
+        case 't': if (!Literal("true")) return false; value = json_spirit::Value(true); return true;
+        case 'f': if (!Literal("false")) return false; value = json_spirit::Value(false); return true;
+        case 'n': if (!Literal("null")) return false; value = json_spirit::Value(); return true;
+        default:  return ParseNumber(value);
+        }
+    }
+
+    bool ParseObject(json_spirit::Value& value)
+    {
+        if (++nDepth > MAX_DEPTH)
+            return false;
+        ++p; // '{'
+        value = json_spirit::Object();
+        json_spirit::Object& obj = value.get_obj();
+        SkipSpace();
+        if (p != pend && *p == '}')
+        {
+            ++p;
+            --nDepth;
+            return true;
+        }
+        while (true)
+        {
+            SkipSpace();
+            if (p == pend || *p != '"')
+                return false;
+            obj.push_back(json_spirit::Pair(std::string(), json_spirit::Value()));
+            if (!ParseString(obj.back().name_))
+                return false;
+            SkipSpace();
+            if (p == pend || *p != ':')
+                return false;
+            ++p;
+            if (!ParseValue(obj.back().value_))
+                return false;
+            SkipSpace();
+            if (p == pend)
+                return false;
+            if (*p == ',')
+            {
+                ++p;
+                continue;
+            }
+            if (*p != '}')
+                return false;
+            ++p;
+            --nDepth;
+            return true;
+        }
+    }
+
+    bool ParseArray(json_spirit::Value& value)
+    {
+        if (++nDepth > MAX_DEPTH)
+            return false;
+        ++p; // '['
+        value = json_spirit::Array();
+        json_spirit::Array& arr = value.get_array();
+        SkipSpace();
+        if (p != pend && *p == ']')
+        {
+            ++p;
+            --nDepth;
+            return true;
+        }
+        while (true)
+        {
+            arr.push_back(json_spirit::Value());
+            if (!ParseValue(arr.back()))
+                return false;
+            SkipSpace();
+            if (p == pend)
+                return false;
+            if (*p == ',')
+            {
+                ++p;
+                continue;
+            }
+            if (*p != ']')
+                return false;
+            ++p;
+            --nDepth;
+            return true;
+        }
+    }
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool ParseString(std::string& str)
+    {
+        ++p; // opening quote
+        const char* pstart = p;
+        const char* pquote = nullptr;
+        while (true)
+        {
+            // Copy runs without escapes in one go. The next quote is only
+            // searched for again once an escaped quote has been consumed.
+            if (pquote == nullptr || pquote < p)
+            {
+                pquote = (const char*)memchr(p, '"', pend - p);
+                if (!pquote)
+                    return false;
+            }
+            const char* pescape = (const char*)memchr(p, '\\', pquote - p);
+            p = pescape ? pescape : pquote;
+            str.append(pstart, p);
+            if (*p == '"')
+            {
+                ++p;
+                return true;
+            }
+            ++p; // backslash
+            if (p == pend)
+                return false;
+            switch (*p++)
+            {
+            case '"':  str += '"'; break;
+            case '\\': str += '\\'; break;
+            case '/':  str += '/'; break;
+            case 'b':  str += '\b'; break;
+            case 'f':  str += '\f'; break;
+            case 'n':  str += '\n'; break;
+            case 'r':  str += '\r'; break;
+            case 't':  str += '\t'; break;
+            case 'u':
+            {
+                if (pend - p < 4)
+                    return false;
+                unsigned int c = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    int n = HexValue(*p++);
+                    if (n < 0)
+                        return false;
+                    c = (c << 4) | n;
+                }
+                // Same narrowing json_spirit applies to std::string values
+                str += (char)c;
+                break;
+            }
+            default:
+                return false;
+            }
+            pstart = p;
+        }
+    }
+
+    bool ParseNumber(json_spirit::Value& value)
+    {
+        const char* pstart = p;
+        bool fReal = false;
+        if (p != pend && *p == '-')
+            ++p;
+        if (p == pend || *p < '0' || *p > '9')
+            return false;
+        while (p != pend && *p >= '0' && *p <= '9')
+            ++p;
+        if (p != pend && *p == '.')
+        {
+            fReal = true;
+            ++p;
+            if (p == pend || *p < '0' || *p > '9')
+                return false;
+            while (p != pend && *p >= '0' && *p <= '9')
+                ++p;
+        }
+        if (p != pend && (*p == 'e' || *p == 'E'))
+        {
+            fReal = true;
+            ++p;
+            if (p != pend && (*p == '+' || *p == '-'))
+                ++p;
+            if (p == pend || *p < '0' || *p > '9')
+                return false;
+            while (p != pend && *p >= '0' && *p <= '9')
+                ++p;
+        }
+
+        std::string strNum(pstart, p);
+        if (fReal)
+        {
+            value = json_spirit::Value(strtod(strNum.c_str(), nullptr));
+            return true;
+        }
+        errno = 0;
+        if (*pstart == '-')
+        {
+            long long n = strtoll(strNum.c_str(), nullptr, 10);
+            if (errno == ERANGE)
+                return false;
+            value = json_spirit::Value((int64_t)n);
+        }
+        else
+        {
+            unsigned long long n = strtoull(strNum.c_str(), nullptr, 10);
+            if (errno == ERANGE)
+                return false;
+            if (n <= (unsigned long long)std::numeric_limits<int64_t>::max())
+                value = json_spirit::Value((int64_t)n);
+            else
+                value = json_spirit::Value((uint64_t)n);
+        }
+        return true;
+    }
+};
+
+} // anon namespace
+
+bool ParseJSON(const std::string& strJSON, json_spirit::Value& valueRet)
+{
+    CJSONParser parser(strJSON.data(), strJSON.data() + strJSON.size());
+    return parser.ParseDocument(valueRet);
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2016-2017 The Honey developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef HONEY_RPCJSON_H
+#define HONEY_RPCJSON_H
+
+#include <json/json_spirit_value.h>
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Writes JSON text straight into a string, for RPC replies too large to
+ * build as json_spirit trees first. The output is byte for byte what
+ * json_spirit::write_string() gives for the same values (compact form).
+ *
+ * Calls must nest properly: inside an object every value is preceded by
+ * Key(), inside an array it is not. Commas are inserted automatically.
+ */
+class CJSONWriter
+{
+public:
+    CJSONWriter() : fNeedComma(false) {}
+
+    void BeginObject() { Separator(); strOut += '{'; }
+    void EndObject() { strOut += '}'; fNeedComma = true; }
+    void BeginArray() { Separator(); strOut += '['; }
+    void EndArray() { strOut += ']'; fNeedComma = true; }
+
+    /** Name of the next object member */
+    void Key(const std::string& strKey);
+
+    void Write(const std::string& str);
+    void Write(const char* psz);
+    void Write(bool f);
+    void Write(int n) { Write((int64_t)n); }
+    void Write(unsigned int n) { Write((int64_t)n); }
+    void Write(int64_t n);
+    void Write(uint64_t n);
+    void Write(double d);
+    void Write(const json_spirit::Value& value);
+    void WriteNull() { Separator(); strOut += "null"; fNeedComma = true; }
+    /** Append text that is already JSON */
+    void WriteRaw(const std::string& strJSON) { Separator(); strOut += strJSON; fNeedComma = true; }
+
+    template<typename T>
+    void Pair(const std::string& strKey, const T& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+
+    const std::string& str() const { return strOut; }
+    std::string& str() { return strOut; }
+    void clear() { strOut.clear(); fNeedComma = false; }
+
+private:
+    std::string strOut;
+    bool fNeedComma;
+
+    void Separator()
+    {
+        if (fNeedComma)
+            strOut += ',';
+        fNeedComma = false;
+    }
+
+    void WriteString(const std::string& str);
+};
+
+/** Parse JSON text into json_spirit values. Gives the same values as
+ * json_spirit::read_string() on valid input, without Boost.Spirit, and
+ * rejects trailing garbage. */
+bool ParseJSON(const std::string& strJSON, json_spirit::Value& valueRet);
+
+#endif // HONEY_RPCJSON_H
@@ -230,6 +230,99 @@ json_spirit::Value checkkernel(const json_spirit::Array& params, bool fHelp)
     return result;
 }
 
+// Kernel hashes one checkkernels call may ask for, inputs times staking times
+static const uint64_t MAX_CHECKKERNELS_HASHES = 50000000;
+
+json_spirit::Value checkkernels(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw std::runtime_error(
+            "checkkernels [{\"txid\":txid,\"vout\":n},...] [starttime] [endtime]\n"
+            "Find every kernel among the given inputs on top of the best block, at each\n"
+            "staking time from starttime (default now) to endtime (default the furthest\n"
+            "time a block may have).\n"
+            "Returns {\"bits\", \"starttime\", \"endtime\", \"unavailable\":[inputs that can't stake],\n"
+            "\"hits\":[{\"txid\", \"vout\", \"time\", \"hashproofofstake\", \"targetproofofstake\", \"margin\"}]}\n"
+            "where margin is how far the hash falls below the target, from 0 to 1.\n"
+        );
+
+    RPCTypeCheck(params, {json_spirit::array_type, json_spirit::int_type, json_spirit::int_type});
+
+    if (vNodes.empty())
+        throw JSONRPCError(-9, "Honey is not connected!");
+
+    if (IsInitialBlockDownload())
+        throw JSONRPCError(-10, "Honey is downloading blocks...");
+
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    const CBlockIndex* pindexPrev = chain->pindexBest;
+    unsigned int nBits = GetNextTargetRequired(pindexPrev, true);
+    int64_t nTimeBegin = params.size() > 1 ? params[1].get_int64() : GetAdjustedTime();
+    int64_t nTimeEnd = params.size() > 2 ? params[2].get_int64() : FutureDrift(GetAdjustedTime());
+    if (nTimeBegin < 0 || nTimeEnd > std::numeric_limits<unsigned int>::max() || nTimeBegin > nTimeEnd)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, bad time range");
+
+    const json_spirit::Array& inputs = params[0].get_array();
+    const uint64_t nTimes = (nTimeEnd - nTimeBegin) / (STAKE_TIMESTAMP_MASK + 1) + 1;
+    if (inputs.size() * nTimes > MAX_CHECKKERNELS_HASHES)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid parameter, more than %u kernel hashes asked for", MAX_CHECKKERNELS_HASHES));
+
+    std::vector<CKernelInput> vInputs;
+    vInputs.reserve(inputs.size());
+    json_spirit::Array unavailable;
+    for (const json_spirit::Value& input : inputs)
+    {
+        if (input.type() != json_spirit::obj_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected object");
+        const json_spirit::Object& o = input.get_obj();
+
+        const json_spirit::Value& txid_v = json_spirit::find_value(o, "txid");
+        if (txid_v.type() != json_spirit::str_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, missing txid key");
+        std::string txid = txid_v.get_str();
+        if (!IsHex(txid))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected hex txid");
+
+        const json_spirit::Value& vout_v = json_spirit::find_value(o, "vout");
+        if (vout_v.type() != json_spirit::int_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, missing vout key");
+        int nOutput = vout_v.get_int();
+        if (nOutput < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, vout must be positive");
+
+        CKernelInput kernelInput;
+        if (GetKernelInput(*chain, COutPoint(uint256(txid), nOutput), kernelInput))
+            vInputs.push_back(kernelInput);
+        else
+            unavailable.push_back(o);
+    }
+
+    std::vector<CKernelHit> vHits;
+    FindKernels(pindexPrev, nBits, vInputs, nTimeBegin, nTimeEnd, vHits);
+
+    json_spirit::Array hits;
+    for (const CKernelHit& hit : vHits)
+    {
+        const CKernelInput& kernelInput = vInputs[hit.nInput];
+        json_spirit::Object oHit;
+        oHit.push_back(json_spirit::Pair("txid", kernelInput.prevout.hash.GetHex()));
+        oHit.push_back(json_spirit::Pair("vout", (int64_t)kernelInput.prevout.n));
+        oHit.push_back(json_spirit::Pair("time", (int64_t)hit.nTime));
+        oHit.push_back(json_spirit::Pair("hashproofofstake", hit.hashProofOfStake.GetHex()));
+        oHit.push_back(json_spirit::Pair("targetproofofstake", hit.targetProofOfStake.GetHex()));
+        oHit.push_back(json_spirit::Pair("margin", 1.0 - hit.hashProofOfStake.getdouble() / hit.targetProofOfStake.getdouble()));
+        hits.push_back(oHit);
+    }
+
+    json_spirit::Object result;
+    result.push_back(json_spirit::Pair("bits", strprintf("%08x", nBits)));
+    result.push_back(json_spirit::Pair("starttime", nTimeBegin));
+    result.push_back(json_spirit::Pair("endtime", nTimeEnd));
+    result.push_back(json_spirit::Pair("unavailable", unavailable));
+    result.push_back(json_spirit::Pair("hits", hits));
+    return result;
+}
+
 json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -258,6 +351,7 @@ json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp)
         static CBlockIndex* pindexPrev;
         static int64_t nStart;
         static CBlock* pblock;
+        static std::vector<uint256> vCoinbaseBranch;
         if (pindexPrev != pindexBest ||
             (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60))
         {
@@ -274,7 +368,7 @@ json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp)
             nStart = GetTime();
 
             // Create new block
-            pblock = CreateNewBlock(*pMiningKey);
+            pblock = CreateNewBlock(*pMiningKey, false, nullptr, &vCoinbaseBranch);
             if (!pblock)
                 throw JSONRPCError(-7, "Out of memory");
             vNewBlock.push_back(pblock);
@@ -286,7 +380,7 @@ json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp)
 
         // Update nExtraNonce
         static unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce, &vCoinbaseBranch);
 
         // Save
         mapNewBlock[pblock->hashMerkleRoot] = std::make_pair(pblock, pblock->vtx[0].vin[0].scriptSig);
@@ -348,7 +442,10 @@ json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp)
         pblock->nNonce = pdata->nNonce;
 
         if(coinbase.size() == 0)
+        {
             pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+            pblock->vtx[0].InvalidateHash();
+        }
         else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
 
@@ -392,6 +489,7 @@ json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp)
         static CBlockIndex* pindexPrev;
         static int64_t nStart;
         static CBlock* pblock;
+        static std::vector<uint256> vCoinbaseBranch;
         if (pindexPrev != pindexBest ||
             (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60))
         {
@@ -413,7 +511,7 @@ json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp)
             nStart = GetTime();
 
             // Create new block
-            pblock = CreateNewBlock(*pMiningKey);
+            pblock = CreateNewBlock(*pMiningKey, false, nullptr, &vCoinbaseBranch);
             if (!pblock)
                 throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
             vNewBlock.push_back(pblock);
@@ -428,7 +526,7 @@ json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp)
 
         // Update nExtraNonce
         static unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce, &vCoinbaseBranch);
 
         // Save
         mapNewBlock[pblock->hashMerkleRoot] = std::make_pair(pblock, pblock->vtx[0].vin[0].scriptSig);
@@ -468,6 +566,7 @@ json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp)
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        pblock->vtx[0].InvalidateHash();
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
         assert(pwalletMain != nullptr);
@@ -496,9 +595,11 @@ json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "  \"longpollid\" : pass as \"longpollid\" in [params] to wait for the next template\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
     std::string strMode = "template";
+    json_spirit::Value lpval;
     if (params.size() > 0)
     {
         const json_spirit::Object& oparam = params[0].get_obj();
@@ -511,11 +612,50 @@ json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp
         }
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
+        lpval = json_spirit::find_value(oparam, "longpollid");
     }
 
     if (strMode != "template")
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
 
+    if (!pMiningKey)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Mining needs a wallet");
+
+    if (lpval.type() == json_spirit::str_type)
+    {
+        // Wait without locks for a new best block, or for new transactions
+        // once a minute has passed, like BIP 22 long polling
+        const std::string& strLongpoll = lpval.get_str();
+        if (strLongpoll.size() < 64 || !IsHex(strLongpoll.substr(0, 64)))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+        const uint256 hashWatched(strLongpoll.substr(0, 64));
+        const unsigned int nTransactionsUpdatedWatched = atoi64(strLongpoll.substr(64));
+
+        int64_t nCheckTxTime = GetTimeMillis() + 60 * 1000;
+        while (true)
+        {
+            std::shared_ptr<const CChainSnapshot> chain = WaitForChainSnapshot([&hashWatched](const CChainSnapshot& c) {
+                    return c.hashBestChain != hashWatched || !IsRPCRunning();
+                }, std::max(nCheckTxTime - GetTimeMillis(), (int64_t)1));
+            if (!IsRPCRunning())
+                throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+            if (chain->hashBestChain != hashWatched)
+                break;
+            if (GetTimeMillis() >= nCheckTxTime)
+            {
+                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedWatched)
+                    break;
+                nCheckTxTime += 10 * 1000;
+            }
+        }
+    }
+    else if (lpval.type() != json_spirit::null_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+
+    // Registered as thread safe so long polls hold no locks, from here on
+    // it works under both like the other mining calls
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
     if (vNodes.empty())
         throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Honey is not connected!");
 
@@ -525,11 +665,13 @@ json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp
     if (pindexBest->nHeight >= Params().LastPOWBlock())
         throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
 
-    // Update block
+    // Update block. The transaction list only changes with the block, so
+    // it is built once for all the calls that share it.
     static unsigned int nTransactionsUpdatedLast;
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static CBlock* pblock;
+    static json_spirit::Array transactions;
     if (pindexPrev != pindexBest ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
@@ -551,57 +693,57 @@ json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp
         if (!pblock)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-
-    // Update nTime
-    pblock->UpdateTime(pindexPrev);
-    pblock->nNonce = 0;
-
-    json_spirit::Array transactions;
-    std::map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    CTxDB txdb("r");
-    for (CTransaction& tx : pblock->vtx)
-    {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase() || tx.IsCoinStake())
-            continue;
+        transactions.clear();
+        std::map<uint256, int64_t> setTxIndex;
+        int i = 0;
+        CTxDB txdb("r");
+        for (CTransaction& tx : pblock->vtx)
+        {
+            uint256 txHash = tx.GetHash();
+            setTxIndex[txHash] = i++;
 
-        json_spirit::Object entry;
+            if (tx.IsCoinBase() || tx.IsCoinStake())
+                continue;
 
-        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-        ssTx << tx;
-        entry.push_back(json_spirit::Pair("data", HexStr(ssTx.begin(), ssTx.end())));
+            json_spirit::Object entry;
 
-        entry.push_back(json_spirit::Pair("hash", txHash.GetHex()));
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << tx;
+            entry.push_back(json_spirit::Pair("data", HexStr(ssTx.begin(), ssTx.end())));
 
-        MapPrevTx mapInputs;
-        std::map<uint256, CTxIndex> mapUnused;
-        bool fInvalid = false;
-        if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
-        {
-            entry.push_back(json_spirit::Pair("fee", (int64_t)(tx.GetValueIn(mapInputs) - tx.GetValueOut())));
+            entry.push_back(json_spirit::Pair("hash", txHash.GetHex()));
 
-            json_spirit::Array deps;
-            for (MapPrevTx::value_type& inp : mapInputs)
+            MapPrevTx mapInputs;
+            std::map<uint256, CTxIndex> mapUnused;
+            bool fInvalid = false;
+            if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
             {
-                if (setTxIndex.count(inp.first))
-                    deps.push_back(setTxIndex[inp.first]);
+                entry.push_back(json_spirit::Pair("fee", (int64_t)(tx.GetValueIn(mapInputs) - tx.GetValueOut())));
+
+                json_spirit::Array deps;
+                for (MapPrevTx::value_type& inp : mapInputs)
+                {
+                    if (setTxIndex.count(inp.first))
+                        deps.push_back(setTxIndex[inp.first]);
+                }
+                entry.push_back(json_spirit::Pair("depends", deps));
+
+                int64_t nSigOps = GetLegacySigOpCount(tx);
+                nSigOps += GetP2SHSigOpCount(tx, mapInputs);
+                entry.push_back(json_spirit::Pair("sigops", nSigOps));
             }
-            entry.push_back(json_spirit::Pair("depends", deps));
 
-            int64_t nSigOps = GetLegacySigOpCount(tx);
-            nSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            entry.push_back(json_spirit::Pair("sigops", nSigOps));
+            transactions.push_back(entry);
         }
 
-        transactions.push_back(entry);
+        // Need to update only after we know CreateNewBlock succeeded
+        pindexPrev = pindexPrevNew;
     }
 
+    // Update nTime
+    pblock->UpdateTime(pindexPrev);
+    pblock->nNonce = 0;
+
     json_spirit::Object aux;
     aux.push_back(json_spirit::Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
@@ -630,6 +772,7 @@ json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp
     result.push_back(json_spirit::Pair("curtime", (int64_t)pblock->nTime));
     result.push_back(json_spirit::Pair("bits", strprintf("%08x", pblock->nBits)));
     result.push_back(json_spirit::Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(json_spirit::Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
 
     return result;
 }
@@ -33,32 +33,41 @@ json_spirit::Value getinfo(const json_spirit::Array& params, bool fHelp)
 
     proxyType proxy;
     GetProxy(NET_IPV4, proxy);
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    int nConnections;
+    {
+        LOCK(cs_vNodes);
+        nConnections = (int)vNodes.size();
+    }
 
     json_spirit::Object obj, diff;
     obj.push_back(json_spirit::Pair("version",       FormatFullVersion()));
     obj.push_back(json_spirit::Pair("protocolversion",(int)PROTOCOL_VERSION));
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
+        // Chain fields come from the snapshot, wallet ones still need the locks
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         obj.push_back(json_spirit::Pair("walletversion", pwalletMain->GetVersion()));
         obj.push_back(json_spirit::Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
         obj.push_back(json_spirit::Pair("newmint",       ValueFromAmount(pwalletMain->GetNewMint())));
         obj.push_back(json_spirit::Pair("stake",         ValueFromAmount(pwalletMain->GetStake())));
     }
 #endif
-    obj.push_back(json_spirit::Pair("blocks",        (int)nBestHeight));
+    obj.push_back(json_spirit::Pair("blocks",        chain->nHeight));
     obj.push_back(json_spirit::Pair("timeoffset",    (int64_t)GetTimeOffset()));
-    obj.push_back(json_spirit::Pair("moneysupply",   ValueFromAmount(pindexBest->nMoneySupply)));
-    obj.push_back(json_spirit::Pair("connections",   (int)vNodes.size()));
+    obj.push_back(json_spirit::Pair("moneysupply",   ValueFromAmount(chain->nMoneySupply)));
+    obj.push_back(json_spirit::Pair("connections",   nConnections));
     obj.push_back(json_spirit::Pair("proxy",         (proxy.IsValid() ? proxy.ToStringIPPort() : std::string())));
     obj.push_back(json_spirit::Pair("ip",            GetLocalAddress(nullptr).ToStringIP()));
 
     diff.push_back(json_spirit::Pair("proof-of-work",  GetDifficulty()));
-    diff.push_back(json_spirit::Pair("proof-of-stake", GetDifficulty(GetLastBlockIndex(pindexBest, true))));
+    diff.push_back(json_spirit::Pair("proof-of-stake", GetDifficulty(GetLastBlockIndex(chain->pindexBest, true))));
     obj.push_back(json_spirit::Pair("difficulty",    diff));
 
     obj.push_back(json_spirit::Pair("testnet",       TestNet()));
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         obj.push_back(json_spirit::Pair("keypoololdest", (int64_t)pwalletMain->GetOldestKeyPoolTime()));
         obj.push_back(json_spirit::Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
     }
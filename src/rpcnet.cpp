@@ -238,11 +238,26 @@ json_spirit::Value getnettotals(const json_spirit::Array& params, bool fHelp)
         throw std::runtime_error(
             "getnettotals\n"
             "Returns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.");
+            "current time, the -maxuploadtarget budget and the upload rate limits.");
 
     json_spirit::Object obj;
     obj.push_back(json_spirit::Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(json_spirit::Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(json_spirit::Pair("timemillis", GetTimeMillis()));
+
+    json_spirit::Object outboundLimit;
+    outboundLimit.push_back(json_spirit::Pair("timeframe", CNode::GetMaxOutboundTimeframe()));
+    outboundLimit.push_back(json_spirit::Pair("target", CNode::GetMaxOutboundTarget()));
+    outboundLimit.push_back(json_spirit::Pair("target_reached", CNode::OutboundTargetReached(false)));
+    outboundLimit.push_back(json_spirit::Pair("serve_historical_blocks", !CNode::OutboundTargetReached(true)));
+    outboundLimit.push_back(json_spirit::Pair("bytes_left_in_cycle", CNode::GetOutboundTargetBytesLeft()));
+    outboundLimit.push_back(json_spirit::Pair("time_left_in_cycle", CNode::GetMaxOutboundTimeLeftInCycle()));
+    obj.push_back(json_spirit::Pair("uploadtarget", outboundLimit));
+
+    json_spirit::Object rateLimit;
+    rateLimit.push_back(json_spirit::Pair("maxuploadrate", CNode::GetMaxUploadRate()));
+    rateLimit.push_back(json_spirit::Pair("maxpeeruploadrate", CNode::GetMaxPeerUploadRate()));
+    rateLimit.push_back(json_spirit::Pair("historical_blocks_deferred", CNode::IsUploadBandwidthScarce()));
+    obj.push_back(json_spirit::Pair("uploadrate", rateLimit));
     return obj;
 }
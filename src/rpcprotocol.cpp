@@ -63,29 +63,34 @@ std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time(), FormatFullVersion());
+    return HTTPReplyHeader(nStatus, strMsg.size(), keepalive) + strMsg;
+}
+
+std::string HTTPReplyHeader(int nStatus, size_t nContentLength, bool keepalive, const std::string& strContentType)
+{
     const char *cStatus;
          if (nStatus == HTTP_OK) cStatus = "OK";
     else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
             "Content-Length: %u\r\n"
-            "Content-Type: application/json\r\n"
+            "Content-Type: %s\r\n"
             "Server: honey-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
+            "\r\n",
         nStatus,
         cStatus,
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
-        strMsg.size(),
-        FormatFullVersion(),
-        strMsg);
+        nContentLength,
+        strContentType,
+        FormatFullVersion());
 }
 
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
@@ -197,6 +202,47 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string,
     return HTTP_OK;
 }
 
+int ParseHTTPRequest(const char* pbegin, size_t nSize, int& nProto, std::string& http_method, std::string& http_uri,
+                     std::map<std::string, std::string>& mapHeadersRet, std::string& strMessageRet)
+{
+    // Headers end with an empty line, accept bare LF line ends like ReadHTTPHeaders()
+    const char* pend = pbegin + nSize;
+    const char* pheadersEnd = nullptr;
+    for (const char* p = pbegin; p < pend; p++)
+    {
+        p = (const char*)memchr(p, '\n', pend - p);
+        if (p == nullptr)
+            break;
+        if (p + 1 < pend && p[1] == '\n')
+            pheadersEnd = p + 2;
+        else if (p + 2 < pend && p[1] == '\r' && p[2] == '\n')
+            pheadersEnd = p + 3;
+        if (pheadersEnd)
+            break;
+    }
+    if (pheadersEnd == nullptr)
+        return nSize > MAX_HTTP_HEADERS_SIZE ? -1 : 0;
+    if (pheadersEnd - pbegin > (ptrdiff_t)MAX_HTTP_HEADERS_SIZE)
+        return -1;
+
+    std::istringstream stream(std::string(pbegin, pheadersEnd));
+    if (!ReadHTTPRequestLine(stream, nProto, http_method, http_uri))
+        return -1;
+    mapHeadersRet.clear();
+    int nLen = ReadHTTPHeaders(stream, mapHeadersRet);
+    if (nLen < 0 || nLen > (int)MAX_SIZE)
+        return -1;
+    if (pend - pheadersEnd < nLen)
+        return 0;
+    strMessageRet.assign(pheadersEnd, pheadersEnd + nLen);
+
+    std::string sConHdr = mapHeadersRet["connection"];
+    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+        mapHeadersRet["connection"] = nProto >= 1 ? "keep-alive" : "close";
+
+    return (pheadersEnd - pbegin) + nLen;
+}
+
 //
 // JSON-RPC protocol.  Honey speaks version 1.0 for maximum compatibility,
 // but uses JSON-RPC 1.1/2.0 standards for parts of the 1.0 standard that were
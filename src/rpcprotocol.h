@@ -38,8 +38,12 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
+/** Largest HTTP request line plus headers accepted by the RPC server */
+static const unsigned int MAX_HTTP_HEADERS_SIZE = 65536;
+
 // Honey RPC error codes
 enum RPCErrorCode
 {
@@ -134,12 +138,18 @@ private:
 
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive);
+/** Status line and headers of a reply with a body of nContentLength bytes, so the body can be sent without copying */
+std::string HTTPReplyHeader(int nStatus, size_t nContentLength, bool keepalive, const std::string& strContentType = "application/json");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet,
                     std::string& strMessageRet, int nProto);
+/** Parse the HTTP request at the start of a receive buffer. Returns the number of bytes it
+ * takes up, 0 if it is not complete yet, or -1 if it is malformed or too large. */
+int ParseHTTPRequest(const char* pbegin, size_t nSize, int& nProto, std::string& http_method, std::string& http_uri,
+                     std::map<std::string, std::string>& mapHeadersRet, std::string& strMessageRet);
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
@@ -6,6 +6,7 @@
 
 #include <base58.h>
 #include <rpcserver.h>
+#include <rpcjson.h>
 #include <txdb.h>
 #include <init.h>
 #include <main.h>
@@ -16,91 +17,96 @@
 #endif
 
 
-void ScriptPubKeyToJSON(const CScript& scriptPubKey, json_spirit::Object& out, bool fIncludeHex)
+void ScriptPubKeyToJSON(const CScript& scriptPubKey, CJSONWriter& out, bool fIncludeHex)
 {
     txnouttype type;
     std::vector<CTxDestination> addresses;
     int nRequired;
 
-    out.push_back(json_spirit::Pair("asm", scriptPubKey.ToString()));
+    out.Pair("asm", scriptPubKey.ToString());
 
     if (fIncludeHex)
-        out.push_back(json_spirit::Pair("hex", HexStr(scriptPubKey.begin(), scriptPubKey.end())));
+        out.Pair("hex", HexStr(scriptPubKey.begin(), scriptPubKey.end()));
 
     if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired))
     {
-        out.push_back(json_spirit::Pair("type", GetTxnOutputType(type)));
+        out.Pair("type", GetTxnOutputType(type));
         return;
     }
 
-    out.push_back(json_spirit::Pair("reqSigs", nRequired));
-    out.push_back(json_spirit::Pair("type", GetTxnOutputType(type)));
+    out.Pair("reqSigs", nRequired);
+    out.Pair("type", GetTxnOutputType(type));
 
-    json_spirit::Array a;
+    out.Key("addresses");
+    out.BeginArray();
     for (const CTxDestination& addr : addresses)
-        a.push_back(CHoneyAddress(addr).ToString());
-    out.push_back(json_spirit::Pair("addresses", a));
+        out.Write(CHoneyAddress(addr).ToString());
+    out.EndArray();
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry)
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& entry)
 {
-    entry.push_back(json_spirit::Pair("txid", tx.GetHash().GetHex()));
-    entry.push_back(json_spirit::Pair("version", tx.nVersion));
-    entry.push_back(json_spirit::Pair("time", (int64_t)tx.nTime));
-    entry.push_back(json_spirit::Pair("locktime", (int64_t)tx.nLockTime));
-    json_spirit::Array vin;
+    entry.Pair("txid", tx.GetHash().GetHex());
+    entry.Pair("version", tx.nVersion);
+    entry.Pair("time", (int64_t)tx.nTime);
+    entry.Pair("locktime", (int64_t)tx.nLockTime);
+    entry.Key("vin");
+    entry.BeginArray();
     for (const CTxIn& txin : tx.vin)
     {
-        json_spirit::Object in;
+        entry.BeginObject();
         if (tx.IsCoinBase())
-            in.push_back(json_spirit::Pair("coinbase", HexStr(txin.scriptSig.begin(), txin.scriptSig.end())));
+            entry.Pair("coinbase", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
         else
         {
-            in.push_back(json_spirit::Pair("txid", txin.prevout.hash.GetHex()));
-            in.push_back(json_spirit::Pair("vout", (int64_t)txin.prevout.n));
-            json_spirit::Object o;
-            o.push_back(json_spirit::Pair("asm", txin.scriptSig.ToString()));
-            o.push_back(json_spirit::Pair("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end())));
-            in.push_back(json_spirit::Pair("scriptSig", o));
+            entry.Pair("txid", txin.prevout.hash.GetHex());
+            entry.Pair("vout", (int64_t)txin.prevout.n);
+            entry.Key("scriptSig");
+            entry.BeginObject();
+            entry.Pair("asm", txin.scriptSig.ToString());
+            entry.Pair("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
+            entry.EndObject();
         }
-        in.push_back(json_spirit::Pair("sequence", (int64_t)txin.nSequence));
-        vin.push_back(in);
+        entry.Pair("sequence", (int64_t)txin.nSequence);
+        entry.EndObject();
     }
-    entry.push_back(json_spirit::Pair("vin", vin));
-    json_spirit::Array vout;
+    entry.EndArray();
+    entry.Key("vout");
+    entry.BeginArray();
     for (unsigned int i = 0; i < tx.vout.size(); i++)
     {
         const CTxOut& txout = tx.vout[i];
-        json_spirit::Object out;
-        out.push_back(json_spirit::Pair("value", ValueFromAmount(txout.nValue)));
-        out.push_back(json_spirit::Pair("n", (int64_t)i));
-        json_spirit::Object o;
-        ScriptPubKeyToJSON(txout.scriptPubKey, o, true);
-        out.push_back(json_spirit::Pair("scriptPubKey", o));
-        vout.push_back(out);
+        entry.BeginObject();
+        entry.Pair("value", ValueFromAmount(txout.nValue));
+        entry.Pair("n", (int64_t)i);
+        entry.Key("scriptPubKey");
+        entry.BeginObject();
+        ScriptPubKeyToJSON(txout.scriptPubKey, entry, true);
+        entry.EndObject();
+        entry.EndObject();
     }
-    entry.push_back(json_spirit::Pair("vout", vout));
+    entry.EndArray();
 
     if (hashBlock != 0)
     {
-        entry.push_back(json_spirit::Pair("blockhash", hashBlock.GetHex()));
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second)
+        entry.Pair("blockhash", hashBlock.GetHex());
+        CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+        if (pindex)
         {
-            CBlockIndex* pindex = (*mi).second;
-            if (pindex->IsInMainChain())
+            std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+            if (chain->Contains(pindex))
             {
-                entry.push_back(json_spirit::Pair("confirmations", 1 + nBestHeight - pindex->nHeight));
-                entry.push_back(json_spirit::Pair("time", (int64_t)pindex->nTime));
-                entry.push_back(json_spirit::Pair("blocktime", (int64_t)pindex->nTime));
+                entry.Pair("confirmations", chain->GetDepth(pindex));
+                entry.Pair("time", (int64_t)pindex->nTime);
+                entry.Pair("blocktime", (int64_t)pindex->nTime);
             }
             else
-                entry.push_back(json_spirit::Pair("confirmations", 0));
+                entry.Pair("confirmations", 0);
         }
     }
 }
 
-json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp)
+void getrawtransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw std::runtime_error(
@@ -127,12 +133,15 @@ json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHel
     std::string strHex = HexStr(ssTx.begin(), ssTx.end());
 
     if (!fVerbose)
-        return strHex;
+    {
+        writer.Write(strHex);
+        return;
+    }
 
-    json_spirit::Object result;
-    result.push_back(json_spirit::Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
-    return result;
+    writer.BeginObject();
+    writer.Pair("hex", strHex);
+    TxToJSON(tx, hashBlock, writer);
+    writer.EndObject();
 }
 
 #ifdef ENABLE_WALLET
@@ -157,7 +166,7 @@ json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp)
     if (params.size() > 1)
         nMaxDepth = params[1].get_int();
 
-    std::set<CHoneyAddress> setAddress;
+    std::set<CTxDestination> setAddress;
     if (params.size() > 2)
     {
         json_spirit::Array inputs = params[2].get_array();
@@ -166,59 +175,59 @@ json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp)
             CHoneyAddress address(input.get_str());
             if (!address.IsValid())
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, std::string("Invalid Honey address: ")+input.get_str());
-            if (setAddress.count(address))
+            if (setAddress.count(address.Get()))
                 throw JSONRPCError(RPC_INVALID_PARAMETER, std::string("Invalid parameter, duplicated address: ")+input.get_str());
-           setAddress.insert(address);
+            setAddress.insert(address.Get());
         }
     }
 
-    json_spirit::Array results;
     std::vector<COutput> vecOutputs;
     assert(pwalletMain != nullptr);
-    pwalletMain->AvailableCoins(vecOutputs, false);
-    for (const COutput& out : vecOutputs)
-    {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
-
-        if(setAddress.size())
-        {
-            CTxDestination address;
-            if(!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-                continue;
-
-            if (!setAddress.count(address))
-                continue;
-        }
-
-        int64_t nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        json_spirit::Object entry;
-        entry.push_back(json_spirit::Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(json_spirit::Pair("vout", out.i));
-        CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
-        {
-            entry.push_back(json_spirit::Pair("address", CHoneyAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(json_spirit::Pair("account", pwalletMain->mapAddressBook[address]));
-        }
-        entry.push_back(json_spirit::Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        if (pk.IsPayToScriptHash())
+    // An empty address list means no filter, as it always has
+    if (!setAddress.empty())
+        pwalletMain->AvailableCoinsTo(setAddress, vecOutputs);
+    else
+        pwalletMain->AvailableCoins(vecOutputs, false);
+    vecOutputs.erase(std::remove_if(vecOutputs.begin(), vecOutputs.end(), [nMinDepth, nMaxDepth](const COutput& out) {
+        return out.nDepth < nMinDepth || out.nDepth > nMaxDepth;
+    }), vecOutputs.end());
+
+    // Only reads the wallet, which the caller holds locked
+    json_spirit::Array results(vecOutputs.size());
+    RPCParallelFor(vecOutputs.size(), [&vecOutputs, &results](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++)
         {
+            const COutput& out = vecOutputs[n];
+            int64_t nValue = out.tx->vout[out.i].nValue;
+            const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+            json_spirit::Object entry;
+            entry.push_back(json_spirit::Pair("txid", out.tx->GetHash().GetHex()));
+            entry.push_back(json_spirit::Pair("vout", out.i));
             CTxDestination address;
             if (ExtractDestination(pk, address))
             {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(json_spirit::Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                entry.push_back(json_spirit::Pair("address", CHoneyAddress(address).ToString()));
+                std::map<CTxDestination, std::string>::const_iterator mi = pwalletMain->mapAddressBook.find(address);
+                if (mi != pwalletMain->mapAddressBook.end())
+                    entry.push_back(json_spirit::Pair("account", (*mi).second));
             }
+            entry.push_back(json_spirit::Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+            if (pk.IsPayToScriptHash())
+            {
+                CTxDestination address;
+                if (ExtractDestination(pk, address))
+                {
+                    const CScriptID& hash = boost::get<CScriptID>(address);
+                    CScript redeemScript;
+                    if (pwalletMain->GetCScript(hash, redeemScript))
+                        entry.push_back(json_spirit::Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                }
+            }
+            entry.push_back(json_spirit::Pair("amount",ValueFromAmount(nValue)));
+            entry.push_back(json_spirit::Pair("confirmations",out.nDepth));
+            results[n] = entry;
         }
-        entry.push_back(json_spirit::Pair("amount",ValueFromAmount(nValue)));
-        entry.push_back(json_spirit::Pair("confirmations",out.nDepth));
-        results.push_back(entry);
-    }
+    });
 
     return results;
 }
@@ -289,7 +298,7 @@ json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool f
     return HexStr(ss.begin(), ss.end());
 }
 
-json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool fHelp)
+void decoderawtransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 1)
         throw std::runtime_error(
@@ -308,13 +317,12 @@ json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool f
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
     }
 
-    json_spirit::Object result;
-    TxToJSON(tx, 0, result);
-
-    return result;
+    writer.BeginObject();
+    TxToJSON(tx, 0, writer);
+    writer.EndObject();
 }
 
-json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp)
+void decodescript(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() != 1)
         throw std::runtime_error(
@@ -323,7 +331,6 @@ json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp)
 
     RPCTypeCheck(params, {json_spirit::str_type});
 
-    json_spirit::Object r;
     CScript script;
     if (params[0].get_str().size() > 0){
         std::vector<unsigned char> scriptData(ParseHexV(params[0], "argument"));
@@ -331,10 +338,10 @@ json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp)
     } else {
         // Empty scripts are valid
     }
-    ScriptPubKeyToJSON(script, r, false);
-
-    r.push_back(json_spirit::Pair("p2sh", CHoneyAddress(script.GetID()).ToString()));
-    return r;
+    writer.BeginObject();
+    ScriptPubKeyToJSON(script, writer, false);
+    writer.Pair("p2sh", CHoneyAddress(script.GetID()).ToString());
+    writer.EndObject();
 }
 
 json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHelp)
@@ -533,6 +540,7 @@ json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHe
         {
             txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
         }
+        mergedTx.InvalidateHash();
         if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0))
             fComplete = false;
     }
@@ -6,6 +6,7 @@
 #include <rpcserver.h>
 
 #include <base58.h>
+#include <rpcjson.h>
 #include <init.h>
 #include <util.h>
 #include <sync.h>
@@ -22,9 +23,12 @@
 #include <boost/asio/ip/v6_only.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <deque>
 #include <list>
 
 
@@ -220,27 +224,33 @@ static const CRPCCommand vRPCCommands[] =
   //  ------------------------  -----------------------  ---------- ---------- ---------
     { "help",                   &help,                   true,      true,      false },
     { "stop",                   &stop,                   true,      true,      false },
-    { "getbestblockhash",       &getbestblockhash,       true,      false,     false },
-    { "getblockcount",          &getblockcount,          true,      false,     false },
+    { "getbestblockhash",       &getbestblockhash,       true,      true,      false },
+    { "getblockcount",          &getblockcount,          true,      true,      false },
+    { "waitfornewblock",        &waitfornewblock,        true,      true,      false },
+    { "waitforblock",           &waitforblock,           true,      true,      false },
     { "getconnectioncount",     &getconnectioncount,     true,      false,     false },
     { "getpeerinfo",            &getpeerinfo,            true,      false,     false },
     { "addnode",                &addnode,                true,      true,      false },
     { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false },
     { "ping",                   &ping,                   true,      false,     false },
     { "getnettotals",           &getnettotals,           true,      true,      false },
-    { "getdifficulty",          &getdifficulty,          true,      false,     false },
-    { "getinfo",                &getinfo,                true,      false,     false },
-    { "getrawmempool",          &getrawmempool,          true,      false,     false },
-    { "getblock",               &getblock,               false,     false,     false },
-    { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
-    { "getblockhash",           &getblockhash,           false,     false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false,     false },
+    { "getdifficulty",          &getdifficulty,          true,      true,      false },
+    { "getinfo",                &getinfo,                true,      true,      false },
+    { "getrawmempool",          &getrawmempool,          true,      true,      false },
+    { "getblock",               &RPCStreamActor<getblock>, false,     true,      false },
+    { "getblockbynumber",       &RPCStreamActor<getblockbynumber>, false,     true,      false },
+    { "getblockhash",           &getblockhash,           false,     true,      false },
+    { "getrawtransaction",      &RPCStreamActor<getrawtransaction>, false,     true,      false },
     { "createrawtransaction",   &createrawtransaction,   false,     false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false },
-    { "decodescript",           &decodescript,           false,     false,     false },
+    { "decoderawtransaction",   &RPCStreamActor<decoderawtransaction>, false,     false,     false },
+    { "decodescript",           &RPCStreamActor<decodescript>, false,     false,     false },
     { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
     { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
     { "getcheckpoint",          &getcheckpoint,          true,      false,     false },
+    { "getaddressbalance",      &getaddressbalance,      true,      false,     false },
+    { "getaddresstxids",        &getaddresstxids,        true,      false,     false },
+    { "getaddresshistory",      &getaddresshistory,      true,      false,     false },
+    { "getaddressutxos",        &getaddressutxos,        true,      false,     false },
     { "validateaddress",        &validateaddress,        true,      false,     false },
     { "validatepubkey",         &validatepubkey,         true,      false,     false },
     { "verifymessage",          &verifymessage,          false,     false,     false },
@@ -271,30 +281,51 @@ static const CRPCCommand vRPCCommands[] =
     { "sendmany",               &sendmany,               false,     false,     true },
     { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true },
     { "addredeemscript",        &addredeemscript,        false,     false,     true },
-    { "gettransaction",         &gettransaction,         false,     false,     true },
-    { "listtransactions",       &listtransactions,       false,     false,     true },
+    { "gettransaction",         &RPCStreamActor<gettransaction>, false,     false,     true },
+    { "listtransactions",       &RPCStreamActor<listtransactions>, false,     false,     true },
     { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true },
     { "signmessage",            &signmessage,            false,     false,     true },
     { "getwork",                &getwork,                true,      false,     true },
     { "getworkex",              &getworkex,              true,      false,     true },
     { "listaccounts",           &listaccounts,           false,     false,     true },
-    { "getblocktemplate",       &getblocktemplate,       true,      false,     false },
+    { "getblocktemplate",       &getblocktemplate,       true,      true,      false },
     { "submitblock",            &submitblock,            false,     false,     false },
-    { "listsinceblock",         &listsinceblock,         false,     false,     true },
+    { "listsinceblock",         &RPCStreamActor<listsinceblock>, false,     false,     true },
     { "dumpprivkey",            &dumpprivkey,            false,     false,     true },
     { "dumpwallet",             &dumpwallet,             true,      false,     true },
-    { "importprivkey",          &importprivkey,          false,     false,     true },
-    { "importwallet",           &importwallet,           false,     false,     true },
+    { "importprivkey",          &importprivkey,          false,     true,      true },
+    { "importwallet",           &importwallet,           false,     true,      true },
+    { "abortrescan",            &abortrescan,            false,     true,      true },
     { "listunspent",            &listunspent,            false,     false,     true },
     { "settxfee",               &settxfee,               false,     false,     true },
     { "getsubsidy",             &getsubsidy,             true,      true,      false },
     { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false },
     { "reservebalance",         &reservebalance,         false,     true,      true },
+    { "getstakingconfig",       &getstakingconfig,       true,      false,     true },
+    { "setstakingconfig",       &setstakingconfig,       false,     false,     true },
     { "checkwallet",            &checkwallet,            false,     true,      true },
     { "repairwallet",           &repairwallet,           false,     true,      true },
     { "resendtx",               &resendtx,               false,     true,      true },
     { "makekeypair",            &makekeypair,            false,     true,      false },
     { "checkkernel",            &checkkernel,            true,      false,     true },
+    { "checkkernels",           &checkkernels,           true,      true,      false },
+#endif
+};
+
+// Commands that write their reply through CJSONWriter instead of building
+// json_spirit trees; they must also appear in vRPCCommands above.
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &getblock               },
+    { "getblockbynumber",       &getblockbynumber       },
+    { "getrawtransaction",      &getrawtransaction      },
+    { "decoderawtransaction",   &decoderawtransaction   },
+    { "decodescript",           &decodescript           },
+#ifdef ENABLE_WALLET
+    { "gettransaction",         &gettransaction         },
+    { "listtransactions",       &listtransactions       },
+    { "listsinceblock",         &listsinceblock         },
 #endif
 };
 
@@ -308,6 +339,18 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamCommands[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].actor;
+}
+
+json_spirit::Value CallRPCStreamActor(rpcstreamfn_type actor, const json_spirit::Array& params, bool fHelp)
+{
+    CJSONWriter writer;
+    actor(params, fHelp, writer);
+    json_spirit::Value result;
+    if (!ParseJSON(writer.str(), result))
+        throw std::runtime_error("Malformed JSON from RPC handler");
+    return result;
 }
 
 const CRPCCommand *CRPCTable::operator[](std::string name) const
@@ -329,15 +372,15 @@ bool HTTPAuthorized(std::map<std::string, std::string>& mapHeaders)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
-void ErrorReply(std::ostream& stream, const json_spirit::Object& objError, const json_spirit::Value& id)
+static int ErrorReply(const json_spirit::Object& objError, const json_spirit::Value& id, std::string& strReply)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = json_spirit::find_value(objError, "code").get_int();
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
-    std::string strReply = JSONRPCReply(json_spirit::Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    strReply = JSONRPCReply(json_spirit::Value::null, objError, id);
+    return nStatus;
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -363,61 +406,332 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-class AcceptedConnection
+/**
+ * Bounded queue of RPC requests waiting for a worker thread. Requests
+ * that do not fit are turned away with 503 instead of piling up.
+ */
+class RPCWorkQueue
 {
 public:
-    virtual ~AcceptedConnection() {}
+    explicit RPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true)
+    {
+    }
 
-    virtual std::iostream& stream() = 0;
-    virtual std::string peer_address_to_string() const = 0;
-    virtual void close() = 0;
+    bool Enqueue(const std::function<void(void)>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(func);
+        cond.notify_one();
+        return true;
+    }
+
+    void Run()
+    {
+        RenameThread("honey-rpcworker");
+        while (true)
+        {
+            std::function<void(void)> func;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    return;
+                func = std::move(queue.front());
+                queue.pop_front();
+            }
+            func();
+        }
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::function<void(void)> > queue;
+    const size_t nMaxDepth;
+    bool fRunning;
 };
 
+static RPCWorkQueue* rpc_work_queue = nullptr;
+static int nRPCBatchThreads = DEFAULT_RPC_BATCH_THREADS;
+static bool fRESTEnabled = false;
+static std::atomic<bool> fRPCRunning(false);
+
+// Runs on a worker thread: executes the JSON-RPC request in an HTTP body
+static int HandleRPCRequest(const std::string& strRequest, std::string& strReply);
+
+/**
+ * An RPC client connection. All I/O is asynchronous on the RPC I/O thread,
+ * which only parses requests and checks credentials; the requests themselves
+ * run on the worker threads, so slow clients and slow calls tie up neither.
+ * Pipelined requests on one connection are answered in order, one at a time.
+ */
 template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+class RPCConnection : public boost::enable_shared_from_this< RPCConnection<Protocol> >
 {
 public:
-    AcceptedConnectionImpl(
-            boost::asio::io_service& io_service,
-            boost::asio::ssl::context &context,
-            bool fUseSSL) :
+    RPCConnection(boost::asio::io_service& io_service,
+                  boost::asio::ssl::context &context,
+                  bool fUseSSLIn) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        fUseSSL(fUseSSLIn),
+        timer(io_service),
+        timerAuth(io_service)
     {
+        fReading = false;
+        fBusy = false;
+        fClosed = false;
+        fEOF = false;
     }
 
-    virtual std::iostream& stream()
+    void Start()
     {
-        return _stream;
+        ResetTimer();
+        if (fUseSSL)
+            sslStream.async_handshake(boost::asio::ssl::stream_base::server,
+                                      boost::bind(&RPCConnection::HandleHandshake, this->shared_from_this(), boost::asio::placeholders::error));
+        else
+            StartRead();
     }
 
-    virtual std::string peer_address_to_string() const
+    /** Send a reply and, unless fKeepAlive, close the connection after it */
+    void Reply(int nStatus, const std::string& strBody, bool fKeepAlive, const std::string& strContentType = "application/json")
     {
-        return peer.address().to_string();
+        if (fClosed)
+            return;
+        fBusy = true;
+        fKeepAliveReply = fKeepAlive && !fEOF;
+        strReplyHeader = nStatus == HTTP_UNAUTHORIZED ? HTTPReply(nStatus, "", false) : HTTPReplyHeader(nStatus, strBody.size(), fKeepAliveReply, strContentType);
+        strReplyBody = nStatus == HTTP_UNAUTHORIZED ? "" : strBody;
+
+        // Header and body go out in one write, without joining them first
+        std::vector<boost::asio::const_buffer> vBuffers;
+        vBuffers.push_back(boost::asio::buffer(strReplyHeader));
+        vBuffers.push_back(boost::asio::buffer(strReplyBody));
+        if (fUseSSL)
+            boost::asio::async_write(sslStream, vBuffers,
+                                     boost::bind(&RPCConnection::HandleWrite, this->shared_from_this(), boost::asio::placeholders::error));
+        else
+            boost::asio::async_write(sslStream.next_layer(), vBuffers,
+                                     boost::bind(&RPCConnection::HandleWrite, this->shared_from_this(), boost::asio::placeholders::error));
     }
 
-    virtual void close()
+    void Close()
     {
-        _stream.close();
+        if (fClosed)
+            return;
+        fClosed = true;
+        boost::system::error_code ec;
+        timer.cancel(ec);
+        timerAuth.cancel(ec);
+        sslStream.lowest_layer().close(ec);
     }
 
     typename Protocol::endpoint peer;
     boost::asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    boost::iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    const bool fUseSSL;
+    boost::asio::deadline_timer timer;      // idle timeout
+    boost::asio::deadline_timer timerAuth;  // delays replies to wrong passwords
+    char pchRead[8192];
+    std::string strBuffer;              // received, not yet parsed
+    std::string strReplyHeader, strReplyBody;
+    bool fReading;
+    bool fBusy;                         // a request is being served
+    bool fKeepAliveReply;
+    bool fClosed;
+    bool fEOF;                          // the client stopped sending
+
+    void ResetTimer()
+    {
+        timer.expires_from_now(boost::posix_time::seconds(GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT)));
+        timer.async_wait(boost::bind(&RPCConnection::HandleTimeout, this->shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // Only idle connections time out, a request may take as long as it needs
+        if (error == boost::asio::error::operation_aborted || fClosed)
+            return;
+        if (fBusy)
+            ResetTimer();
+        else
+            Close();
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+            Close();
+        else
+            StartRead();
+    }
+
+    void StartRead()
+    {
+        // Stop reading while a whole request worth of pipelined data is waiting
+        if (fReading || fClosed || fEOF || strBuffer.size() > MAX_SIZE + MAX_HTTP_HEADERS_SIZE)
+            return;
+        fReading = true;
+        if (fUseSSL)
+            sslStream.async_read_some(boost::asio::buffer(pchRead),
+                                      boost::bind(&RPCConnection::HandleRead, this->shared_from_this(),
+                                                  boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+        else
+            sslStream.next_layer().async_read_some(boost::asio::buffer(pchRead),
+                                                   boost::bind(&RPCConnection::HandleRead, this->shared_from_this(),
+                                                               boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    void HandleRead(const boost::system::error_code& error, size_t nBytes)
+    {
+        fReading = false;
+        if (fClosed)
+            return;
+        if (error)
+        {
+            // Finish the request in hand before closing
+            fEOF = true;
+            if (!fBusy)
+                Close();
+            return;
+        }
+        strBuffer.append(pchRead, nBytes);
+        ResetTimer();
+        ProcessBuffer();
+        StartRead();
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        strReplyHeader.clear();
+        strReplyBody.clear();
+        if (error || !fKeepAliveReply)
+        {
+            Close();
+            return;
+        }
+        fBusy = false;
+        ProcessBuffer();
+        StartRead();
+    }
+
+    void ProcessBuffer()
+    {
+        if (fBusy || fClosed)
+            return;
+
+        int nProto = 0;
+        std::string strMethod, strURI, strRequest;
+        std::map<std::string, std::string> mapHeaders;
+        int nRet = ParseHTTPRequest(strBuffer.data(), strBuffer.size(), nProto, strMethod, strURI, mapHeaders, strRequest);
+        if (nRet < 0)
+        {
+            Reply(HTTP_BAD_REQUEST, "", false);
+            return;
+        }
+        if (nRet == 0)
+        {
+            if (fEOF)
+                Close();
+            return;
+        }
+        strBuffer.erase(0, nRet);
+        fBusy = true;
+
+        const bool fKeepAlive = mapHeaders["connection"] != "close";
+        if (fRESTEnabled && boost::starts_with(strURI, "/rest/"))
+        {
+            ServeREST(strMethod, strURI, fKeepAlive);
+            return;
+        }
+
+        if (strURI != "/")
+        {
+            Reply(HTTP_NOT_FOUND, "", false);
+            return;
+        }
+
+        // Check authorization
+        if (mapHeaders.count("authorization") == 0)
+        {
+            Reply(HTTP_UNAUTHORIZED, "", false);
+            return;
+        }
+        if (!HTTPAuthorized(mapHeaders))
+        {
+            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", peer.address().to_string());
+            /* Deter brute-forcing short passwords.
+               If this results in a DoS the user really
+               shouldn't have their RPC port exposed. */
+            if (mapArgs["-rpcpassword"].size() < 20)
+            {
+                timerAuth.expires_from_now(boost::posix_time::milliseconds(250));
+                timerAuth.async_wait(boost::bind(&RPCConnection::HandleDelayedUnauthorized, this->shared_from_this(), boost::asio::placeholders::error));
+            }
+            else
+                Reply(HTTP_UNAUTHORIZED, "", false);
+            return;
+        }
+
+        boost::shared_ptr<RPCConnection> self = this->shared_from_this();
+        if (!rpc_work_queue->Enqueue([self, strRequest, fKeepAlive]() {
+                std::string strReply;
+                int nStatus = HandleRPCRequest(strRequest, strReply);
+                // Errors close the connection, as they always have
+                rpc_io_service->post(boost::bind(&RPCConnection::Reply, self, nStatus, strReply, fKeepAlive && nStatus == HTTP_OK, "application/json"));
+            }))
+        {
+            LogPrint("rpc", "ThreadRPCServer work queue full, rejecting request from %s\n", peer.address().to_string());
+            Reply(HTTP_SERVICE_UNAVAILABLE, JSONRPCReply(json_spirit::Value::null, JSONRPCError(RPC_MISC_ERROR, "Work queue depth exceeded"), json_spirit::Value::null), fKeepAlive);
+        }
+    }
+
+    // REST requests need no credentials; ClientAllowed() still applies
+    void ServeREST(const std::string& strMethod, const std::string& strURI, bool fKeepAlive)
+    {
+        if (strMethod != "GET")
+        {
+            Reply(HTTP_BAD_REQUEST, "Only GET is supported\r\n", false, "text/plain");
+            return;
+        }
+
+        boost::shared_ptr<RPCConnection> self = this->shared_from_this();
+        if (!rpc_work_queue->Enqueue([self, strURI, fKeepAlive]() {
+                std::string strBody, strContentType;
+                int nStatus = HandleRESTRequest(strURI, strBody, strContentType);
+                rpc_io_service->post(boost::bind(&RPCConnection::Reply, self, nStatus, strBody, fKeepAlive, strContentType));
+            }))
+        {
+            LogPrint("rpc", "ThreadRPCServer work queue full, rejecting REST request from %s\n", peer.address().to_string());
+            Reply(HTTP_SERVICE_UNAVAILABLE, "Work queue depth exceeded\r\n", fKeepAlive, "text/plain");
+        }
+    }
+
+    void HandleDelayedUnauthorized(const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted || fClosed)
+            return;
+        Reply(HTTP_UNAUTHORIZED, "", false);
+    }
+};
 
 // Forward declaration required for RPCListen
 template <typename Protocol>
 static void RPCAcceptHandler(boost::shared_ptr< boost::asio::basic_socket_acceptor<Protocol> > acceptor,
                              boost::asio::ssl::context& context,
                              bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr< RPCConnection<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -429,7 +743,7 @@ static void RPCListen(boost::shared_ptr< boost::asio::basic_socket_acceptor<Prot
                    const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(GET_IO_SERVICE_(acceptor), context, fUseSSL);
+    boost::shared_ptr< RPCConnection<Protocol> > conn(new RPCConnection<Protocol>(GET_IO_SERVICE_(acceptor), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -450,36 +764,31 @@ template <typename Protocol>
 static void RPCAcceptHandler(boost::shared_ptr< boost::asio::basic_socket_acceptor<Protocol> > acceptor,
                              boost::asio::ssl::context& context,
                              const bool fUseSSL,
-                             AcceptedConnection* conn,
+                             boost::shared_ptr< RPCConnection<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != boost::asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<boost::asio::ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<boost::asio::ip::tcp>* >(conn);
-
     // TODO: Actually handle errors
     if (error)
-    {
-        delete conn;
-    }
+        return;
 
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading any request, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        delete conn;
-    }
-    else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
+            conn->Reply(HTTP_FORBIDDEN, "", false);
+        else
+            conn->Close();
+        return;
     }
+
+    conn->Start();
 }
 
 void StartRPCThreads()
@@ -582,21 +891,42 @@ void StartRPCThreads()
         return;
     }
 
+    nRPCBatchThreads = std::max((int64_t)1, GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS));
+    fRESTEnabled = GetBoolArg("-rest", false);
+
+    // One thread does all network I/O, the workers run the calls
+    rpc_work_queue = new RPCWorkQueue(std::max((int64_t)1, GetArg("-rpcworkqueue", DEFAULT_RPC_WORK_QUEUE)));
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&boost::asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread([]() {
+        RenameThread("honey-rpcio");
+        rpc_io_service->run();
+    });
+    for (int i = 0; i < std::max((int64_t)1, GetArg("-rpcthreads", DEFAULT_RPC_THREADS)); i++)
+        rpc_worker_group->create_thread(boost::bind(&RPCWorkQueue::Run, rpc_work_queue));
+    fRPCRunning = true;
+}
+
+bool IsRPCRunning()
+{
+    return fRPCRunning;
 }
 
 void StopRPCThreads()
 {
     if (rpc_io_service == nullptr) return;
 
+    // Release workers blocked in waitforblock and longpolls first
+    fRPCRunning = false;
+    WakeChainSnapshotWaiters();
     deadlineTimers.clear();
     DeleteAuthCookie();
+    if (rpc_work_queue != nullptr)
+        rpc_work_queue->Interrupt();
     rpc_io_service->stop();
     if (rpc_worker_group != nullptr)
         rpc_worker_group->join_all();
     delete rpc_worker_group; rpc_worker_group = nullptr;
+    delete rpc_work_queue; rpc_work_queue = nullptr;
     delete rpc_ssl_context; rpc_ssl_context = nullptr;
     delete rpc_io_service; rpc_io_service = nullptr;
 }
@@ -607,6 +937,34 @@ void RPCRunHandler(const boost::system::error_code& err, std::function<void(void
         func();
 }
 
+// Threads and chunk size of RPCParallelFor()
+static const int MAX_RPC_LIST_THREADS = 8;
+static const size_t RPC_LIST_ITEMS_PER_CHUNK = 1024;
+
+static void RPCParallelForThread(size_t nCount, std::atomic<size_t>& nNext, const std::function<void(size_t, size_t)>& func)
+{
+    size_t nBegin;
+    while ((nBegin = nNext.fetch_add(RPC_LIST_ITEMS_PER_CHUNK)) < nCount)
+        func(nBegin, std::min(nCount, nBegin + RPC_LIST_ITEMS_PER_CHUNK));
+}
+
+void RPCParallelFor(size_t nCount, const std::function<void(size_t, size_t)>& func)
+{
+    std::atomic<size_t> nNext(0);
+    size_t nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_RPC_LIST_THREADS));
+    nThreads = std::min(nThreads, (nCount + RPC_LIST_ITEMS_PER_CHUNK - 1) / RPC_LIST_ITEMS_PER_CHUNK);
+    if (nThreads <= 1)
+    {
+        RPCParallelForThread(nCount, nNext, func);
+        return;
+    }
+
+    boost::thread_group threadList;
+    for (size_t i = 0; i < nThreads; i++)
+        threadList.create_thread(boost::bind(&RPCParallelForThread, nCount, boost::ref(nNext), boost::cref(func)));
+    threadList.join_all();
+}
+
 void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_t nSeconds)
 {
     assert(rpc_io_service != nullptr);
@@ -662,122 +1020,203 @@ void JSONRequest::parse(const json_spirit::Value& valRequest)
 }
 
 
-static json_spirit::Object JSONRPCExecOne(const json_spirit::Value& req)
+// Reply members are written by hand so results can stream straight into the
+// reply; the layout matches JSONRPCReplyObj().
+static std::string JSONRPCExecOne(const json_spirit::Value& req)
 {
-    json_spirit::Object rpc_result;
-
     JSONRequest jreq;
+    CJSONWriter reply;
     try {
         jreq.parse(req);
 
-        json_spirit::Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, json_spirit::Value::null, jreq.id);
+        reply.BeginObject();
+        reply.Key("result");
+        tableRPC.execute(jreq.strMethod, jreq.params, reply);
+        reply.Key("error");
+        reply.WriteNull();
+        reply.Key("id");
+        reply.Write(jreq.id);
+        reply.EndObject();
     }
     catch (json_spirit::Object& objError)
     {
-        rpc_result = JSONRPCReplyObj(json_spirit::Value::null, objError, jreq.id);
+        reply.clear();
+        reply.Write(JSONRPCReplyObj(json_spirit::Value::null, objError, jreq.id));
     }
     catch (std::exception& e)
     {
-        rpc_result = JSONRPCReplyObj(json_spirit::Value::null,
-                                     JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        reply.clear();
+        reply.Write(JSONRPCReplyObj(json_spirit::Value::null,
+                                    JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id));
     }
 
-    return rpc_result;
+    return reply.str();
 }
 
-static std::string JSONRPCExecBatch(const json_spirit::Array& vReq)
-{
-    json_spirit::Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
-
-    return json_spirit::write_string(json_spirit::Value(ret), false) + "\n";
-}
-
-void ServiceConnection(AcceptedConnection *conn)
+/**
+ * A run of consecutive batch elements that may execute concurrently. The
+ * worker that owns the batch works through it together with any helpers it
+ * managed to queue, so it never depends on a helper being scheduled.
+ */
+class RPCBatchRun
 {
-    bool fRun = true;
-    while (fRun)
+public:
+    RPCBatchRun(const json_spirit::Array& vReqIn, size_t nBeginIn, size_t nEndIn) :
+        vReq(vReqIn), nBegin(nBeginIn), nEnd(nEndIn), nNext(nBeginIn), nDone(0), vReply(nEndIn - nBeginIn)
     {
-        int nProto = 0;
-        std::map<std::string, std::string> mapHeaders;
-        std::string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
-
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
-        }
+    }
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
-        {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (!HTTPAuthorized(mapHeaders))
+    // Helpers may start after all elements were taken, and then must not
+    // touch vReq: the owner only waits for elements somebody has claimed.
+    void Work()
+    {
+        while (true)
         {
-            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string());
-            /* Deter brute-forcing short passwords.
-               If this results in a DoS the user really
-               shouldn't have their RPC port exposed. */
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
-
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            size_t i = nNext++;
+            if (i >= nEnd)
+                return;
+            vReply[i - nBegin] = JSONRPCExecOne(vReq[i]);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (++nDone == nEnd - nBegin)
+                cond.notify_all();
         }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+    }
 
-        JSONRequest jreq;
-        try
-        {
-            // Parse request
-            json_spirit::Value valRequest;
-            if (!json_spirit::read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+    void WaitAll()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nDone < nEnd - nBegin)
+            cond.wait(lock);
+    }
 
-            std::string strReply;
+    const std::vector<std::string>& Replies() const { return vReply; }
 
-            // singleton request
-            if (valRequest.type() == json_spirit::obj_type) {
-                jreq.parse(valRequest);
+private:
+    const json_spirit::Array& vReq;
+    const size_t nBegin;
+    const size_t nEnd;
+    std::atomic<size_t> nNext;
+    size_t nDone;
+    std::vector<std::string> vReply;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+};
 
-                json_spirit::Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+// Commands that only read state and return without waiting. Consecutive
+// ones in a batch may run at the same time; any other command is a barrier,
+// so calls that change state or wait still see the batch in order. They
+// must also be threadSafe in vRPCCommands.
+static const char* const vRPCParallelBatchCommands[] =
+{
+    "getbestblockhash",
+    "getblockcount",
+    "getaddednodeinfo",
+    "getnettotals",
+    "getdifficulty",
+    "getinfo",
+    "getrawmempool",
+    "getblock",
+    "getblockbynumber",
+    "getblockhash",
+    "getrawtransaction",
+    "getsubsidy",
+    "getstakesubsidy",
+};
 
-                // Send reply
-                strReply = JSONRPCReply(result, json_spirit::Value::null, jreq.id);
+static bool IsParallelBatchElement(const json_spirit::Value& req)
+{
+    static const std::set<std::string> setParallel(vRPCParallelBatchCommands,
+        vRPCParallelBatchCommands + sizeof(vRPCParallelBatchCommands) / sizeof(vRPCParallelBatchCommands[0]));
 
-            // array of requests
-            } else if (valRequest.type() == json_spirit::array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+    if (req.type() != json_spirit::obj_type)
+        return false;
+    const json_spirit::Value& valMethod = json_spirit::find_value(req.get_obj(), "method");
+    if (valMethod.type() != json_spirit::str_type || !setParallel.count(valMethod.get_str()))
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->threadSafe;
+}
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        }
-        catch (json_spirit::Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        }
-        catch (std::exception& e)
+std::string JSONRPCExecBatch(const json_spirit::Array& vReq)
+{
+    CJSONWriter writer;
+    writer.BeginArray();
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size())
+    {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsParallelBatchElement(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || nRPCBatchThreads < 2 || rpc_work_queue == nullptr)
         {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+            writer.WriteRaw(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
         }
+
+        std::shared_ptr<RPCBatchRun> run = std::make_shared<RPCBatchRun>(vReq, reqIdx, nEnd);
+        size_t nHelpers = std::min((size_t)nRPCBatchThreads, nEnd - reqIdx) - 1;
+        for (size_t i = 0; i < nHelpers; i++)
+            if (!rpc_work_queue->Enqueue([run]() { run->Work(); }))
+                break;
+        run->Work();
+        run->WaitAll();
+        for (const std::string& strReply : run->Replies())
+            writer.WriteRaw(strReply);
+        reqIdx = nEnd;
     }
+    writer.EndArray();
+
+    return writer.str() + "\n";
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+static int HandleRPCRequest(const std::string& strRequest, std::string& strReply)
+{
+    JSONRequest jreq;
+    try
+    {
+        // Parse request
+        json_spirit::Value valRequest;
+        if (!ParseJSON(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+
+        // singleton request
+        if (valRequest.type() == json_spirit::obj_type) {
+            jreq.parse(valRequest);
+
+            CJSONWriter writer;
+            writer.BeginObject();
+            writer.Key("result");
+            tableRPC.execute(jreq.strMethod, jreq.params, writer);
+            writer.Key("error");
+            writer.WriteNull();
+            writer.Key("id");
+            writer.Write(jreq.id);
+            writer.EndObject();
+
+            // Send reply
+            strReply.swap(writer.str());
+            strReply += "\n";
+
+        // array of requests
+        } else if (valRequest.type() == json_spirit::array_type)
+            strReply = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+
+        return HTTP_OK;
+    }
+    catch (json_spirit::Object& objError)
+    {
+        return ErrorReply(objError, jreq.id, strReply);
+    }
+    catch (std::exception& e)
+    {
+        return ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, strReply);
+    }
+}
+
+static const CRPCCommand* CheckRPCCommand(const std::string &strMethod)
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -794,29 +1233,30 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, std::string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+static void RunRPCCommand(const CRPCCommand *pcmd, const std::function<void(void)>& func)
+{
     try
     {
         // Execute
-        json_spirit::Value result;
-        {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
+        if (pcmd->threadSafe)
+            func();
 #ifdef ENABLE_WALLET
-            else if (!pwalletMain) {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            } else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
-            }
+        else if (!pwalletMain) {
+            LOCK(cs_main);
+            func();
+        } else {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            func();
+        }
 #else // ENABLE_WALLET
-            else {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            }
-#endif // !ENABLE_WALLET
+        else {
+            LOCK(cs_main);
+            func();
         }
-        return result;
+#endif // !ENABLE_WALLET
     }
     catch (std::exception& e)
     {
@@ -824,4 +1264,30 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = CheckRPCCommand(strMethod);
+
+    json_spirit::Value result;
+    RunRPCCommand(pcmd, [&]() { result = pcmd->actor(params, false); });
+    return result;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONWriter& writer) const
+{
+    const CRPCCommand *pcmd = CheckRPCCommand(strMethod);
+
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it != mapStreamCommands.end())
+    {
+        rpcstreamfn_type actor = it->second;
+        RunRPCCommand(pcmd, [&]() { actor(params, false, writer); });
+        return;
+    }
+
+    json_spirit::Value result;
+    RunRPCCommand(pcmd, [&]() { result = pcmd->actor(params, false); });
+    writer.Write(result);
+}
+
 const CRPCTable tableRPC;
@@ -14,9 +14,26 @@
 
 
 class CBlockIndex;
+class CJSONWriter;
+
+static const int DEFAULT_RPC_THREADS = 4;
+/** Requests waiting for a worker beyond this are answered with 503 */
+static const int DEFAULT_RPC_WORK_QUEUE = 16;
+/** Seconds an idle client connection is kept open */
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
+/** Calls of one batch request that may run at the same time */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
 
 void StartRPCThreads();
 void StopRPCThreads();
+/** False once shutdown began; calls that wait for events give up then */
+bool IsRPCRunning();
+
+/** Execute a JSON-RPC batch and return the reply array */
+std::string JSONRPCExecBatch(const json_spirit::Array& vReq);
+
+/** Serve a GET request for /rest/... (in rest.cpp); returns the HTTP status */
+int HandleRESTRequest(const std::string& strURI, std::string& strBody, std::string& strContentType);
 
 /*
   Type-check arguments; throws JSONRPCError if wrong type given. Does not check that
@@ -38,7 +55,16 @@ void RPCTypeCheck(const json_spirit::Object& o,
  */
 void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_t nSeconds);
 
+/*
+  Call func(nBegin, nEnd) over consecutive chunks of [0, nCount) on several
+  threads and return once all are done. For building the entries of long
+  listings; func runs without the caller's locks and must not throw.
+ */
+void RPCParallelFor(size_t nCount, const std::function<void(size_t, size_t)>& func);
+
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+/** Handler that writes its result straight into the reply */
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 
 class CRPCCommand
 {
@@ -50,6 +76,23 @@ public:
     bool reqWallet;
 };
 
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
+};
+
+/** Run a streaming handler and parse its output back into a json_spirit value */
+json_spirit::Value CallRPCStreamActor(rpcstreamfn_type actor, const json_spirit::Array& params, bool fHelp);
+
+/** Table adapter so streaming handlers can also be called as plain actors */
+template<rpcstreamfn_type F>
+json_spirit::Value RPCStreamActor(const json_spirit::Array& params, bool fHelp)
+{
+    return CallRPCStreamActor(F, params, fHelp);
+}
+
 /**
  * Honey RPC command dispatcher.
  */
@@ -57,6 +100,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -70,6 +114,13 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method, appending its result to writer as JSON. Methods
+     * with a streaming handler write directly; others are serialized from
+     * their json_spirit result.
+     */
+    void execute(const std::string &method, const json_spirit::Array &params, CJSONWriter& writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -108,12 +159,14 @@ extern json_spirit::Value dumpwallet(const json_spirit::Array& params, bool fHel
 extern json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value abortrescan(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getsubsidy(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getstakesubsidy(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmininginfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getstakinginfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value checkkernel(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value checkkernels(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp);
@@ -137,11 +190,11 @@ extern json_spirit::Value addmultisigaddress(const json_spirit::Array& params, b
 extern json_spirit::Value addredeemscript(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern void listtransactions(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp);
+extern void listsinceblock(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+extern void gettransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value backupwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value keypoolrefill(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value walletpassphrase(const json_spirit::Array& params, bool fHelp);
@@ -151,6 +204,8 @@ extern json_spirit::Value encryptwallet(const json_spirit::Array& params, bool f
 extern json_spirit::Value validateaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value reservebalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getstakingconfig(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value setstakingconfig(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value checkwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value repairwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value resendtx(const json_spirit::Array& params, bool fHelp);
@@ -158,22 +213,28 @@ extern json_spirit::Value makekeypair(const json_spirit::Array& params, bool fHe
 extern json_spirit::Value validatepubkey(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fHelp);
 
-extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
+extern void getrawtransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp);
+extern void decoderawtransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+extern void decodescript(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendrawtransaction(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
+extern json_spirit::Value waitfornewblock(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value waitforblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
+extern void getblock(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
+extern void getblockbynumber(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresstxids(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
 
 #endif
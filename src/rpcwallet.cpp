@@ -5,6 +5,7 @@
 
 #include <base58.h>
 #include <rpcserver.h>
+#include <rpcjson.h>
 #include <init.h>
 #include <net.h>
 #include <netbase.h>
@@ -15,10 +16,12 @@
 
 #include <boost/bind/bind.hpp>
 
+#include <unordered_map>
+
 int64_t nWalletUnlockTime;
 static CCriticalSection cs_nWalletUnlockTime;
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry);
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, CJSONWriter& entry);
 
 static void accountingDeprecationCheck()
 {
@@ -47,23 +50,24 @@ void EnsureWalletIsUnlocked()
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Wallet is unlocked for staking only.");
 }
 
-void WalletTxToJSON(const CWalletTx& wtx, json_spirit::Object& entry)
+void WalletTxToJSON(const CWalletTx& wtx, CJSONWriter& entry)
 {
     int confirms = wtx.GetDepthInMainChain();
-    entry.push_back(json_spirit::Pair("confirmations", confirms));
+    entry.Pair("confirmations", confirms);
     if (wtx.IsCoinBase() || wtx.IsCoinStake())
-        entry.push_back(json_spirit::Pair("generated", true));
+        entry.Pair("generated", true);
     if (confirms > 0)
     {
-        entry.push_back(json_spirit::Pair("blockhash", wtx.hashBlock.GetHex()));
-        entry.push_back(json_spirit::Pair("blockindex", wtx.nIndex));
-        entry.push_back(json_spirit::Pair("blocktime", (int64_t)(mapBlockIndex[wtx.hashBlock]->nTime)));
+        entry.Pair("blockhash", wtx.hashBlock.GetHex());
+        entry.Pair("blockindex", wtx.nIndex);
+        if (const CBlockIndex* pindex = LookupBlockIndex(wtx.hashBlock))
+            entry.Pair("blocktime", (int64_t)pindex->nTime);
     }
-    entry.push_back(json_spirit::Pair("txid", wtx.GetHash().GetHex()));
-    entry.push_back(json_spirit::Pair("time", (int64_t)wtx.GetTxTime()));
-    entry.push_back(json_spirit::Pair("timereceived", (int64_t)wtx.nTimeReceived));
+    entry.Pair("txid", wtx.GetHash().GetHex());
+    entry.Pair("time", (int64_t)wtx.GetTxTime());
+    entry.Pair("timereceived", (int64_t)wtx.nTimeReceived);
     for (const std::pair<std::string,std::string>& item : wtx.mapValue)
-        entry.push_back(json_spirit::Pair(item.first, item.second));
+        entry.Pair(item.first, item.second);
 }
 
 std::string AccountFromValue(const json_spirit::Value& value)
@@ -87,9 +91,6 @@ json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -116,9 +117,6 @@ json_spirit::Value getnewaddress(const json_spirit::Array& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -379,16 +377,20 @@ json_spirit::Value getreceivedbyaddress(const json_spirit::Array& params, bool f
 
     // Tally
     int64_t nAmount = 0;
-    for (std::map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > >::const_iterator mi = pwalletMain->mapOutputsByDestination.find(address.Get());
+    if (mi != pwalletMain->mapOutputsByDestination.end())
     {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
-            continue;
+        for (const std::pair<const CWalletTx*, unsigned int>& output : (*mi).second)
+        {
+            const CWalletTx& wtx = *output.first;
+            if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
+                continue;
 
-        for (const CTxOut& txout : wtx.vout)
+            const CTxOut& txout = wtx.vout[output.second];
             if (txout.scriptPubKey == scriptPubKey)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
+        }
     }
 
     return  ValueFromAmount(nAmount);
@@ -427,18 +429,20 @@ json_spirit::Value getreceivedbyaccount(const json_spirit::Array& params, bool f
 
     // Tally
     int64_t nAmount = 0;
-    for (std::map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    for (const CTxDestination& address : setAddress)
     {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
+        std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > >::const_iterator mi = pwalletMain->mapOutputsByDestination.find(address);
+        if (mi == pwalletMain->mapOutputsByDestination.end() || !IsMine(*pwalletMain, address))
             continue;
 
-        for (const CTxOut& txout : wtx.vout)
+        for (const std::pair<const CWalletTx*, unsigned int>& output : (*mi).second)
         {
-            CTxDestination address;
-            if (ExtractDestination(txout.scriptPubKey, address) && IsMine(*pwalletMain, address) && setAddress.count(address))
-                if (wtx.GetDepthInMainChain() >= nMinDepth)
-                    nAmount += txout.nValue;
+            const CWalletTx& wtx = *output.first;
+            if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
+                continue;
+
+            if (wtx.GetDepthInMainChain() >= nMinDepth)
+                nAmount += wtx.vout[output.second].nValue;
         }
     }
 
@@ -565,7 +569,7 @@ json_spirit::Value movecmd(const json_spirit::Array& params, bool fHelp)
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(debit, walletdb);
 
     // Credit
     CAccountingEntry credit;
@@ -575,7 +579,7 @@ json_spirit::Value movecmd(const json_spirit::Array& params, bool fHelp)
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
+    pwalletMain->AddAccountingEntry(credit, walletdb);
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
@@ -810,8 +814,9 @@ json_spirit::Value ListReceived(const json_spirit::Array& params, bool fByAccoun
     if (params.size() > 1)
         fIncludeEmpty = params[1].get_bool();
 
-    // Tally
-    std::map<CHoneyAddress, tallyitem> mapTally;
+    // Depth of the transactions that count, settled here under the caller's
+    // locks so the per-address work below can run on several threads
+    std::unordered_map<const CWalletTx*, int> mapDepth;
     for (std::map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
     {
         const CWalletTx& wtx = (*it).second;
@@ -823,52 +828,67 @@ json_spirit::Value ListReceived(const json_spirit::Array& params, bool fByAccoun
         if (nDepth < nMinDepth)
             continue;
 
-        for (const CTxOut& txout : wtx.vout)
+        mapDepth[&wtx] = nDepth;
+    }
+
+    // Tally each address book entry from the outputs paying it
+    std::vector<const std::pair<const CTxDestination, std::string>*> vEntries;
+    vEntries.reserve(pwalletMain->mapAddressBook.size());
+    for (const std::pair<const CTxDestination, std::string>& item : pwalletMain->mapAddressBook)
+        vEntries.push_back(&item);
+
+    std::vector<tallyitem> vTally(vEntries.size());
+    std::vector<char> vfTallied(vEntries.size(), false);
+    std::vector<json_spirit::Value> vObjects(fByAccounts ? 0 : vEntries.size());
+    RPCParallelFor(vEntries.size(), [&](size_t nBegin, size_t nEnd) {
+        for (size_t n = nBegin; n < nEnd; n++)
         {
-            CTxDestination address;
-            if (!ExtractDestination(txout.scriptPubKey, address) || !IsMine(*pwalletMain, address))
+            const CTxDestination& address = vEntries[n]->first;
+            std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > >::const_iterator mi = pwalletMain->mapOutputsByDestination.find(address);
+            if (mi != pwalletMain->mapOutputsByDestination.end() && IsMine(*pwalletMain, address))
+            {
+                for (const std::pair<const CWalletTx*, unsigned int>& output : (*mi).second)
+                {
+                    std::unordered_map<const CWalletTx*, int>::const_iterator itDepth = mapDepth.find(output.first);
+                    if (itDepth == mapDepth.end())
+                        continue;
+
+                    tallyitem& item = vTally[n];
+                    item.nAmount += output.first->vout[output.second].nValue;
+                    item.nConf = std::min(item.nConf, (*itDepth).second);
+                    vfTallied[n] = true;
+                }
+            }
+
+            if (fByAccounts || (!vfTallied[n] && !fIncludeEmpty))
                 continue;
 
-            tallyitem& item = mapTally[address];
-            item.nAmount += txout.nValue;
-            item.nConf = std::min(item.nConf, nDepth);
+            int nConf = vTally[n].nConf;
+            json_spirit::Object obj;
+            obj.push_back(json_spirit::Pair("address",       CHoneyAddress(address).ToString()));
+            obj.push_back(json_spirit::Pair("account",       vEntries[n]->second));
+            obj.push_back(json_spirit::Pair("amount",        ValueFromAmount(vTally[n].nAmount)));
+            obj.push_back(json_spirit::Pair("confirmations", (nConf == std::numeric_limits<int>::max() ? 0 : nConf)));
+            vObjects[n] = obj;
         }
-    }
+    });
 
     // Reply
     json_spirit::Array ret;
     std::map<std::string, tallyitem> mapAccountTally;
-    for (const std::pair<CHoneyAddress, std::string>& item : pwalletMain->mapAddressBook)
+    for (size_t n = 0; n < vEntries.size(); n++)
     {
-        const CHoneyAddress& address = item.first;
-        const std::string& strAccount = item.second;
-        std::map<CHoneyAddress, tallyitem>::iterator it = mapTally.find(address);
-        if (it == mapTally.end() && !fIncludeEmpty)
+        if (!vfTallied[n] && !fIncludeEmpty)
             continue;
 
-        int64_t nAmount = 0;
-        int nConf = std::numeric_limits<int>::max();
-        if (it != mapTally.end())
-        {
-            nAmount = (*it).second.nAmount;
-            nConf = (*it).second.nConf;
-        }
-
         if (fByAccounts)
         {
-            tallyitem& item = mapAccountTally[strAccount];
-            item.nAmount += nAmount;
-            item.nConf = std::min(item.nConf, nConf);
+            tallyitem& item = mapAccountTally[vEntries[n]->second];
+            item.nAmount += vTally[n].nAmount;
+            item.nConf = std::min(item.nConf, vTally[n].nConf);
         }
         else
-        {
-            json_spirit::Object obj;
-            obj.push_back(json_spirit::Pair("address",       address.ToString()));
-            obj.push_back(json_spirit::Pair("account",       strAccount));
-            obj.push_back(json_spirit::Pair("amount",        ValueFromAmount(nAmount)));
-            obj.push_back(json_spirit::Pair("confirmations", (nConf == std::numeric_limits<int>::max() ? 0 : nConf)));
-            ret.push_back(obj);
-        }
+            ret.push_back(vObjects[n]);
     }
 
     if (fByAccounts)
@@ -921,14 +941,15 @@ json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool
     return ListReceived(params, true);
 }
 
-static void MaybePushAddress(json_spirit::Object & entry, const CTxDestination &dest)
+static void MaybePushAddress(CJSONWriter& entry, const CTxDestination &dest)
 {
     CHoneyAddress addr;
     if (addr.Set(dest))
-        entry.push_back(json_spirit::Pair("address", addr.ToString()));
+        entry.Pair("address", addr.ToString());
 }
 
-void ListTransactions(const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, json_spirit::Array& ret)
+// Each entry is written as a separate JSON object so callers can page through them
+void ListTransactions(const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, std::vector<std::string>& ret)
 {
     int64_t nFee;
     std::string strSentAccount;
@@ -944,15 +965,17 @@ void ListTransactions(const CWalletTx& wtx, const std::string& strAccount, int n
     {
         for (const std::pair<CTxDestination, int64_t>& s : listSent)
         {
-            json_spirit::Object entry;
-            entry.push_back(json_spirit::Pair("account", strSentAccount));
+            CJSONWriter entry;
+            entry.BeginObject();
+            entry.Pair("account", strSentAccount);
             MaybePushAddress(entry, s.first);
-            entry.push_back(json_spirit::Pair("category", "send"));
-            entry.push_back(json_spirit::Pair("amount", ValueFromAmount(-s.second)));
-            entry.push_back(json_spirit::Pair("fee", ValueFromAmount(-nFee)));
+            entry.Pair("category", "send");
+            entry.Pair("amount", ValueFromAmount(-s.second));
+            entry.Pair("fee", ValueFromAmount(-nFee));
             if (fLong)
                 WalletTxToJSON(wtx, entry);
-            ret.push_back(entry);
+            entry.EndObject();
+            ret.push_back(std::move(entry.str()));
         }
     }
 
@@ -967,32 +990,34 @@ void ListTransactions(const CWalletTx& wtx, const std::string& strAccount, int n
                 account = pwalletMain->mapAddressBook[r.first];
             if (fAllAccounts || (account == strAccount))
             {
-                json_spirit::Object entry;
-                entry.push_back(json_spirit::Pair("account", account));
+                CJSONWriter entry;
+                entry.BeginObject();
+                entry.Pair("account", account);
                 MaybePushAddress(entry, r.first);
                 if (wtx.IsCoinBase() || wtx.IsCoinStake())
                 {
                     if (wtx.GetDepthInMainChain() < 1)
-                        entry.push_back(json_spirit::Pair("category", "orphan"));
+                        entry.Pair("category", "orphan");
                     else if (wtx.GetBlocksToMaturity() > 0)
-                        entry.push_back(json_spirit::Pair("category", "immature"));
+                        entry.Pair("category", "immature");
                     else
-                        entry.push_back(json_spirit::Pair("category", "generate"));
+                        entry.Pair("category", "generate");
                 }
                 else
                 {
-                    entry.push_back(json_spirit::Pair("category", "receive"));
+                    entry.Pair("category", "receive");
                 }
                 if (!wtx.IsCoinStake())
-                    entry.push_back(json_spirit::Pair("amount", ValueFromAmount(r.second)));
+                    entry.Pair("amount", ValueFromAmount(r.second));
                 else
                 {
-                    entry.push_back(json_spirit::Pair("amount", ValueFromAmount(-nFee)));
+                    entry.Pair("amount", ValueFromAmount(-nFee));
                     stop = true; // only one coinstake output
                 }
                 if (fLong)
                     WalletTxToJSON(wtx, entry);
-                ret.push_back(entry);
+                entry.EndObject();
+                ret.push_back(std::move(entry.str()));
             }
             if (stop)
                 break;
@@ -1000,24 +1025,34 @@ void ListTransactions(const CWalletTx& wtx, const std::string& strAccount, int n
     }
 }
 
-void AcentryToJSON(const CAccountingEntry& acentry, const std::string& strAccount, json_spirit::Array& ret)
+void AcentryToJSON(const CAccountingEntry& acentry, const std::string& strAccount, std::vector<std::string>& ret)
 {
     bool fAllAccounts = (strAccount == std::string("*"));
 
     if (fAllAccounts || acentry.strAccount == strAccount)
     {
-        json_spirit::Object entry;
-        entry.push_back(json_spirit::Pair("account", acentry.strAccount));
-        entry.push_back(json_spirit::Pair("category", "move"));
-        entry.push_back(json_spirit::Pair("time", (int64_t)acentry.nTime));
-        entry.push_back(json_spirit::Pair("amount", ValueFromAmount(acentry.nCreditDebit)));
-        entry.push_back(json_spirit::Pair("otheraccount", acentry.strOtherAccount));
-        entry.push_back(json_spirit::Pair("comment", acentry.strComment));
-        ret.push_back(entry);
+        CJSONWriter entry;
+        entry.BeginObject();
+        entry.Pair("account", acentry.strAccount);
+        entry.Pair("category", "move");
+        entry.Pair("time", (int64_t)acentry.nTime);
+        entry.Pair("amount", ValueFromAmount(acentry.nCreditDebit));
+        entry.Pair("otheraccount", acentry.strOtherAccount);
+        entry.Pair("comment", acentry.strComment);
+        entry.EndObject();
+        ret.push_back(std::move(entry.str()));
     }
 }
 
-json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp)
+static void WriteEntries(const std::vector<std::string>& vEntries, CJSONWriter& writer)
+{
+    writer.BeginArray();
+    for (const std::string& strEntry : vEntries)
+        writer.WriteRaw(strEntry);
+    writer.EndArray();
+}
+
+void listtransactions(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw std::runtime_error(
@@ -1039,13 +1074,11 @@ json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    json_spirit::Array ret;
-
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    std::vector<std::string> ret;
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
         CWalletTx *const pwtx = (*it).second.first;
         if (pwtx != 0)
@@ -1062,9 +1095,9 @@ json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp
         nFrom = ret.size();
     if ((nFrom + nCount) > (int)ret.size())
         nCount = ret.size() - nFrom;
-    json_spirit::Array::iterator first = ret.begin();
+    std::vector<std::string>::iterator first = ret.begin();
     std::advance(first, nFrom);
-    json_spirit::Array::iterator last = ret.begin();
+    std::vector<std::string>::iterator last = ret.begin();
     std::advance(last, nFrom+nCount);
 
     if (last != ret.end()) ret.erase(last, ret.end());
@@ -1072,7 +1105,7 @@ json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp
 
     std::reverse(ret.begin(), ret.end()); // Return oldest to newest
 
-    return ret;
+    WriteEntries(ret, writer);
 }
 
 json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp)
@@ -1118,9 +1151,7 @@ json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp)
         }
     }
 
-    std::list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
-    for (const CAccountingEntry& entry : acentries)
+    for (const CAccountingEntry& entry : pwalletMain->laccentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
     json_spirit::Object ret;
@@ -1130,7 +1161,7 @@ json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp)
     return ret;
 }
 
-json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp)
+void listsinceblock(const json_spirit::Array& params, bool fHelp, CJSONWriter& writer)
 {
     if (fHelp)
         throw std::runtime_error(
@@ -1158,15 +1189,20 @@ json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp)
 
     int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
 
-    json_spirit::Array transactions;
-
-    for (std::map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
-    {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
-    }
+    std::vector<std::string> transactions;
+
+    // Only transactions outside the main chain or in blocks above pindex can be
+    // shallower than depth
+    const std::set<std::pair<int, CWalletTx*> >& setTxByHeight = pwalletMain->setTxByHeight;
+    std::set<std::pair<int, CWalletTx*> >::const_iterator it = setTxByHeight.begin();
+    for (; it != setTxByHeight.end() && (*it).first == -1; ++it)
+        if (depth == -1 || (*it).second->GetDepthInMainChain() < depth)
+            ListTransactions(*(*it).second, "*", 0, true, transactions);
+    if (pindex)
+        it = setTxByHeight.lower_bound(std::make_pair(pindex->nHeight + 1, (CWalletTx*)0));
+    for (; it != setTxByHeight.end(); ++it)
+        if (depth == -1 || (*it).second->GetDepthInMainChain() < depth)
+            ListTransactions(*(*it).second, "*", 0, true, transactions);
 
     uint256 lastblock;
 
@@ -1186,14 +1222,14 @@ json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp)
         lastblock = block ? block->GetBlockHash() : 0;
     }
 
-    json_spirit::Object ret;
-    ret.push_back(json_spirit::Pair("transactions", transactions));
-    ret.push_back(json_spirit::Pair("lastblock", lastblock.GetHex()));
-
-    return ret;
+    writer.BeginObject();
+    writer.Key("transactions");
+    WriteEntries(transactions, writer);
+    writer.Pair("lastblock", lastblock.GetHex());
+    writer.EndObject();
 }
 
-json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp)
+void gettransaction(const json_spirit::Array& params, bool fHelp, CJSONWriter& entry)
 {
     if (fHelp || params.size() != 1)
         throw std::runtime_error(
@@ -1203,12 +1239,11 @@ json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp)
     uint256 hash;
     hash.SetHex(params[0].get_str());
 
-    json_spirit::Object entry;
-
     if (pwalletMain->mapWallet.count(hash))
     {
         const CWalletTx& wtx = pwalletMain->mapWallet[hash];
 
+        entry.BeginObject();
         TxToJSON(wtx, 0, entry);
 
         int64_t nCredit = wtx.GetCredit();
@@ -1216,44 +1251,44 @@ json_spirit::Value gettransaction(const json_spirit::Array& params, bool fHelp)
         int64_t nNet = nCredit - nDebit;
         int64_t nFee = (wtx.IsFromMe() ? wtx.GetValueOut() - nDebit : 0);
 
-        entry.push_back(json_spirit::Pair("amount", ValueFromAmount(nNet - nFee)));
+        entry.Pair("amount", ValueFromAmount(nNet - nFee));
         if (wtx.IsFromMe())
-            entry.push_back(json_spirit::Pair("fee", ValueFromAmount(nFee)));
+            entry.Pair("fee", ValueFromAmount(nFee));
 
         WalletTxToJSON(wtx, entry);
 
-        json_spirit::Array details;
+        std::vector<std::string> details;
         ListTransactions(pwalletMain->mapWallet[hash], "*", 0, false, details);
-        entry.push_back(json_spirit::Pair("details", details));
+        entry.Key("details");
+        WriteEntries(details, entry);
+        entry.EndObject();
     }
     else
     {
         CTransaction tx;
         uint256 hashBlock = 0;
-        if (GetTransaction(hash, tx, hashBlock))
+        if (!GetTransaction(hash, tx, hashBlock))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+
+        entry.BeginObject();
+        TxToJSON(tx, 0, entry);
+        if (hashBlock == 0)
+            entry.Pair("confirmations", 0);
+        else
         {
-            TxToJSON(tx, 0, entry);
-            if (hashBlock == 0)
-                entry.push_back(json_spirit::Pair("confirmations", 0));
-            else
+            entry.Pair("blockhash", hashBlock.GetHex());
+            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (*mi).second)
             {
-                entry.push_back(json_spirit::Pair("blockhash", hashBlock.GetHex()));
-                std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-                if (mi != mapBlockIndex.end() && (*mi).second)
-                {
-                    CBlockIndex* pindex = (*mi).second;
-                    if (pindex->IsInMainChain())
-                        entry.push_back(json_spirit::Pair("confirmations", 1 + nBestHeight - pindex->nHeight));
-                    else
-                        entry.push_back(json_spirit::Pair("confirmations", 0));
-                }
+                CBlockIndex* pindex = (*mi).second;
+                if (pindex->IsInMainChain())
+                    entry.Pair("confirmations", 1 + nBestHeight - pindex->nHeight);
+                else
+                    entry.Pair("confirmations", 0);
             }
         }
-        else
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+        entry.EndObject();
     }
-
-    return entry;
 }
 
 
@@ -1336,8 +1371,6 @@ json_spirit::Value walletpassphrase(const json_spirit::Array& params, bool fHelp
             "walletpassphrase <passphrase> <timeout>\n"
             "Stores the wallet decryption key in memory for <timeout> seconds.");
 
-    pwalletMain->TopUpKeyPool();
-
     int64_t nSleepTime = params[1].get_int64();
     LOCK(cs_nWalletUnlockTime);
     nWalletUnlockTime = GetTime() + nSleepTime;
@@ -1484,6 +1517,107 @@ json_spirit::Value reservebalance(const json_spirit::Array& params, bool fHelp)
 }
 
 
+static json_spirit::Object StakingConfig()
+{
+    int64_t nCombine, nSplit;
+    GetStakeThresholds(pwalletMain->GetBalance() - nReserveBalance, nCombine, nSplit);
+
+    std::vector<COutput> vCoins;
+    pwalletMain->AvailableCoinsForStaking(vCoins);
+    int nSmall = 0;
+    for (const COutput& out : vCoins)
+        if (out.tx->vout[out.i].nValue < nCombine)
+            nSmall++;
+
+    json_spirit::Object result;
+    {
+        LOCK(cs_stakeconfig);
+        result.push_back(json_spirit::Pair("combinethreshold", ValueFromAmount(nStakeCombineThreshold)));
+        result.push_back(json_spirit::Pair("splitthreshold", ValueFromAmount(nStakeSplitThreshold)));
+        result.push_back(json_spirit::Pair("splitoutputs", (int)nStakeSplitOutputs));
+        result.push_back(json_spirit::Pair("combineminage", nStakeCombineMinAge));
+        result.push_back(json_spirit::Pair("targetoutputs", (int)nStakeTargetOutputs));
+        result.push_back(json_spirit::Pair("consolidate", fStakeConsolidate));
+    }
+    result.push_back(json_spirit::Pair("effectivecombinethreshold", ValueFromAmount(nCombine)));
+    result.push_back(json_spirit::Pair("effectivesplitthreshold", ValueFromAmount(nSplit)));
+    result.push_back(json_spirit::Pair("stakeoutputs", (int)vCoins.size()));
+    result.push_back(json_spirit::Pair("smalloutputs", nSmall));
+    return result;
+}
+
+json_spirit::Value getstakingconfig(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getstakingconfig\n"
+            "Returns the stake output management settings, the thresholds in effect\n"
+            "for the current balance, and how many stakeable outputs are below the\n"
+            "combine threshold.");
+
+    return StakingConfig();
+}
+
+json_spirit::Value setstakingconfig(const json_spirit::Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "setstakingconfig {\"setting\":value,...}\n"
+            "Changes stake output management settings until restart. Settings are\n"
+            "combinethreshold, splitthreshold (amounts), splitoutputs (1 to 8),\n"
+            "combineminage (seconds), targetoutputs (0 = fixed thresholds, at most 1000)\n"
+            "and consolidate (true/false).\n"
+            "Returns the new configuration as getstakingconfig does.");
+
+    int64_t nCombine, nSplit, nSplitOutputs, nMinAge, nTargetOutputs;
+    bool fConsolidate;
+    {
+        LOCK(cs_stakeconfig);
+        nCombine = nStakeCombineThreshold;
+        nSplit = nStakeSplitThreshold;
+        nSplitOutputs = nStakeSplitOutputs;
+        nMinAge = nStakeCombineMinAge;
+        nTargetOutputs = nStakeTargetOutputs;
+        fConsolidate = fStakeConsolidate;
+    }
+
+    for (const json_spirit::Pair& s : params[0].get_obj())
+    {
+        if (s.name_ == "combinethreshold")
+            nCombine = AmountFromValue(s.value_);
+        else if (s.name_ == "splitthreshold")
+            nSplit = AmountFromValue(s.value_);
+        else if (s.name_ == "splitoutputs")
+            nSplitOutputs = s.value_.get_int64();
+        else if (s.name_ == "combineminage")
+            nMinAge = s.value_.get_int64();
+        else if (s.name_ == "targetoutputs")
+            nTargetOutputs = s.value_.get_int64();
+        else if (s.name_ == "consolidate")
+            fConsolidate = s.value_.get_bool();
+        else
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown setting: " + s.name_);
+    }
+
+    if (!ValidStakeThresholds(nCombine, nSplit))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "splitthreshold must be at least 1 and twice combinethreshold");
+    if (nSplitOutputs < 1 || nSplitOutputs > MAX_STAKE_SPLIT_OUTPUTS ||
+        nMinAge < 0 || nTargetOutputs < 0 || nTargetOutputs > MAX_STAKE_TARGET_OUTPUTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Setting out of range");
+
+    {
+        LOCK(cs_stakeconfig);
+        nStakeCombineThreshold = nCombine;
+        nStakeSplitThreshold = nSplit;
+        nStakeSplitOutputs = nSplitOutputs;
+        nStakeCombineMinAge = nMinAge;
+        nStakeTargetOutputs = nTargetOutputs;
+        fStakeConsolidate = fConsolidate;
+    }
+
+    return StakingConfig();
+}
+
 // ppcoin: check wallet integrity
 json_spirit::Value checkwallet(const json_spirit::Array& params, bool fHelp)
 {
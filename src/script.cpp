@@ -5,6 +5,7 @@
 
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
+#include <boost/thread.hpp>
 #include <boost/variant.hpp>
 
 #include <script.h>
@@ -14,6 +15,8 @@
 #include <sync.h>
 #include <util.h>
 
+#include <atomic>
+
 bool CheckSig(std::vector<unsigned char> vchSig, const std::vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
 
 static const valtype vchFalse(0);
@@ -1370,12 +1373,8 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::v
 
 bool Sign1(const CKeyID& address, const CKeyStore& keystore, uint256 hash, int nHashType, CScript& scriptSigRet)
 {
-    CKey key;
-    if (!keystore.GetKey(address, key))
-        return false;
-
     std::vector<unsigned char> vchSig;
-    if (!key.Sign(hash, vchSig))
+    if (!keystore.SignHash(address, hash, vchSig))
         return false;
     vchSig.push_back((unsigned char)nHashType);
     scriptSigRet << vchSig;
@@ -1687,17 +1686,16 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+// Build the scriptSig for input nIn of txTo. Signature hashes never cover
+// other inputs' scriptSigs, so this only reads txTo.
+static bool ProduceSignature(const CKeyStore &keystore, const CScript& fromPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType, CScript& scriptSigRet)
 {
-    assert(nIn < txTo.vin.size());
-    CTxIn& txin = txTo.vin[nIn];
-
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
     uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
 
     txnouttype whichType;
-    if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
+    if (!Solver(keystore, fromPubKey, hash, nHashType, scriptSigRet, whichType))
         return false;
 
     if (whichType == TX_SCRIPTHASH)
@@ -1705,21 +1703,75 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         // Solver returns the subscript that need to be evaluated;
         // the final scriptSig is the signatures from that
         // and then the serialized subscript:
-        CScript subscript = txin.scriptSig;
+        CScript subscript = scriptSigRet;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
         uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
-            Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) && subType != TX_SCRIPTHASH;
+            Solver(keystore, subscript, hash2, nHashType, scriptSigRet, subType) && subType != TX_SCRIPTHASH;
         // Append serialized subscript whether or not it is completely signed:
-        txin.scriptSig << static_cast<valtype>(subscript);
+        scriptSigRet << static_cast<valtype>(subscript);
         if (!fSolved) return false;
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+    return VerifyScript(scriptSigRet, fromPubKey, txTo, nIn, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+}
+
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    assert(nIn < txTo.vin.size());
+    txTo.InvalidateHash();
+    return ProduceSignature(keystore, fromPubKey, txTo, nIn, nHashType, txTo.vin[nIn].scriptSig);
+}
+
+// Inputs per thread below which a transaction is signed on the calling thread
+static const unsigned int SIGN_INPUTS_PER_THREAD = 16;
+
+// Maximum number of threads signing the inputs of one transaction
+static const int MAX_SIGN_THREADS = 8;
+
+static void ProduceSignatures(const CKeyStore& keystore, const std::vector<CScript>& vFromPubKey, const CTransaction& txTo, int nHashType,
+                              std::atomic<unsigned int>& nNext, std::vector<CScript>& vScriptSig, std::vector<char>& vfSigned)
+{
+    for (unsigned int n = nNext++; n < vScriptSig.size(); n = nNext++)
+        vfSigned[n] = ProduceSignature(keystore, vFromPubKey[n], txTo, n, nHashType, vScriptSig[n]);
+}
+
+bool SignSignatures(const CKeyStore &keystore, const std::vector<CScript>& vFromPubKey, CTransaction& txTo, int nHashType)
+{
+    assert(vFromPubKey.size() == txTo.vin.size());
+    const unsigned int nInputs = txTo.vin.size();
+
+    // Signatures are collected aside and filled in once all are done, so
+    // txTo stays unchanged while the workers read it
+    std::vector<CScript> vScriptSig(nInputs);
+    std::vector<char> vfSigned(nInputs, false);
+    std::atomic<unsigned int> nNext(0);
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_SIGN_THREADS));
+    nThreads = std::min(nThreads, (int)(nInputs / SIGN_INPUTS_PER_THREAD));
+    if (nThreads <= 1)
+        ProduceSignatures(keystore, vFromPubKey, txTo, nHashType, nNext, vScriptSig, vfSigned);
+    else
+    {
+        boost::thread_group threadSign;
+        for (int i = 0; i < nThreads; i++)
+            threadSign.create_thread(boost::bind(&ProduceSignatures, boost::cref(keystore), boost::cref(vFromPubKey), boost::cref(txTo), nHashType,
+                                                 boost::ref(nNext), boost::ref(vScriptSig), boost::ref(vfSigned)));
+        threadSign.join_all();
+    }
+
+    bool fAllSigned = true;
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        txTo.vin[i].scriptSig.swap(vScriptSig[i]);
+        fAllSigned &= (vfSigned[i] != 0);
+    }
+    txTo.InvalidateHash();
+    return fAllSigned;
 }
 
 bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
@@ -828,6 +828,8 @@ bool ExtractDestination(const CScript &scriptPubKey, CTxDestination &addressRet)
 bool ExtractDestinations(const CScript &scriptPubKey, txnouttype &typeRet, std::vector<CTxDestination> &addressRet, int &nRequiredRet);
 bool SignSignature(const CKeyStore &keystore, const CScript &fromPubKey, CTransaction &txTo, unsigned int nIn, int nHashType = SIGHASH_ALL);
 bool SignSignature(const CKeyStore &keystore, const CTransaction &txFrom, CTransaction &txTo, unsigned int nIn, int nHashType = SIGHASH_ALL);
+// Sign every input of txTo against the matching vFromPubKey entry in one pass, on several threads for large transactions
+bool SignSignatures(const CKeyStore &keystore, const std::vector<CScript>& vFromPubKey, CTransaction &txTo, int nHashType = SIGHASH_ALL);
 bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey, const CTransaction &txTo, unsigned int nIn,
                   unsigned int flags, int nHashType);
 bool VerifySignature(const CTransaction &txFrom, const CTransaction &txTo, unsigned int nIn, unsigned int flags, int nHashType);
@@ -312,6 +312,7 @@ I ReadVarInt(Stream& is)
 
 #define FLATDATA(obj)  REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
 #define VARINT(obj)    REF(WrapVarInt(REF(obj)))
+#define BIGENDIAN(obj) REF(WrapBigEndian(REF(obj)))
 
 /** Wrapper for serializing arrays and POD.
  */
@@ -371,6 +372,42 @@ public:
 template<typename I>
 CVarInt<I> WrapVarInt(I& n) { return CVarInt<I>(n); }
 
+/** Wrapper for serializing unsigned integers most significant byte first,
+ * so that serialized keys sort in numeric order (LevelDB range scans).
+ */
+template<typename I>
+class CBigEndian
+{
+protected:
+    I &n;
+public:
+    CBigEndian(I& nIn) : n(nIn) { }
+
+    unsigned int GetSerializeSize(int, int) const {
+        return sizeof(I);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int, int) const {
+        unsigned char buf[sizeof(I)];
+        for (unsigned int i = 0; i < sizeof(I); i++)
+            buf[i] = (unsigned char)(n >> (8 * (sizeof(I) - 1 - i)));
+        s.write((char*)buf, sizeof(I));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int) {
+        unsigned char buf[sizeof(I)];
+        s.read((char*)buf, sizeof(I));
+        n = 0;
+        for (unsigned int i = 0; i < sizeof(I); i++)
+            n = (n << 8) | buf[i];
+    }
+};
+
+template<typename I>
+CBigEndian<I> WrapBigEndian(I& n) { return CBigEndian<I>(n); }
+
 //
 // Forward declarations
 //
@@ -0,0 +1,91 @@
+#include <boost/test/unit_test.hpp>
+
+#include <addrman.h>
+#include <util.h>
+
+static CAddress RandomAddress(uint32_t n)
+{
+    // 1.0.0.0 upwards, spread over many /16 groups
+    struct in_addr ip;
+    ip.s_addr = htonl(0x01000000 + n * 7919);
+    CAddress addr(CService(ip, 15714));
+    addr.nTime = GetAdjustedTime() - GetRand(24 * 60 * 60);
+    return addr;
+}
+
+BOOST_AUTO_TEST_SUITE(addrman_tests)
+
+BOOST_AUTO_TEST_CASE(addrman_sparse_select)
+{
+    CAddrMan addrman;
+    BOOST_CHECK(!addrman.Select().IsValid());
+    BOOST_CHECK(!addrman.SelectRecentlyGood().IsValid());
+
+    // A single entry in 1024*64 new positions is found at once
+    CAddress addr1 = RandomAddress(1);
+    BOOST_CHECK(addrman.Add(addr1, CNetAddr("250.1.1.1")));
+    BOOST_CHECK(addrman.Select() == addr1);
+    BOOST_CHECK(addrman.SelectRecentlyGood() == addr1);
+
+    // ... and so is a single tried entry
+    CAddress addr2 = RandomAddress(2);
+    BOOST_CHECK(addrman.Add(addr2, CNetAddr("250.1.1.1")));
+    addrman.Good(addr2);
+    for (int i = 0; i < 20; i++)
+        BOOST_CHECK(addrman.SelectRecentlyGood() == addr2);
+
+    // Survives a round trip through peers.dat format
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    CAddrMan addrman2;
+    ss >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), 2);
+    BOOST_CHECK(addrman2.SelectRecentlyGood() == addr2);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_change_count)
+{
+    CAddrMan addrman;
+    uint64_t nChanges = addrman.GetChangeCount();
+    addrman.Select();
+    BOOST_CHECK_EQUAL(addrman.GetChangeCount(), nChanges);
+    addrman.Add(RandomAddress(1), CNetAddr("250.1.1.1"));
+    BOOST_CHECK(addrman.GetChangeCount() != nChanges);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_benchmark)
+{
+    const int nAddresses = 120000;
+    const int nSelects = 10000;
+
+    CAddrMan addrman;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nAddresses; i++)
+        addrman.Add(RandomAddress(i), CNetAddr(strprintf("250.%d.%d.1", (i >> 8) & 0xff, i & 0xff)));
+    int64_t nAdd = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nAddresses; i += 8)
+        addrman.Good(RandomAddress(i));
+    int64_t nGood = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nSelects; i++)
+        BOOST_CHECK(addrman.Select().IsValid());
+    int64_t nSelect = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    int64_t nSerialize = GetTimeMicros() - nStart;
+    unsigned int nBytes = ss.size();
+
+    CAddrMan addrman2;
+    ss >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+
+    BOOST_TEST_MESSAGE(strprintf("addrman with %d entries: %d adds in %dus, %d goods in %dus, %d selects in %dus, %u byte snapshot in %dus",
+                                 addrman.size(), nAddresses, nAdd, nAddresses / 8, nGood, nSelects, nSelect, nBytes, nSerialize));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
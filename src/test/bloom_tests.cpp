@@ -0,0 +1,65 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include <bloom.h>
+#include <util.h>
+
+static std::vector<unsigned char> RandomData()
+{
+    uint256 r = GetRandHash();
+    return std::vector<unsigned char>(r.begin(), r.end());
+}
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    // last-100-entry, 1% false positive:
+    CRollingBloomFilter rb1(100, 0.01);
+
+    // Overfill:
+    static const int DATASIZE = 399;
+    std::vector<unsigned char> data[DATASIZE];
+    for (int i = 0; i < DATASIZE; i++) {
+        data[i] = RandomData();
+        rb1.insert(data[i]);
+    }
+    // Last 100 guaranteed to be remembered:
+    for (int i = 299; i < DATASIZE; i++) {
+        BOOST_CHECK(rb1.contains(data[i]));
+    }
+
+    // false positive rate is 1%, so we should get about 100 hits if
+    // testing 10,000 random keys. We get worst-case false positive
+    // behavior when the filter is as full as possible, which is
+    // when we've inserted one minus an integer multiple of nElement*2.
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (rb1.contains(RandomData()))
+            ++nHits;
+    }
+    // Run test_honey with --log_level=message to see BOOST_TEST_MESSAGEs:
+    BOOST_TEST_MESSAGE("RollingBloomFilter got " << nHits << " false positives (~100 expected)");
+
+    // Insanely unlikely to get a fp count outside this range:
+    BOOST_CHECK(nHits > 25);
+    BOOST_CHECK(nHits < 175);
+
+    BOOST_CHECK(rb1.contains(data[DATASIZE-1]));
+    rb1.reset();
+    BOOST_CHECK(!rb1.contains(data[DATASIZE-1]));
+
+    // uint256 keys, as used for inventory:
+    CRollingBloomFilter rb2(1000, 0.001);
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 1000; i++) {
+        vHash.push_back(GetRandHash());
+        rb2.insert(vHash.back());
+    }
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(rb2.contains(vHash[i]));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,60 @@
+#include <boost/test/unit_test.hpp>
+
+#include <kernel.h>
+#include <hash.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(find_kernels)
+{
+    CBlockIndex indexPrev;
+    indexPrev.bnStakeModifierV2 = GetRandHash();
+    const unsigned int nBits = 0x1f00ffff;
+    const unsigned int nTimeBegin = 1500000003, nTimeEnd = 1500001600;
+
+    std::vector<CKernelInput> vInputs(200);
+    for (unsigned int i = 0; i < vInputs.size(); i++)
+    {
+        vInputs[i].prevout = COutPoint(GetRandHash(), i % 3);
+        vInputs[i].nTimeTxPrev = nTimeBegin + (i % 2 ? 0 : 7 * i);
+        vInputs[i].nValue = 2000 + i;
+    }
+
+    std::vector<CKernelHit> vHits;
+    FindKernels(&indexPrev, nBits, vInputs, nTimeBegin, nTimeEnd, vHits);
+
+    // Same hits, in the same order, as hashing every input at every time
+    std::vector<CKernelHit>::const_iterator it = vHits.begin();
+    for (unsigned int nTime = 1500000016; nTime <= nTimeEnd; nTime += STAKE_TIMESTAMP_MASK + 1)
+    {
+        for (unsigned int i = 0; i < vInputs.size(); i++)
+        {
+            const CKernelInput& input = vInputs[i];
+            uint256 bnTarget;
+            bnTarget.SetCompact(nBits);
+            bnTarget *= uint256(input.nValue);
+
+            CDataStream ss(SER_GETHASH, 0);
+            ss << indexPrev.bnStakeModifierV2;
+            ss << input.nTimeTxPrev << input.prevout.hash << input.prevout.n << nTime;
+            uint256 hashProofOfStake = HashBlake2s(ss.begin(), ss.end());
+            if (nTime < input.nTimeTxPrev || hashProofOfStake > bnTarget)
+                continue;
+
+            BOOST_REQUIRE(it != vHits.end());
+            BOOST_CHECK_EQUAL(it->nInput, i);
+            BOOST_CHECK_EQUAL(it->nTime, nTime);
+            BOOST_CHECK(it->hashProofOfStake == hashProofOfStake);
+            BOOST_CHECK(it->targetProofOfStake == bnTarget);
+            ++it;
+        }
+    }
+    BOOST_CHECK(it == vHits.end());
+    BOOST_CHECK(!vHits.empty());
+
+    FindKernels(&indexPrev, nBits, vInputs, nTimeEnd + 1, nTimeEnd, vHits);
+    BOOST_CHECK(vHits.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,9 @@
 #include <vector>
 
 #include <key.h>
+#include <keystore.h>
+#include <main.h>
+#include <script.h>
 #include <base58.h>
 #include <uint256.h>
 #include <util.h>
@@ -137,4 +140,71 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(signing_key_reuse)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    CSigningKey signer;
+    BOOST_CHECK(!signer.IsValid());
+    BOOST_CHECK(!signer.Set(CKey()));
+    BOOST_CHECK(signer.Set(key));
+
+    // Copies share the set-up key and produce valid low-S signatures
+    CSigningKey signerCopy(signer);
+    for (int n = 0; n < 16; n++)
+    {
+        uint256 hash = GetRandHash();
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK((n % 2 ? signer : signerCopy).Sign(hash, vchSig));
+        BOOST_CHECK(pubkey.Verify(hash, vchSig));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sign_signatures_batch)
+{
+    CBasicKeyStore keystore;
+    std::vector<CKey> vKeys(4);
+    for (CKey& key : vKeys)
+    {
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+    }
+
+    // Enough inputs to be signed on several threads
+    CTransaction tx;
+    std::vector<CScript> vFromPubKey;
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        tx.vin.push_back(CTxIn(GetRandHash(), i));
+        CScript scriptPubKey;
+        if (i % 2)
+            scriptPubKey.SetDestination(vKeys[i % vKeys.size()].GetPubKey().GetID());
+        else
+            scriptPubKey << vKeys[i % vKeys.size()].GetPubKey() << OP_CHECKSIG;
+        vFromPubKey.push_back(scriptPubKey);
+    }
+    tx.vout.push_back(CTxOut(COIN, vFromPubKey[0]));
+
+    CTransaction txSingle(tx);
+    for (unsigned int i = 0; i < txSingle.vin.size(); i++)
+        BOOST_CHECK(SignSignature(keystore, vFromPubKey[i], txSingle, i));
+
+    BOOST_CHECK(SignSignatures(keystore, vFromPubKey, tx));
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        BOOST_CHECK(VerifyScript(tx.vin[i].scriptSig, vFromPubKey[i], tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0));
+        BOOST_CHECK(VerifyScript(txSingle.vin[i].scriptSig, vFromPubKey[i], txSingle, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0));
+    }
+
+    // An input without a key fails the batch but leaves the others signed
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    vFromPubKey[7].SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!SignSignatures(keystore, vFromPubKey, tx));
+    BOOST_CHECK(tx.vin[7].scriptSig.empty());
+    BOOST_CHECK(VerifyScript(tx.vin[8].scriptSig, vFromPubKey[8], tx, 8, STANDARD_SCRIPT_VERIFY_FLAGS, 0));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,243 @@
+#include <boost/test/unit_test.hpp>
+
+#include <addressindex.h>
+#include <main.h>
+#include <util.h>
+
+static CTransaction RandomTransaction()
+{
+    CTransaction tx;
+    tx.vin.resize(2);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), i);
+        tx.vin[i].scriptSig << OP_1;
+    }
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        tx.vout[i].nValue = GetRand(COIN);
+        tx.vout[i].scriptPubKey << OP_TRUE;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(main_tests)
+
+BOOST_AUTO_TEST_CASE(transaction_hash_cache)
+{
+    CTransaction tx = RandomTransaction();
+    uint256 hash = SerializeHash(tx);
+    BOOST_CHECK(tx.GetHash() == hash);
+
+    // Deserialized transactions come back finalized with the same hash
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK(txRead.GetHash() == hash);
+
+    // Modifying a finalized transaction requires InvalidateHash(); builds
+    // with -DDEBUG_HASHCACHE assert if GetHash() is called before it
+    txRead.vout[0].nValue++;
+    txRead.InvalidateHash();
+    BOOST_CHECK(txRead.GetHash() == SerializeHash(txRead));
+    BOOST_CHECK(txRead.GetHash() != hash);
+
+    txRead.UpdateHash();
+    BOOST_CHECK(txRead.GetHash() == SerializeHash(txRead));
+
+    // Copies keep the cached value, SetNull() drops it
+    CTransaction txCopy(txRead);
+    BOOST_CHECK(txCopy.GetHash() == txRead.GetHash());
+    txCopy.SetNull();
+    BOOST_CHECK(txCopy.GetHash() == SerializeHash(txCopy));
+}
+
+BOOST_AUTO_TEST_CASE(block_hash_cache)
+{
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    block.nTime = GetTime();
+    block.vtx.push_back(RandomTransaction());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    uint256 hash = block.GetHash();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    CBlock blockRead;
+    ss >> blockRead;
+    BOOST_CHECK(blockRead.GetHash() == hash);
+    BOOST_CHECK(blockRead.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // Unfinalized headers are hashed on every call, so mining still works
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() != hash);
+
+    blockRead.nNonce++;
+    blockRead.InvalidateHash();
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+}
+
+// Transaction hashes computed to receive and check one block, the way
+// ProcessMessage() and ProcessBlock() do before ConnectBlock(): once with the
+// transactions finalized by deserialization, once with them unfinalized as
+// before the cache.
+BOOST_AUTO_TEST_CASE(connect_block_hash_benchmark)
+{
+    const int nTx = 2000;
+
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    CTransaction txCoinBase;
+    txCoinBase.vin.resize(1);
+    txCoinBase.vin[0].prevout.SetNull();
+    txCoinBase.vin[0].scriptSig << OP_1 << OP_2;
+    txCoinBase.vout.resize(1);
+    txCoinBase.vout[0].nValue = COIN;
+    txCoinBase.vout[0].scriptPubKey << OP_TRUE;
+    block.vtx.push_back(txCoinBase);
+    for (int i = 1; i < nTx; i++)
+        block.vtx.push_back(RandomTransaction());
+    block.nTime = GetAdjustedTime();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+
+    uint64_t nStart = CTransaction::nHashesComputed;
+    int64_t nTimeStart = GetTimeMicros();
+    CBlock blockCached;
+    ss >> blockCached;
+    BOOST_CHECK(blockCached.CheckBlock(false, true, false));
+    uint64_t nCached = CTransaction::nHashesComputed - nStart;
+    int64_t nTimeCached = GetTimeMicros() - nTimeStart;
+
+    CBlock blockUncached(blockCached);
+    for (const CTransaction& tx : blockUncached.vtx)
+        tx.InvalidateHash();
+    nStart = CTransaction::nHashesComputed;
+    nTimeStart = GetTimeMicros();
+    BOOST_CHECK(blockUncached.CheckBlock(false, true, false));
+    uint64_t nUncached = CTransaction::nHashesComputed - nStart;
+    int64_t nTimeUncached = GetTimeMicros() - nTimeStart;
+
+    // one hash per transaction, at deserialization, however often it is used
+    BOOST_CHECK_EQUAL(nCached, (uint64_t)nTx);
+    BOOST_CHECK(nUncached > nCached);
+    BOOST_TEST_MESSAGE(strprintf("block of %d transactions: %d transaction hashes cached in %dus, %d uncached in %dus",
+                                 nTx, nCached, nTimeCached, nUncached, nTimeUncached));
+}
+
+BOOST_AUTO_TEST_CASE(address_index_key_order)
+{
+    // Big-endian fields serialize most significant byte first
+    unsigned int n = 0x01020304;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << BIGENDIAN(n);
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), "01020304");
+    unsigned int nRead = 0;
+    ss >> BIGENDIAN(nRead);
+    BOOST_CHECK_EQUAL(nRead, n);
+
+    // History keys of one address sort by height, then block position
+    uint160 hashAddress = Hash160(std::vector<unsigned char>(1, 0x42));
+    uint256 txhash = GetRandHash();
+    CAddressIndexKey keys[] = {
+        CAddressIndexKey(ADDRESS_INDEX_KEY, hashAddress, 255, 7, txhash, 1, false),
+        CAddressIndexKey(ADDRESS_INDEX_KEY, hashAddress, 256, 0, txhash, 0, true),
+        CAddressIndexKey(ADDRESS_INDEX_KEY, hashAddress, 256, 2, txhash, 0, false),
+        CAddressIndexKey(ADDRESS_INDEX_KEY, hashAddress, 65536, 0, txhash, 3, false),
+    };
+    std::string strPrev;
+    for (const CAddressIndexKey& key : keys)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        std::string strKey(ssKey.begin(), ssKey.end());
+        BOOST_CHECK(strPrev < strKey);
+        strPrev = strKey;
+
+        CAddressIndexKey keyRead;
+        ssKey >> keyRead;
+        BOOST_CHECK_EQUAL(keyRead.nHeight, key.nHeight);
+        BOOST_CHECK_EQUAL(keyRead.nTxPos, key.nTxPos);
+        BOOST_CHECK_EQUAL(keyRead.nIndex, key.nIndex);
+        BOOST_CHECK(keyRead.txhash == key.txhash);
+        BOOST_CHECK(keyRead.fSpending == key.fSpending);
+    }
+
+    // Pay-to-pubkey and pay-to-pubkey-hash outputs share an entry
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey, scriptPubKeyHash;
+    scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    scriptPubKeyHash.SetDestination(key.GetPubKey().GetID());
+    unsigned char nType1, nType2;
+    uint160 hash1, hash2;
+    BOOST_CHECK(GetAddressIndexKey(scriptPubKey, nType1, hash1));
+    BOOST_CHECK(GetAddressIndexKey(scriptPubKeyHash, nType2, hash2));
+    BOOST_CHECK(nType1 == ADDRESS_INDEX_KEY && nType2 == ADDRESS_INDEX_KEY);
+    BOOST_CHECK(hash1 == hash2);
+}
+
+BOOST_AUTO_TEST_CASE(chain_snapshot_reorg)
+{
+    // Long enough to span several snapshot chunks
+    const int nBlocks = CChainSnapshot::CHUNK_SIZE * 2 + 100;
+    std::vector<uint256> vHash(nBlocks + 20);
+    std::vector<CBlockIndex> vIndex(nBlocks + 20);
+    for (int i = 0; i < nBlocks; i++)
+    {
+        vHash[i] = GetRandHash();
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+        vIndex[i].nMoneySupply = i * COIN;
+    }
+
+    UpdateChainSnapshot(&vIndex[nBlocks - 11]);
+    std::shared_ptr<const CChainSnapshot> chainOld = GetChainSnapshot();
+    UpdateChainSnapshot(&vIndex[nBlocks - 1]);
+    std::shared_ptr<const CChainSnapshot> chain = GetChainSnapshot();
+    BOOST_CHECK_EQUAL(chain->nHeight, nBlocks - 1);
+    BOOST_CHECK(chain->hashBestChain == vHash[nBlocks - 1]);
+    BOOST_CHECK_EQUAL(chain->nMoneySupply, (nBlocks - 1) * COIN);
+    for (int i = 0; i < nBlocks; i++)
+        BOOST_CHECK((*chain)[i] == &vIndex[i]);
+    BOOST_CHECK((*chain)[nBlocks] == nullptr);
+    BOOST_CHECK((*chain)[-1] == nullptr);
+    BOOST_CHECK(chain->Next(&vIndex[nBlocks - 2]) == &vIndex[nBlocks - 1]);
+    BOOST_CHECK(chain->Next(&vIndex[nBlocks - 1]) == nullptr);
+    BOOST_CHECK_EQUAL(chain->GetDepth(&vIndex[nBlocks - 10]), 10);
+
+    // Older snapshots are not affected by later tips
+    BOOST_CHECK_EQUAL(chainOld->nHeight, nBlocks - 11);
+    BOOST_CHECK(!chainOld->Contains(&vIndex[nBlocks - 1]));
+
+    // Switch to a longer branch forking off below the last full chunk
+    const int nFork = CChainSnapshot::CHUNK_SIZE * 2 - 5;
+    for (int i = 0; i < 20; i++)
+    {
+        CBlockIndex& index = vIndex[nBlocks + i];
+        vHash[nBlocks + i] = GetRandHash();
+        index.phashBlock = &vHash[nBlocks + i];
+        index.nHeight = nFork + 1 + i;
+        index.pprev = i ? &vIndex[nBlocks + i - 1] : &vIndex[nFork];
+    }
+    const CBlockIndex* pindexTip = &vIndex[nBlocks + 19];
+    UpdateChainSnapshot(pindexTip);
+    std::shared_ptr<const CChainSnapshot> chainNew = GetChainSnapshot();
+    BOOST_CHECK_EQUAL(chainNew->nHeight, nFork + 20);
+    for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev)
+        BOOST_CHECK((*chainNew)[pindex->nHeight] == pindex);
+    BOOST_CHECK(!chainNew->Contains(&vIndex[nFork + 1]));
+    BOOST_CHECK(chain->Contains(&vIndex[nFork + 1]));
+    BOOST_CHECK(chainNew->Next(&vIndex[nFork]) == &vIndex[nBlocks]);
+
+    UpdateChainSnapshot(nullptr);
+    BOOST_CHECK_EQUAL(GetChainSnapshot()->nHeight, -1);
+    BOOST_CHECK(GetChainSnapshot()->pindexBest == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
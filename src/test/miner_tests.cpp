@@ -0,0 +1,85 @@
+#include <boost/test/unit_test.hpp>
+
+#include <miner.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(miner_tests)
+
+BOOST_AUTO_TEST_CASE(template_merkle_tree)
+{
+    CTemplateMerkleTree merkle;
+    CBlock block;
+    block.vtx.resize(1);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vout.resize(1);
+
+    for (int nTx = 1; nTx <= 70; nTx++)
+    {
+        // Built one transaction at a time, the coinbase branch gives the same
+        // root as the full tree, whatever the coinbase turns out to be
+        for (int nExtraNonce = 0; nExtraNonce < 2; nExtraNonce++)
+        {
+            block.vtx[0].vin[0].scriptSig = CScript() << nTx << nExtraNonce;
+            block.vtx[0].InvalidateHash();
+            uint256 hashRoot = CBlock::CheckMerkleBranch(block.vtx[0].GetHash(), merkle.GetFirstBranch(), 0);
+            BOOST_CHECK(hashRoot == block.BuildMerkleTree());
+        }
+
+        CTransaction tx;
+        tx.nLockTime = nTx;
+        block.vtx.push_back(tx);
+        merkle.push_back(tx.GetHash());
+    }
+
+    merkle.clear();
+    BOOST_CHECK(merkle.GetFirstBranch().empty());
+}
+
+BOOST_AUTO_TEST_CASE(selection_chosen_outputs)
+{
+    // A confirmed transaction with two outputs, spent one at a time by pool
+    // transactions arriving in different selection rounds
+    CTransaction txConfirmed;
+    txConfirmed.vout.resize(2);
+    txConfirmed.vout[0].nValue = 3 * COIN;
+    txConfirmed.vout[1].nValue = 4 * COIN;
+    const uint256 hashConfirmed = txConfirmed.GetHash();
+
+    CTransaction txA;
+    txA.vin.push_back(CTxIn(COutPoint(hashConfirmed, 0)));
+    txA.vout.resize(1);
+    txA.vout[0].nValue = 2 * COIN;
+    const uint256 hashA = txA.GetHash();
+
+    CTransaction txB;
+    txB.vin.push_back(CTxIn(COutPoint(hashConfirmed, 1)));
+    txB.vout.resize(1);
+    txB.vout[0].nValue = 1 * COIN;
+
+    // First round chose txA. Like ConnectInputs(), the test pool holds the
+    // confirmed transaction it spends as well as txA itself.
+    CTxSelection selection;
+    selection.vtx.push_back(txA);
+    selection.setChosen.insert(hashA);
+    selection.mapTestPool[hashConfirmed] = CTxIndex(CDiskTxPos(1, 1, 1), txConfirmed.vout.size());
+    selection.mapTestPool[hashA] = CTxIndex(CDiskTxPos(1, 1, 1), txA.vout.size());
+
+    LOCK(mempool.cs);
+    mempool.addUnchecked(hashA, txA);
+    const size_t nPoolSize = mempool.mapTx.size();
+
+    // Second round: txB's input is in the chain, not an output of the selection
+    int64_t nValue = 0;
+    BOOST_CHECK(!selection.GetChosenOutputValue(txB.vin[0].prevout, nValue));
+    BOOST_CHECK(!mempool.mapTx.count(hashConfirmed));
+    BOOST_CHECK_EQUAL(mempool.mapTx.size(), nPoolSize);
+
+    // A child of txA is valued from the pool
+    BOOST_CHECK(selection.GetChosenOutputValue(COutPoint(hashA, 0), nValue));
+    BOOST_CHECK_EQUAL(nValue, 2 * COIN);
+    BOOST_CHECK(!selection.GetChosenOutputValue(COutPoint(hashA, 1), nValue));
+
+    mempool.remove(txA);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include <main.h>
+#include <notify.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(notify_tests)
+
+BOOST_AUTO_TEST_CASE(chain_snapshot_wait)
+{
+    CBlockIndex index;
+    uint256 hash = GetRandHash();
+    index.phashBlock = &hash;
+    index.nHeight = 0;
+
+    // Times out while nothing changes
+    int64_t nStart = GetTimeMillis();
+    std::shared_ptr<const CChainSnapshot> chain = WaitForChainSnapshot([](const CChainSnapshot& c) { return c.nHeight >= 0; }, 50);
+    BOOST_CHECK(GetTimeMillis() - nStart >= 50);
+    BOOST_CHECK_EQUAL(chain->nHeight, -1);
+
+    // Wakes up when the tip is published
+    boost::thread thread([&index]() {
+        MilliSleep(20);
+        UpdateChainSnapshot(&index);
+    });
+    chain = WaitForChainSnapshot([](const CChainSnapshot& c) { return c.nHeight >= 0; }, 0);
+    BOOST_CHECK(chain->hashBestChain == hash);
+    thread.join();
+
+    UpdateChainSnapshot(nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(notify_stream)
+{
+    std::string strError;
+    mapArgs["-pubhashtx"] = "10.1.2.3:28391";
+    BOOST_CHECK(!StartNotifications(strError));
+    BOOST_CHECK(strError.find("-pubhashtx") != std::string::npos);
+
+    mapArgs["-pubhashtx"] = "127.0.0.1:28391";
+    mapArgs["-pubrawtx"] = "127.0.0.1:28391";
+    BOOST_REQUIRE(StartNotifications(strError));
+
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket(io_service);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 28391));
+    MilliSleep(100);
+
+    CTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1234;
+    NotifyTransactionAccepted(tx);
+
+    CNotifyMessage msgHash, msgRaw;
+    msgHash.strTopic = "hashtx";
+    msgHash.vchBody = ParseHex(tx.GetHash().GetHex());
+    msgRaw.strTopic = "rawtx";
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    msgRaw.vchBody.assign(ssTx.begin(), ssTx.end());
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << msgHash << msgRaw;
+
+    std::vector<char> vchRead(ssExpected.size());
+    boost::asio::read(socket, boost::asio::buffer(vchRead));
+    CDataStream ss(vchRead.data(), vchRead.data() + vchRead.size(), SER_NETWORK, PROTOCOL_VERSION);
+    CNotifyMessage msg;
+    ss >> msg;
+    BOOST_CHECK_EQUAL(msg.strTopic, "hashtx");
+    BOOST_CHECK(msg.vchBody == msgHash.vchBody);
+    BOOST_CHECK_EQUAL(msg.nSequence, 0U);
+    ss >> msg;
+    BOOST_CHECK_EQUAL(msg.strTopic, "rawtx");
+    BOOST_CHECK(msg.vchBody == msgRaw.vchBody);
+
+    StopNotifications();
+    mapArgs.erase("-pubhashtx");
+    mapArgs.erase("-pubrawtx");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
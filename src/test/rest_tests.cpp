@@ -0,0 +1,84 @@
+#include <boost/test/unit_test.hpp>
+
+#include <main.h>
+#include <rpcserver.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(rest_tests)
+
+BOOST_AUTO_TEST_CASE(rest_request_errors)
+{
+    std::string strBody, strContentType;
+    const std::string strHash = GetRandHash().GetHex();
+
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/", strBody, strContentType), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/nosuch/" + strHash + ".bin", strBody, strContentType), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(strContentType, "text/plain");
+
+    // Unknown format, malformed hash, unknown block and transaction
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/block/" + strHash + ".xml", strBody, strContentType), HTTP_NOT_FOUND);
+    BOOST_CHECK(strBody.find(".bin, .hex, .json") != std::string::npos);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/block/" + strHash.substr(1) + ".bin", strBody, strContentType), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/block/zz" + strHash.substr(2) + ".bin", strBody, strContentType), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/block/" + strHash + ".bin", strBody, strContentType), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/block/notxdetails/" + strHash + ".json", strBody, strContentType), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/tx/" + strHash + ".hex", strBody, strContentType), HTTP_NOT_FOUND);
+
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/" + strHash + ".bin", strBody, strContentType), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/0/" + strHash + ".bin", strBody, strContentType), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/2001/" + strHash + ".bin", strBody, strContentType), HTTP_BAD_REQUEST);
+}
+
+BOOST_AUTO_TEST_CASE(rest_headers)
+{
+    const int nBlocks = 10;
+    std::vector<uint256> vHash(nBlocks);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    for (int i = 0; i < nBlocks; i++)
+    {
+        vIndex[i].nVersion = 7;
+        vIndex[i].nTime = 1500000000 + i;
+        vIndex[i].nBits = 0x1d00ffff;
+        vIndex[i].nNonce = i;
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+        vHash[i] = vIndex[i].GetBlockHeader().GetHash();
+        vIndex[i].phashBlock = &vHash[i];
+        mapBlockIndex[vHash[i]] = &vIndex[i];
+    }
+    UpdateChainSnapshot(&vIndex[nBlocks - 1]);
+
+    std::string strBody, strContentType;
+
+    // Binary: 80 bytes per header, stopping at the tip
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/5/" + vHash[3].GetHex() + ".bin", strBody, strContentType), HTTP_OK);
+    BOOST_CHECK_EQUAL(strContentType, "application/octet-stream");
+    BOOST_REQUIRE_EQUAL(strBody.size(), 5 * 80U);
+    CDataStream ss(strBody.data(), strBody.data() + strBody.size(), SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+    for (int i = 3; i < 8; i++)
+    {
+        CBlock header;
+        ss >> header;
+        BOOST_CHECK(header.GetHash() == vHash[i]);
+    }
+
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/100/" + vHash[8].GetHex() + ".hex", strBody, strContentType), HTTP_OK);
+    BOOST_CHECK_EQUAL(strContentType, "text/plain");
+    BOOST_CHECK_EQUAL(strBody.size(), 2 * 80 * 2 + 1U);
+
+    BOOST_CHECK_EQUAL(HandleRESTRequest("/rest/headers/2/" + vHash[0].GetHex() + ".json?x=1", strBody, strContentType), HTTP_OK);
+    BOOST_CHECK_EQUAL(strContentType, "application/json");
+    json_spirit::Value value;
+    BOOST_REQUIRE(json_spirit::read_string(strBody, value));
+    const json_spirit::Array& vHeaders = value.get_array();
+    BOOST_REQUIRE_EQUAL(vHeaders.size(), 2U);
+    BOOST_CHECK_EQUAL(json_spirit::find_value(vHeaders[1].get_obj(), "hash").get_str(), vHash[1].GetHex());
+    BOOST_CHECK_EQUAL(json_spirit::find_value(vHeaders[1].get_obj(), "previousblockhash").get_str(), vHash[0].GetHex());
+    BOOST_CHECK_EQUAL(json_spirit::find_value(vHeaders[1].get_obj(), "confirmations").get_int(), nBlocks - 1);
+
+    UpdateChainSnapshot(nullptr);
+    for (int i = 0; i < nBlocks; i++)
+        mapBlockIndex.erase(vHash[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
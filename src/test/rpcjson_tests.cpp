@@ -0,0 +1,224 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rpcjson.h>
+#include <rpcprotocol.h>
+#include <uint256.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(rpcjson_tests)
+
+static json_spirit::Value SampleValue()
+{
+    json_spirit::Object inner;
+    inner.push_back(json_spirit::Pair("quote\"back\\slash", "tab\there\nnew\rline\b\f"));
+    inner.push_back(json_spirit::Pair("control", std::string("\x01\x1f\x7f\x80\xff", 5)));
+    inner.push_back(json_spirit::Pair("utf8", "h\xc3\xa9llo"));
+    inner.push_back(json_spirit::Pair("empty", ""));
+
+    json_spirit::Array arr;
+    arr.push_back(0);
+    arr.push_back(-1);
+    arr.push_back((int64_t)-9223372036854775807LL - 1);
+    arr.push_back((int64_t)9223372036854775807LL);
+    arr.push_back((uint64_t)18446744073709551615ULL);
+    arr.push_back(0.0);
+    arr.push_back(-0.5);
+    arr.push_back(21000000.12345678);
+    arr.push_back(1e-9);
+    arr.push_back(1e20);
+    arr.push_back(true);
+    arr.push_back(false);
+    arr.push_back(json_spirit::Value());
+    arr.push_back(json_spirit::Array());
+    arr.push_back(json_spirit::Object());
+
+    json_spirit::Object obj;
+    obj.push_back(json_spirit::Pair("inner", inner));
+    obj.push_back(json_spirit::Pair("array", arr));
+    obj.push_back(json_spirit::Pair("dup", 1));
+    obj.push_back(json_spirit::Pair("dup", 2));
+    return obj;
+}
+
+BOOST_AUTO_TEST_CASE(writer_matches_json_spirit)
+{
+    json_spirit::Value value = SampleValue();
+
+    CJSONWriter writer;
+    writer.Write(value);
+    BOOST_CHECK_EQUAL(writer.str(), json_spirit::write_string(value, false));
+
+    // Built by hand through the streaming calls
+    writer.clear();
+    writer.BeginObject();
+    writer.Pair("a", 1);
+    writer.Key("b");
+    writer.BeginArray();
+    writer.Write("x");
+    writer.WriteNull();
+    writer.WriteRaw("{\"c\":true}");
+    writer.Write(std::string("y"));
+    writer.EndArray();
+    writer.Pair("d", (uint64_t)4294967296ULL);
+    writer.Pair("e", 0.1);
+    writer.Key("f");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+
+    json_spirit::Object obj;
+    json_spirit::Array arr;
+    json_spirit::Object c;
+    c.push_back(json_spirit::Pair("c", true));
+    arr.push_back("x");
+    arr.push_back(json_spirit::Value());
+    arr.push_back(c);
+    arr.push_back("y");
+    obj.push_back(json_spirit::Pair("a", 1));
+    obj.push_back(json_spirit::Pair("b", arr));
+    obj.push_back(json_spirit::Pair("d", (uint64_t)4294967296ULL));
+    obj.push_back(json_spirit::Pair("e", 0.1));
+    obj.push_back(json_spirit::Pair("f", json_spirit::Object()));
+    BOOST_CHECK_EQUAL(writer.str(), json_spirit::write_string(json_spirit::Value(obj), false));
+}
+
+BOOST_AUTO_TEST_CASE(parse_matches_json_spirit)
+{
+    const char* vInput[] = {
+        "{\"method\":\"getblock\",\"params\":[\"00ff\",true],\"id\":1}",
+        " [ 1 , -2 , 3.5 , -4e2 , 5E-1 , 18446744073709551615 , 9223372036854775807 ] ",
+        "{\"a\":{\"b\":[[],{}]},\"c\":null,\"d\":false,\"e\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0041\"}",
+        "\"plain\"",
+        "-0",
+        "1.00000000",
+    };
+    for (const char* psz : vInput)
+    {
+        json_spirit::Value valueFast, valueSpirit;
+        BOOST_CHECK_MESSAGE(ParseJSON(psz, valueFast), psz);
+        BOOST_CHECK(json_spirit::read_string(std::string(psz), valueSpirit));
+        BOOST_CHECK(valueFast.type() == valueSpirit.type());
+        BOOST_CHECK_EQUAL(json_spirit::write_string(valueFast, false), json_spirit::write_string(valueSpirit, false));
+    }
+
+    json_spirit::Value value;
+    BOOST_CHECK(ParseJSON("9223372036854775808", value) && value.is_uint64());
+    BOOST_CHECK(ParseJSON("1", value) && value.type() == json_spirit::int_type && !value.is_uint64());
+    BOOST_CHECK(ParseJSON("1e0", value) && value.type() == json_spirit::real_type);
+
+    // Round trip of everything the writer produces
+    json_spirit::Value sample = SampleValue();
+    std::string strSample = json_spirit::write_string(sample, false);
+    BOOST_CHECK(ParseJSON(strSample, value));
+    BOOST_CHECK_EQUAL(json_spirit::write_string(value, false), strSample);
+
+    const char* vBad[] = {
+        "", " ", "{", "}", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":}", "{a:1}", "tru", "nul",
+        "\"abc", "\"\\x\"", "\"\\u12\"", "01x", "-", "1.", ".5", "1e", "{} {}", "[]x",
+        "18446744073709551616", "-9223372036854775809",
+    };
+    for (const char* psz : vBad)
+        BOOST_CHECK_MESSAGE(!ParseJSON(psz, value), psz);
+
+    std::string strDeep(100000, '[');
+    BOOST_CHECK(!ParseJSON(strDeep + std::string(100000, ']'), value));
+}
+
+// Roughly the shape of getblock with txinfo for a full block
+BOOST_AUTO_TEST_CASE(rpcjson_benchmark)
+{
+    const int nTx = 2000;
+    std::vector<std::string> vHash;
+    for (int i = 0; i < nTx; i++)
+        vHash.push_back(GetRandHash().GetHex());
+
+    int64_t nStart = GetTimeMicros();
+    json_spirit::Object block;
+    block.push_back(json_spirit::Pair("hash", vHash[0]));
+    block.push_back(json_spirit::Pair("confirmations", 12));
+    block.push_back(json_spirit::Pair("difficulty", 1234.5678));
+    json_spirit::Array vtx;
+    for (int i = 0; i < nTx; i++)
+    {
+        json_spirit::Object tx;
+        tx.push_back(json_spirit::Pair("txid", vHash[i]));
+        tx.push_back(json_spirit::Pair("time", (int64_t)1500000000 + i));
+        json_spirit::Array vin, vout;
+        json_spirit::Object in;
+        in.push_back(json_spirit::Pair("txid", vHash[(i + 1) % nTx]));
+        in.push_back(json_spirit::Pair("vout", (int64_t)i % 3));
+        in.push_back(json_spirit::Pair("sequence", (int64_t)4294967295LL));
+        vin.push_back(in);
+        for (int n = 0; n < 2; n++)
+        {
+            json_spirit::Object out;
+            out.push_back(json_spirit::Pair("value", i * 0.01));
+            out.push_back(json_spirit::Pair("n", (int64_t)n));
+            out.push_back(json_spirit::Pair("asm", "OP_DUP OP_HASH160 " + vHash[i].substr(0, 40) + " OP_EQUALVERIFY OP_CHECKSIG"));
+            vout.push_back(out);
+        }
+        tx.push_back(json_spirit::Pair("vin", vin));
+        tx.push_back(json_spirit::Pair("vout", vout));
+        vtx.push_back(tx);
+    }
+    block.push_back(json_spirit::Pair("tx", vtx));
+    std::string strSpirit = json_spirit::write_string(json_spirit::Value(block), false);
+    int64_t nSpiritWrite = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    CJSONWriter writer;
+    writer.BeginObject();
+    writer.Pair("hash", vHash[0]);
+    writer.Pair("confirmations", 12);
+    writer.Pair("difficulty", 1234.5678);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (int i = 0; i < nTx; i++)
+    {
+        writer.BeginObject();
+        writer.Pair("txid", vHash[i]);
+        writer.Pair("time", (int64_t)1500000000 + i);
+        writer.Key("vin");
+        writer.BeginArray();
+        writer.BeginObject();
+        writer.Pair("txid", vHash[(i + 1) % nTx]);
+        writer.Pair("vout", (int64_t)i % 3);
+        writer.Pair("sequence", (int64_t)4294967295LL);
+        writer.EndObject();
+        writer.EndArray();
+        writer.Key("vout");
+        writer.BeginArray();
+        for (int n = 0; n < 2; n++)
+        {
+            writer.BeginObject();
+            writer.Pair("value", i * 0.01);
+            writer.Pair("n", (int64_t)n);
+            writer.Pair("asm", "OP_DUP OP_HASH160 " + vHash[i].substr(0, 40) + " OP_EQUALVERIFY OP_CHECKSIG");
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    int64_t nStreamWrite = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(writer.str() == strSpirit);
+
+    nStart = GetTimeMicros();
+    json_spirit::Value valueSpirit;
+    BOOST_CHECK(json_spirit::read_string(strSpirit, valueSpirit));
+    int64_t nSpiritRead = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    json_spirit::Value valueFast;
+    BOOST_CHECK(ParseJSON(strSpirit, valueFast));
+    int64_t nFastRead = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(json_spirit::write_string(valueFast, false) == strSpirit);
+
+    BOOST_TEST_MESSAGE(strprintf("%u byte reply: json_spirit build+write %dus, CJSONWriter %dus; json_spirit read %dus, ParseJSON %dus",
+                                 strSpirit.size(), nSpiritWrite, nStreamWrite, nSpiritRead, nFastRead));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,63 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rpcprotocol.h>
+#include <serialize.h>
+#include <util.h>
+
+BOOST_AUTO_TEST_SUITE(rpcprotocol_tests)
+
+BOOST_AUTO_TEST_CASE(parse_http_request)
+{
+    const std::string strBody = "{\"method\":\"getblockcount\",\"params\":[],\"id\":1}";
+    const std::string strRequest = HTTPPost(strBody, std::map<std::string, std::string>());
+    // Two pipelined requests, the second one without Connection: close
+    std::string strSecond = strRequest;
+    strSecond.replace(strSecond.find("Connection: close\r\n"), 19, "");
+    const std::string strBuffer = strRequest + strSecond;
+
+    int nProto = 0;
+    std::string strMethod, strURI, strMessage;
+    std::map<std::string, std::string> mapHeaders;
+    int nRet = ParseHTTPRequest(strBuffer.data(), strBuffer.size(), nProto, strMethod, strURI, mapHeaders, strMessage);
+    BOOST_CHECK_EQUAL(nRet, (int)strRequest.size());
+    BOOST_CHECK_EQUAL(nProto, 1);
+    BOOST_CHECK_EQUAL(strMethod, "POST");
+    BOOST_CHECK_EQUAL(strURI, "/");
+    BOOST_CHECK_EQUAL(strMessage, strBody);
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "close");
+
+    nRet = ParseHTTPRequest(strBuffer.data() + nRet, strSecond.size(), nProto, strMethod, strURI, mapHeaders, strMessage);
+    BOOST_CHECK_EQUAL(nRet, (int)strSecond.size());
+    BOOST_CHECK_EQUAL(strMessage, strBody);
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "keep-alive");
+
+    // Incomplete headers or body need more data
+    for (size_t nSize : {(size_t)0, (size_t)10, strRequest.find("\r\n\r\n"), strRequest.size() - 1})
+        BOOST_CHECK_EQUAL(ParseHTTPRequest(strRequest.data(), nSize, nProto, strMethod, strURI, mapHeaders, strMessage), 0);
+
+    // Bare LF line ends are accepted
+    const std::string strLF = "POST / HTTP/1.0\nContent-Length: 2\n\n{}";
+    BOOST_CHECK_EQUAL(ParseHTTPRequest(strLF.data(), strLF.size(), nProto, strMethod, strURI, mapHeaders, strMessage), (int)strLF.size());
+    BOOST_CHECK_EQUAL(strMessage, "{}");
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "close");
+
+    // Malformed or oversized requests are rejected
+    const std::string strBad = "BREW /pot HTTP/1.1\r\n\r\n";
+    BOOST_CHECK_EQUAL(ParseHTTPRequest(strBad.data(), strBad.size(), nProto, strMethod, strURI, mapHeaders, strMessage), -1);
+    const std::string strHuge = strprintf("POST / HTTP/1.1\r\nContent-Length: %u\r\n\r\n", MAX_SIZE + 1);
+    BOOST_CHECK_EQUAL(ParseHTTPRequest(strHuge.data(), strHuge.size(), nProto, strMethod, strURI, mapHeaders, strMessage), -1);
+    const std::string strEndless = "POST / HTTP/1.1\r\nX-Filler: " + std::string(MAX_HTTP_HEADERS_SIZE, 'x');
+    BOOST_CHECK_EQUAL(ParseHTTPRequest(strEndless.data(), strEndless.size(), nProto, strMethod, strURI, mapHeaders, strMessage), -1);
+}
+
+BOOST_AUTO_TEST_CASE(http_reply_header)
+{
+    const std::string strBody = "{\"result\":1}";
+    std::string strReply = HTTPReply(HTTP_SERVICE_UNAVAILABLE, strBody, true);
+    BOOST_CHECK(strReply.find("HTTP/1.1 503 Service Unavailable\r\n") == 0);
+    BOOST_CHECK(strReply.find("Connection: keep-alive\r\n") != std::string::npos);
+    BOOST_CHECK(strReply.find(strprintf("Content-Length: %u\r\n", strBody.size())) != std::string::npos);
+    BOOST_CHECK_EQUAL(strReply.substr(strReply.size() - strBody.size() - 4), "\r\n\r\n" + strBody);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,194 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <fs.h>
+#include <main.h>
+#include <rpcjson.h>
+#include <rpcserver.h>
+#include <util.h>
+
+#include <atomic>
+
+BOOST_AUTO_TEST_SUITE(rpcserver_tests)
+
+// Read-only calls are served from the chain snapshot, so they keep going
+// while cs_main is held, as it is during block validation and staking.
+BOOST_AUTO_TEST_CASE(rpc_read_benchmark)
+{
+    const int nBlocks = 20000;
+    const int nCallsPerThread = 20000;
+    const int nBlockReadsPerThread = 2000;
+
+    // One proof-of-stake block in a scratch data directory stands in for the
+    // block of every index entry, so getblock reads a real block file
+    std::string strDataDirOld = mapArgs["-datadir"];
+    fs::path pathTemp = fs::temp_directory_path() / fs::unique_path("test_honey_%%%%%%%%");
+    fs::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+
+    CBlock block;
+    block.nTime = GetAdjustedTime();
+    block.vtx.resize(2);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vout.resize(1);
+    block.vtx[0].vout[0].SetEmpty();
+    block.vtx[1].vin.resize(1);
+    block.vtx[1].vin[0].prevout = COutPoint(GetRandHash(), 0);
+    block.vtx[1].vout.resize(2);
+    block.vtx[1].vout[0].SetEmpty();
+    block.vtx[1].vout[1].nValue = COIN;
+    block.vtx[1].vout[1].scriptPubKey << OP_TRUE;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    unsigned int nFile, nBlockPos;
+    BOOST_REQUIRE(block.WriteToDisk(nFile, nBlockPos));
+
+    std::vector<uint256> vHash(nBlocks);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    for (int i = 0; i < nBlocks; i++)
+    {
+        vHash[i] = GetRandHash();
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+        vIndex[i].nFile = nFile;
+        vIndex[i].nBlockPos = nBlockPos;
+        vIndex[i].nBits = 0x1d00ffff;
+        vIndex[i].nMint = i;
+        LOCK(cs_mapBlockIndex);
+        mapBlockIndex[vHash[i]] = &vIndex[i];
+    }
+    UpdateChainSnapshot(&vIndex[nBlocks - 1]);
+
+    BOOST_CHECK_EQUAL(tableRPC.execute("getblockcount", json_spirit::Array()).get_int(), nBlocks - 1);
+    BOOST_CHECK_EQUAL(tableRPC.execute("getbestblockhash", json_spirit::Array()).get_str(), vHash[nBlocks - 1].GetHex());
+
+    for (int nThreads : {1, 4, 16})
+    {
+        std::atomic<int> nErrors(0);
+        int64_t nStart = GetTimeMicros();
+        {
+            LOCK(cs_main);
+            boost::thread_group threads;
+            for (int t = 0; t < nThreads; t++)
+                threads.create_thread([&, t]() {
+                    json_spirit::Array params;
+                    params.push_back(0);
+                    for (int i = 0; i < nCallsPerThread; i++)
+                    {
+                        int nHeight = (t * 7919 + i * 104729) % nBlocks;
+                        params[0] = nHeight;
+                        if (tableRPC.execute("getblockhash", params).get_str() != vHash[nHeight].GetHex())
+                            nErrors++;
+                        if (tableRPC.execute("getblockcount", json_spirit::Array()).get_int() != nBlocks - 1)
+                            nErrors++;
+                    }
+                });
+            threads.join_all();
+        }
+        int64_t nElapsed = std::max<int64_t>(GetTimeMicros() - nStart, 1);
+
+        BOOST_CHECK_EQUAL(nErrors, 0);
+        BOOST_TEST_MESSAGE(strprintf("%2d threads: %d calls in %dus, %d queries/sec",
+                                     nThreads, nThreads * nCallsPerThread * 2, nElapsed,
+                                     (int64_t)nThreads * nCallsPerThread * 2 * 1000000 / nElapsed));
+
+        // getblock reads the block from disk and its mint from the index
+        nStart = GetTimeMicros();
+        {
+            LOCK(cs_main);
+            boost::thread_group threads;
+            for (int t = 0; t < nThreads; t++)
+                threads.create_thread([&, t]() {
+                    json_spirit::Array params;
+                    params.push_back(std::string());
+                    for (int i = 0; i < nBlockReadsPerThread; i++)
+                    {
+                        int nHeight = (t * 7919 + i * 104729) % nBlocks;
+                        params[0] = vHash[nHeight].GetHex();
+                        CJSONWriter writer;
+                        tableRPC.execute("getblock", params, writer);
+                        if (writer.str().find("\"height\":" + strprintf("%d", nHeight) + ",") == std::string::npos ||
+                            writer.str().find(block.vtx[1].GetHash().GetHex()) == std::string::npos)
+                            nErrors++;
+                    }
+                });
+            threads.join_all();
+        }
+        nElapsed = std::max<int64_t>(GetTimeMicros() - nStart, 1);
+
+        BOOST_CHECK_EQUAL(nErrors, 0);
+        BOOST_TEST_MESSAGE(strprintf("%2d threads: %d getblock calls in %dus, %d queries/sec",
+                                     nThreads, nThreads * nBlockReadsPerThread, nElapsed,
+                                     (int64_t)nThreads * nBlockReadsPerThread * 1000000 / nElapsed));
+    }
+
+    UpdateChainSnapshot(nullptr);
+    {
+        LOCK(cs_mapBlockIndex);
+        for (int i = 0; i < nBlocks; i++)
+            mapBlockIndex.erase(vHash[i]);
+    }
+    mapArgs["-datadir"] = strDataDirOld;
+    ClearDatadirCache();
+    fs::remove_all(pathTemp);
+}
+
+// Replies come back in request order whether or not the elements could
+// run in parallel, with errors in place of the failed calls.
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    const int nBlocks = 100;
+    std::vector<uint256> vHash(nBlocks);
+    std::vector<CBlockIndex> vIndex(nBlocks);
+    for (int i = 0; i < nBlocks; i++)
+    {
+        vHash[i] = GetRandHash();
+        vIndex[i].phashBlock = &vHash[i];
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+    }
+    UpdateChainSnapshot(&vIndex[nBlocks - 1]);
+
+    json_spirit::Array vReq;
+    for (int i = 0; i < 3 * nBlocks; i++)
+    {
+        json_spirit::Object req;
+        json_spirit::Array params;
+        if (i % 50 == 7)
+            req.push_back(json_spirit::Pair("method", "nosuchmethod"));
+        else if (i % 50 == 30)
+            req.push_back(json_spirit::Pair("method", "getconnectioncount"));
+        else
+        {
+            req.push_back(json_spirit::Pair("method", "getblockhash"));
+            params.push_back(i % nBlocks);
+        }
+        req.push_back(json_spirit::Pair("params", params));
+        req.push_back(json_spirit::Pair("id", i));
+        vReq.push_back(req);
+    }
+
+    json_spirit::Value valReply;
+    BOOST_REQUIRE(json_spirit::read_string(JSONRPCExecBatch(vReq), valReply));
+    const json_spirit::Array& vReply = valReply.get_array();
+    BOOST_REQUIRE_EQUAL(vReply.size(), vReq.size());
+    for (int i = 0; i < (int)vReply.size(); i++)
+    {
+        const json_spirit::Object& reply = vReply[i].get_obj();
+        BOOST_CHECK_EQUAL(json_spirit::find_value(reply, "id").get_int(), i);
+        const json_spirit::Value& error = json_spirit::find_value(reply, "error");
+        const json_spirit::Value& result = json_spirit::find_value(reply, "result");
+        if (i % 50 == 7)
+            BOOST_CHECK_EQUAL(json_spirit::find_value(error.get_obj(), "code").get_int(), (int)RPC_METHOD_NOT_FOUND);
+        else if (i % 50 == 30)
+            BOOST_CHECK(error.is_null() && result.type() == json_spirit::int_type);
+        else
+            BOOST_CHECK(error.is_null() && result.get_str() == vHash[i % nBlocks].GetHex());
+    }
+
+    UpdateChainSnapshot(nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -291,4 +291,274 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(unspent_index_tests)
+{
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+
+    CTransaction tx;
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 5 * COIN;
+    tx.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    tx.vout[1].nValue = 1 * COIN;
+    tx.vout[1].scriptPubKey << OP_TRUE;
+    wallet.AddToWallet(CWalletTx(&wallet, tx));
+
+    // only our output counts, and an unconfirmed receive isn't spendable yet
+    BOOST_CHECK(wallet.mapUnspentTx.count(tx.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+
+    // spending our output drops the transaction from the index and the cached balance
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(tx.GetHash(), 0));
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 5 * COIN;
+    txSpend.vout[0].scriptPubKey << OP_TRUE;
+    wallet.WalletUpdateSpent(txSpend);
+    BOOST_CHECK(!wallet.mapUnspentTx.count(tx.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+
+    std::vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable, false);
+    BOOST_CHECK(vAvailable.empty());
+}
+
+BOOST_AUTO_TEST_CASE(ismine_cache_tests)
+{
+    CWallet wallet;
+    CKey key1, key2, keyOther;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    keyOther.MakeNewKey(true);
+    wallet.AddKeyPubKey(key1, key1.GetPubKey());
+
+    std::vector<CPubKey> vKeys;
+    vKeys.push_back(key1.GetPubKey());
+    vKeys.push_back(key2.GetPubKey());
+    CScript redeemScript;
+    redeemScript.SetMultisig(2, vKeys);
+    wallet.AddCScript(redeemScript);
+
+    std::vector<CScript> vScripts(7);
+    vScripts[0].SetDestination(key1.GetPubKey().GetID());
+    vScripts[1].SetDestination(keyOther.GetPubKey().GetID());
+    vScripts[2] << key1.GetPubKey() << OP_CHECKSIG;
+    vScripts[3] << key2.GetPubKey() << OP_CHECKSIG;
+    vScripts[4].SetDestination(redeemScript.GetID());
+    vScripts[5] = redeemScript;
+    vScripts[6] << OP_TRUE;
+
+    // the cached classification agrees with the generic one before and after
+    // the second key turns the multisig redeem script into ours
+    for (int n = 0; n < 2; n++)
+    {
+        for (const CScript& script : vScripts)
+            BOOST_CHECK_EQUAL(wallet.IsMine(script), IsMine(wallet, script));
+        wallet.AddKeyPubKey(key2, key2.GetPubKey());
+    }
+    BOOST_CHECK(wallet.IsMine(vScripts[3]));
+    BOOST_CHECK(wallet.IsMine(vScripts[4]));
+    BOOST_CHECK(!wallet.IsMine(vScripts[1]));
+
+    wallet.RebuildMineCache();
+    for (const CScript& script : vScripts)
+        BOOST_CHECK_EQUAL(wallet.IsMine(script), IsMine(wallet, script));
+}
+
+// Synthetic wallet of nCoins mature outputs between 0.001 and ~100 coins
+static void MakeCoins(CWallet& wallet, int nCoins, std::vector<CWalletTx>& vTx, std::vector<COutput>& vOutputs)
+{
+    vTx.resize(nCoins);
+    vOutputs.clear();
+    for (int i = 0; i < nCoins; i++)
+    {
+        CTransaction tx;
+        tx.nTime = 0;
+        tx.nLockTime = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN / 1000 + GetRand(100 * COIN);
+        vTx[i] = CWalletTx(&wallet, tx);
+    }
+    for (int i = 0; i < nCoins; i++)
+        vOutputs.push_back(COutput(&vTx[i], 0, 100));
+    std::sort(vOutputs.begin(), vOutputs.end(), [](const COutput& a, const COutput& b) {
+        return a.tx->vout[a.i].nValue > b.tx->vout[b.i].nValue;
+    });
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_exact_match)
+{
+    CWallet wallet;
+    std::vector<CWalletTx> vTx;
+    std::vector<COutput> vOutputs;
+    MakeCoins(wallet, 12, vTx, vOutputs);
+
+    // a target made up of a few of the coins is always met without change,
+    // small pools are searched exhaustively
+    for (int n = 0; n < 20; n++)
+    {
+        std::vector<COutput> vPick(vOutputs);
+        random_shuffle(vPick.begin(), vPick.end(), GetRandInt);
+        int64_t nTarget = 0;
+        for (int i = 0; i < 3; i++)
+            nTarget += vPick[i].tx->vout[0].nValue;
+        std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+        int64_t nValue = 0;
+        BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, GetTime(), 1, 1, vOutputs, setCoins, nValue));
+        BOOST_CHECK_EQUAL(nValue, nTarget);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_benchmark)
+{
+    const int vSizes[] = {1000, 10000, 100000};
+    CWallet wallet;
+    for (int nCoins : vSizes)
+    {
+        std::vector<CWalletTx> vTx;
+        std::vector<COutput> vOutputs;
+        MakeCoins(wallet, nCoins, vTx, vOutputs);
+
+        // one target that has an exact match and one that most likely does not
+        int64_t vTargets[] = {vOutputs[nCoins / 2].tx->vout[0].nValue + vOutputs[nCoins / 3].tx->vout[0].nValue, 1234 * COIN + 1};
+        for (int64_t nTarget : vTargets)
+        {
+            std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+            int64_t nValue = 0;
+            int64_t nStart = GetTimeMicros();
+            BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, GetTime(), 1, 1, vOutputs, setCoins, nValue));
+            int64_t nElapsed = GetTimeMicros() - nStart;
+            BOOST_CHECK(nValue >= nTarget);
+            BOOST_TEST_MESSAGE(strprintf("%d coins: selected %d inputs worth %s for %s in %dus",
+                                         nCoins, setCoins.size(), FormatMoney(nValue), FormatMoney(nTarget), nElapsed));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_thresholds)
+{
+    int64_t nCombine, nSplit;
+
+    // small balances use the configured thresholds
+    GetStakeThresholds(1000 * COIN, nCombine, nSplit);
+    BOOST_CHECK_EQUAL(nCombine, nStakeCombineThreshold);
+    BOOST_CHECK_EQUAL(nSplit, nStakeSplitThreshold);
+
+    // with the default target of 0 large balances do too
+    int64_t nStakeable = 1000000 * COIN;
+    BOOST_CHECK_EQUAL(nStakeTargetOutputs, DEFAULT_STAKE_TARGET_OUTPUTS);
+    GetStakeThresholds(nStakeable, nCombine, nSplit);
+    BOOST_CHECK_EQUAL(nCombine, nStakeCombineThreshold);
+    BOOST_CHECK_EQUAL(nSplit, nStakeSplitThreshold);
+
+    // with a target, large ones aim for about nStakeTargetOutputs outputs,
+    // and splits never fall below the combine threshold
+    nStakeTargetOutputs = 50;
+    GetStakeThresholds(nStakeable, nCombine, nSplit);
+    BOOST_CHECK_EQUAL(nCombine, nStakeable / 50 / 2);
+    BOOST_CHECK_EQUAL(nSplit, nStakeable / 50 * 2);
+    BOOST_CHECK(ValidStakeThresholds(nCombine, nSplit));
+    nStakeTargetOutputs = DEFAULT_STAKE_TARGET_OUTPUTS;
+
+    BOOST_CHECK(!ValidStakeThresholds(600 * COIN, 1000 * COIN));
+    BOOST_CHECK(!ValidStakeThresholds(0, 0));
+}
+
+BOOST_AUTO_TEST_CASE(tx_order_index)
+{
+    CWallet wallet;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 5; i++)
+    {
+        CTransaction tx;
+        tx.nLockTime = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN;
+        tx.vout[0].scriptPubKey << OP_TRUE;
+        wallet.AddToWallet(CWalletTx(&wallet, tx));
+        vHashes.push_back(tx.GetHash());
+    }
+
+    // the activity log lists transactions in the order they were added
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 5);
+    int i = 0;
+    for (const std::pair<const int64_t, CWallet::TxPair>& item : wallet.wtxOrdered)
+        BOOST_CHECK(item.second.first->GetHash() == vHashes[i++]);
+
+    // none of them is in a block
+    BOOST_CHECK_EQUAL(wallet.setTxByHeight.size(), 5);
+    BOOST_CHECK_EQUAL(wallet.setTxByHeight.begin()->first, -1);
+    BOOST_CHECK_EQUAL(wallet.setTxByHeight.rbegin()->first, -1);
+}
+
+BOOST_AUTO_TEST_CASE(destination_index)
+{
+    CWallet wallet;
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    CTxDestination dest = key.GetPubKey().GetID(), destOther = keyOther.GetPubKey().GetID();
+
+    CTransaction tx;
+    tx.vout.resize(4);
+    tx.vout[0].nValue = 5 * COIN;
+    tx.vout[0].scriptPubKey.SetDestination(dest);
+    tx.vout[1].nValue = 1 * COIN;
+    tx.vout[1].scriptPubKey << OP_TRUE;
+    tx.vout[2].nValue = 2 * COIN;
+    tx.vout[2].scriptPubKey.SetDestination(destOther);
+    tx.vout[3].nValue = 3 * COIN;
+    tx.vout[3].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    wallet.AddToWallet(CWalletTx(&wallet, tx));
+    const CWalletTx* pwtx = &wallet.mapWallet[tx.GetHash()];
+
+    // pay-to-pubkey and pay-to-pubkey-hash outputs share the key's entry,
+    // outputs to others are indexed too and unsolvable ones are left out
+    BOOST_CHECK_EQUAL(wallet.mapOutputsByDestination.size(), 2U);
+    BOOST_CHECK(wallet.mapOutputsByDestination[dest] == (std::set<std::pair<const CWalletTx*, unsigned int> >{{pwtx, 0}, {pwtx, 3}}));
+    BOOST_CHECK(wallet.mapOutputsByDestination[destOther] == (std::set<std::pair<const CWalletTx*, unsigned int> >{{pwtx, 2}}));
+
+    // adding the transaction again changes nothing, rebuilding gives the same index
+    wallet.AddToWallet(CWalletTx(&wallet, tx));
+    std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > > mapBefore = wallet.mapOutputsByDestination;
+    wallet.ReindexTxOrder();
+    BOOST_CHECK(wallet.mapOutputsByDestination == mapBefore);
+
+    LOCK(wallet.cs_wallet);
+    wallet.IndexDestinations(*pwtx, true);
+    BOOST_CHECK(wallet.mapOutputsByDestination.empty());
+}
+
+BOOST_AUTO_TEST_CASE(keypool_batch_refill)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    // More than one batch, generated on several threads
+    unsigned int nSize = KEYPOOL_BATCH_SIZE + KEYPOOL_BATCH_SIZE / 2;
+    BOOST_CHECK(wallet.TopUpKeyPool(nSize));
+    BOOST_CHECK_EQUAL(wallet.GetKeyPoolSize(), nSize + 1);
+    BOOST_CHECK_EQUAL(*wallet.setKeyPool.begin(), 1);
+    BOOST_CHECK_EQUAL(*wallet.setKeyPool.rbegin(), (int64_t)nSize + 1);
+
+    std::set<CKeyID> setKeys;
+    wallet.GetKeys(setKeys);
+    BOOST_CHECK_EQUAL(setKeys.size(), nSize + 1);
+    for (const CKeyID& keyid : setKeys)
+        BOOST_CHECK(wallet.mapKeyMetadata.count(keyid));
+
+    // A full pool is left alone, a smaller target never shrinks it
+    BOOST_CHECK(wallet.TopUpKeyPool(nSize));
+    BOOST_CHECK(wallet.TopUpKeyPool(10));
+    BOOST_CHECK_EQUAL(wallet.GetKeyPoolSize(), nSize + 1);
+
+    BOOST_CHECK(wallet.TopUpKeyPool(nSize + 5));
+    BOOST_CHECK_EQUAL(wallet.GetKeyPoolSize(), nSize + 6);
+    BOOST_CHECK_EQUAL(*wallet.setKeyPool.rbegin(), (int64_t)nSize + 6);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
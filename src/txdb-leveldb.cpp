@@ -293,12 +293,158 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
     CBlockIndex* pindexNew = new CBlockIndex();
     if (!pindexNew)
         throw std::runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    {
+        LOCK(cs_mapBlockIndex);
+        mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
+        pindexNew->phashBlock = &((*mi).first);
+    }
 
     return pindexNew;
 }
 
+bool CTxDB::ReadFlag(const std::string& strName, bool& fValue)
+{
+    char ch;
+    if (!Read(std::make_pair(std::string("flag"), strName), ch))
+        return false;
+    fValue = (ch == '1');
+    return true;
+}
+
+bool CTxDB::WriteFlag(const std::string& strName, bool fValue)
+{
+    return Write(std::make_pair(std::string("flag"), strName), fValue ? '1' : '0');
+}
+
+bool CTxDB::WriteAddressIndex(const AddressIndexEntries& vEntries)
+{
+    for (AddressIndexEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Write(std::make_pair(std::string("addrtx"), (*it).first), (*it).second))
+            return false;
+    return true;
+}
+
+bool CTxDB::EraseAddressIndex(const AddressIndexEntries& vEntries)
+{
+    for (AddressIndexEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+        if (!Erase(std::make_pair(std::string("addrtx"), (*it).first)))
+            return false;
+    return true;
+}
+
+bool CTxDB::UpdateAddressUnspentIndex(const AddressUnspentEntries& vEntries)
+{
+    // Applied in order: an output created and spent in one block is put, then erased
+    for (AddressUnspentEntries::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+    {
+        if ((*it).second.IsNull())
+        {
+            if (!Erase(std::make_pair(std::string("addrutxo"), (*it).first)))
+                return false;
+        }
+        else if (!Write(std::make_pair(std::string("addrutxo"), (*it).first), (*it).second))
+            return false;
+    }
+    return true;
+}
+
+bool CTxDB::ReadAddressIndex(unsigned char nAddressType, const uint160& hashAddress, AddressIndexEntries& vEntries,
+                             unsigned int nStart, unsigned int nEnd)
+{
+    // Keys of one address are contiguous and ordered by height, so the
+    // range is a single seek followed by a forward scan
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << std::make_pair(std::string("addrtx"), CAddressIndexKey(nAddressType, hashAddress, nStart, 0, 0, 0, false));
+    iterator->Seek(ssStartKey.str());
+    for (; iterator->Valid(); iterator->Next())
+    {
+        boost::this_thread::interruption_point();
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        std::string strType;
+        CAddressIndexKey key;
+        ssKey >> strType;
+        if (strType != "addrtx")
+            break;
+        ssKey >> key;
+        if (key.nAddressType != nAddressType || key.hashAddress != hashAddress || (nEnd > 0 && key.nHeight > nEnd))
+            break;
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.write(iterator->value().data(), iterator->value().size());
+        int64_t nValue;
+        ssValue >> nValue;
+        vEntries.push_back(std::make_pair(key, nValue));
+    }
+    bool fOk = iterator->status().ok();
+    delete iterator;
+    return fOk;
+}
+
+bool CTxDB::ReadAddressUnspentIndex(unsigned char nAddressType, const uint160& hashAddress, AddressUnspentEntries& vEntries)
+{
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << std::make_pair(std::string("addrutxo"), CAddressUnspentKey(nAddressType, hashAddress, 0, 0));
+    iterator->Seek(ssStartKey.str());
+    for (; iterator->Valid(); iterator->Next())
+    {
+        boost::this_thread::interruption_point();
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        std::string strType;
+        CAddressUnspentKey key;
+        ssKey >> strType;
+        if (strType != "addrutxo")
+            break;
+        ssKey >> key;
+        if (key.nAddressType != nAddressType || key.hashAddress != hashAddress)
+            break;
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.write(iterator->value().data(), iterator->value().size());
+        CAddressUnspentValue value;
+        ssValue >> value;
+        vEntries.push_back(std::make_pair(key, value));
+    }
+    bool fOk = iterator->status().ok();
+    delete iterator;
+    return fOk;
+}
+
+// Remove every address index record, in batches so memory use stays bounded
+bool CTxDB::WipeAddressIndex()
+{
+    const char* pszPrefixes[] = { "addrtx", "addrutxo" };
+    for (const char* pszPrefix : pszPrefixes)
+    {
+        CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+        ssPrefix << std::string(pszPrefix);
+        const std::string strPrefix = ssPrefix.str();
+
+        leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+        leveldb::WriteBatch batch;
+        unsigned int nBatch = 0;
+        for (iterator->Seek(strPrefix); iterator->Valid() && iterator->key().starts_with(strPrefix); iterator->Next())
+        {
+            batch.Delete(iterator->key());
+            if (++nBatch == 10000)
+            {
+                if (!pdb->Write(leveldb::WriteOptions(), &batch).ok())
+                    break;
+                batch.Clear();
+                nBatch = 0;
+            }
+        }
+        bool fOk = iterator->status().ok();
+        delete iterator;
+        if (!fOk || !pdb->Write(leveldb::WriteOptions(), &batch).ok())
+            return false;
+    }
+    return true;
+}
+
 bool CTxDB::LoadBlockIndex()
 {
     if (mapBlockIndex.size() > 0) {
@@ -395,9 +541,9 @@ bool CTxDB::LoadBlockIndex()
             return true;
         return error("CTxDB::LoadBlockIndex() : hashBestChain not loaded");
     }
-    if (!mapBlockIndex.count(hashBestChain))
+    pindexBest = LookupBlockIndex(hashBestChain);
+    if (!pindexBest)
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
-    pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
 
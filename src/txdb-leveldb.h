@@ -6,6 +6,7 @@
 #ifndef HONEY_LEVELDB_H
 #define HONEY_LEVELDB_H
 
+#include <addressindex.h>
 #include <main.h>
 
 #include <map>
@@ -198,6 +199,19 @@ public:
     bool ReadBestInvalidTrust(uint256& bnBestInvalidTrust);
     bool WriteBestInvalidTrust(uint256 bnBestInvalidTrust);
     bool LoadBlockIndex();
+
+    bool ReadFlag(const std::string& strName, bool& fValue);
+    bool WriteFlag(const std::string& strName, bool fValue);
+
+    // Address index (-addressindex)
+    bool WriteAddressIndex(const AddressIndexEntries& vEntries);
+    bool EraseAddressIndex(const AddressIndexEntries& vEntries);
+    bool UpdateAddressUnspentIndex(const AddressUnspentEntries& vEntries);
+    // History of an address between two heights (inclusive, nEnd 0 for no limit), oldest first
+    bool ReadAddressIndex(unsigned char nAddressType, const uint160& hashAddress, AddressIndexEntries& vEntries,
+                          unsigned int nStart = 0, unsigned int nEnd = 0);
+    bool ReadAddressUnspentIndex(unsigned char nAddressType, const uint160& hashAddress, AddressUnspentEntries& vEntries);
+    bool WipeAddressIndex();
 private:
     bool LoadBlockIndexGuts();
 };
@@ -24,7 +24,7 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
-bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
+bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx, int64_t nFeePerKB)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
@@ -34,6 +34,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
         mapTx[hash] = tx;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+        mapFeePerKB[hash] = nFeePerKB;
         nTransactionsUpdated++;
     }
     return true;
@@ -57,6 +58,7 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
             for (const CTxIn& txin : tx.vin)
                 mapNextTx.erase(txin.prevout);
             mapTx.erase(hash);
+            mapFeePerKB.erase(hash);
             nTransactionsUpdated++;
         }
     }
@@ -83,6 +85,7 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapFeePerKB.clear();
     ++nTransactionsUpdated;
 }
 
@@ -104,3 +107,11 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     result = i->second;
     return true;
 }
+
+int64_t CTxMemPool::GetFeePerKB(const uint256& hash) const
+{
+    LOCK(cs);
+    std::map<uint256, int64_t>::const_iterator i = mapFeePerKB.find(hash);
+    if (i == mapFeePerKB.end()) return 0;
+    return i->second;
+}
@@ -27,10 +27,11 @@ public:
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
+    std::map<uint256, int64_t> mapFeePerKB; // used to order relay announcements
 
     CTxMemPool();
 
-    bool addUnchecked(const uint256& hash, CTransaction &tx);
+    bool addUnchecked(const uint256& hash, CTransaction &tx, int64_t nFeePerKB = 0);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
     void clear();
@@ -51,6 +52,7 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    int64_t GetFeePerKB(const uint256& hash) const;
 };
 
 #endif /* HONEY_TXMEMPOOL_H */
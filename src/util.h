@@ -161,6 +161,7 @@ void FileCommit(FILE *fileout);
 bool RenameOver(fs::path src, fs::path dest);
 fs::path GetDefaultDataDir();
 const fs::path &GetDataDir(bool fNetSpecific = true);
+void ClearDatadirCache();
 fs::path GetConfigFile();
 fs::path GetPidFile();
 #ifndef WIN32
@@ -8,6 +8,7 @@
 #include <arith_uint256.h>
 #include <base58.h>
 #include <coincontrol.h>
+#include <init.h>
 #include <kernel.h>
 #include <net.h>
 #include <timedata.h>
@@ -17,14 +18,46 @@
 
 #include <boost/algorithm/string/replace.hpp>
 
+#include <unordered_set>
+
 
 // Settings
 int64_t nTransactionFee = MIN_TX_FEE;
 int64_t nReserveBalance = 0;
 int64_t nMinimumInputValue = 0;
 
-static int64_t GetStakeCombineThreshold() { return 500 * COIN; }
-static int64_t GetStakeSplitThreshold() { return 2 * GetStakeCombineThreshold(); }
+CCriticalSection cs_stakeconfig;
+int64_t nStakeCombineThreshold = DEFAULT_STAKE_COMBINE_THRESHOLD;
+int64_t nStakeSplitThreshold = DEFAULT_STAKE_SPLIT_THRESHOLD;
+int64_t nStakeCombineMinAge = 0;
+unsigned int nStakeTargetOutputs = DEFAULT_STAKE_TARGET_OUTPUTS;
+unsigned int nStakeSplitOutputs = DEFAULT_STAKE_SPLIT_OUTPUTS;
+bool fStakeConsolidate = false;
+
+// Seconds between two attempts to consolidate small stake outputs
+static const int64_t STAKE_CONSOLIDATE_INTERVAL = 10 * 60;
+
+// Number of small outputs of one address needed before they are consolidated,
+// and the most a single consolidation transaction spends
+static const unsigned int STAKE_CONSOLIDATE_MIN_INPUTS = 5;
+static const unsigned int STAKE_CONSOLIDATE_MAX_INPUTS = 50;
+
+// Every stake output costs a kernel hash per search, while an output that
+// staked is out of the running until it matures. Outputs of about
+// nStakeable / nStakeTargetOutputs keep both small, so for large balances the
+// configured thresholds are raised towards that size.
+void GetStakeThresholds(int64_t nStakeable, int64_t& nCombineRet, int64_t& nSplitRet)
+{
+    LOCK(cs_stakeconfig);
+    nCombineRet = nStakeCombineThreshold;
+    nSplitRet = nStakeSplitThreshold;
+    if (nStakeTargetOutputs > 0 && nStakeable > 0)
+    {
+        int64_t nTarget = nStakeable / nStakeTargetOutputs;
+        nCombineRet = std::max(nCombineRet, nTarget / 2);
+        nSplitRet = std::max(nSplitRet, nTarget * 2);
+    }
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -71,9 +104,12 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    CacheMineKey(pubkey.GetID());
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
@@ -83,12 +119,15 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    CacheMineKey(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
         LOCK(cs_wallet);
         if (pwalletdbEncryption)
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey, vchCryptedSecret, mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey, vchCryptedSecret, mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey, vchCryptedSecret, mapKeyMetadata[vchPubKey.GetID()]);
     }
@@ -105,15 +144,29 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    LOCK(cs_KeyStore);
+    setMineKeyIds.insert(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    LOCK(cs_KeyStore);
+    setMineKeyIds.insert(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    CacheMineScript(redeemScript);
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -137,9 +190,44 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
+    // Scripts are classified once all keys are loaded, in RebuildMineCache()
     return CCryptoKeyStore::AddCScript(redeemScript);
 }
 
+// A new key can make redeem scripts already in the keystore ours, e.g. a
+// multisig script whose last missing key was just added.
+void CWallet::CacheMineKey(const CKeyID& keyid)
+{
+    LOCK(cs_KeyStore);
+    if (!setMineKeyIds.insert(keyid).second)
+        return;
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        if (!setMineScriptIds.count((*it).first) && ::IsMine(*this, (*it).second))
+            setMineScriptIds.insert((*it).first);
+}
+
+void CWallet::CacheMineScript(const CScript& redeemScript)
+{
+    LOCK(cs_KeyStore);
+    if (::IsMine(*this, redeemScript))
+        setMineScriptIds.insert(redeemScript.GetID());
+}
+
+void CWallet::RebuildMineCache()
+{
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+
+    LOCK(cs_KeyStore);
+    setMineKeyIds.clear();
+    setMineScriptIds.clear();
+    for (const CKeyID& keyid : setKeys)
+        setMineKeyIds.insert(keyid);
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        if (::IsMine(*this, (*it).second))
+            setMineScriptIds.insert((*it).first);
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 {
     CCrypter crypter;
@@ -154,7 +242,10 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 continue; // try another master key
             if (CCryptoKeyStore::Unlock(vMasterKey))
+            {
+                RequestKeyPoolRefill();
                 return true;
+            }
         }
     }
     return false;
@@ -208,8 +299,11 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
-    CWalletDB walletdb(strWalletFile);
-    walletdb.WriteBestBlock(loc);
+    // The best block must never be ahead of the transactions written for it,
+    // or a crash would lose them without a rescan
+    if (!FlushTxQueue())
+        return;
+    CWalletDB(strWalletFile).WriteBestBlock(loc);
 }
 
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
@@ -344,29 +438,78 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order std::multimap.
-    TxItems txOrdered;
+    LOCK(cs_wallet);
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(std::make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    return true;
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
-    for (std::map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+// Move wtx to the height of its block in setTxByHeight. Transactions of a
+// block being disconnected are passed with fInMainChain false.
+void CWallet::IndexTxHeight(CWalletTx& wtx, bool fInMainChain)
+{
+    AssertLockHeld(cs_wallet);
+    int nHeight = -1;
+    if (fInMainChain && wtx.hashBlock != 0)
     {
-        CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(std::make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && (*mi).second->IsInMainChain())
+            nHeight = (*mi).second->nHeight;
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    for (CAccountingEntry& entry : acentries)
+    setTxByHeight.erase(std::make_pair(wtx.nIndexedHeight, &wtx));
+    wtx.nIndexedHeight = nHeight;
+    setTxByHeight.insert(std::make_pair(nHeight, &wtx));
+}
+
+// Add wtx's outputs to or remove them from mapOutputsByDestination
+void CWallet::IndexDestinations(const CWalletTx& wtx, bool fErase)
+{
+    AssertLockHeld(cs_wallet);
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
     {
-        txOrdered.insert(std::make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        CTxDestination address;
+        if (!ExtractDestination(wtx.vout[i].scriptPubKey, address))
+            continue;
+
+        if (!fErase)
+            mapOutputsByDestination[address].insert(std::make_pair(&wtx, i));
+        else
+        {
+            std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > >::iterator mi = mapOutputsByDestination.find(address);
+            if (mi == mapOutputsByDestination.end())
+                continue;
+            (*mi).second.erase(std::make_pair(&wtx, i));
+            if ((*mi).second.empty())
+                mapOutputsByDestination.erase(mi);
+        }
     }
+}
 
-    return txOrdered;
+void CWallet::ReindexTxOrder()
+{
+    LOCK2(cs_main, cs_wallet);
+    wtxOrdered.clear();
+    setTxByHeight.clear();
+    mapOutputsByDestination.clear();
+    for (std::map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        CWalletTx* wtx = &((*it).second);
+        wtxOrdered.insert(std::make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        IndexTxHeight(*wtx);
+        IndexDestinations(*wtx);
+    }
+
+    laccentries.clear();
+    if (fFileBacked)
+        CWalletDB(strWalletFile).ListAccountCreditDebit("*", laccentries);
+    for (CAccountingEntry& entry : laccentries)
+        wtxOrdered.insert(std::make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
@@ -388,6 +531,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
                 {
                     LogPrintf("WalletUpdateSpent found spent coin %s HONEY %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
                     wtx.MarkSpent(txin.prevout.n);
+                    IndexUnspent(wtx);
                     wtx.WriteToDisk();
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
@@ -405,6 +549,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
                 if (IsMine(txout))
                 {
                     wtx.MarkUnspent(&txout - &tx.vout[0]);
+                    IndexUnspent(wtx);
                     wtx.WriteToDisk();
                     NotifyTransactionChanged(this, hash, CT_UPDATED);
                 }
@@ -421,6 +566,43 @@ void CWallet::MarkDirty()
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
     }
+    // Outputs may have become ours (e.g. after a key import)
+    ReindexUnspent();
+}
+
+// Add wtx to or remove it from mapUnspentTx and setCoinsByValue after its
+// outputs' spent state changed.
+void CWallet::IndexUnspent(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    nWalletChanges++;
+
+    bool fUnspent = false;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        std::pair<int64_t, std::pair<const CWalletTx*, unsigned int> > coin = std::make_pair(wtx.vout[i].nValue, std::make_pair(&wtx, i));
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]))
+        {
+            setCoinsByValue.insert(coin);
+            fUnspent = true;
+        }
+        else
+            setCoinsByValue.erase(coin);
+    }
+
+    if (fUnspent)
+        mapUnspentTx[wtx.GetHash()] = &wtx;
+    else
+        mapUnspentTx.erase(wtx.GetHash());
+}
+
+void CWallet::ReindexUnspent()
+{
+    LOCK(cs_wallet);
+    mapUnspentTx.clear();
+    setCoinsByValue.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet)
+        IndexUnspent(item.second);
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn)
@@ -437,20 +619,20 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+            IndexDestinations(wtx);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
             {
-                if (mapBlockIndex.count(wtxIn.hashBlock))
+                if (const CBlockIndex* pindexBlock = LookupBlockIndex(wtxIn.hashBlock))
                 {
                     unsigned int latestNow = wtx.nTimeReceived;
                     unsigned int latestEntry = 0;
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -475,7 +657,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
                         }
                     }
 
-                    unsigned int& blocktime = mapBlockIndex[wtxIn.hashBlock]->nTime;
+                    unsigned int blocktime = pindexBlock->nTime;
                     wtx.nTimeSmart = std::max(latestEntry, std::min(blocktime, latestNow));
                 }
                 else
@@ -508,6 +690,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             fUpdated |= wtx.UpdateSpent(wtxIn.vfSpent);
         }
 
+        if (fInsertedNew || fUpdated)
+            IndexUnspent(wtx);
+        if (fInsertedNew || fUpdated || wtx.nIndexedHeight == -1)
+            IndexTxHeight(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -587,6 +774,11 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool
             if (IsFromMe(tx))
                 DisableTransaction(tx);
         }
+
+        LOCK(cs_wallet);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(tx.GetHash());
+        if (mi != mapWallet.end())
+            IndexTxHeight((*mi).second, false);
         return;
     }
 
@@ -599,12 +791,146 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            CWalletTx& wtx = (*mi).second;
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                setCoinsByValue.erase(std::make_pair(wtx.vout[i].nValue, std::make_pair(&wtx, i)));
+            setTxByHeight.erase(std::make_pair(wtx.nIndexedHeight, &wtx));
+            IndexDestinations(wtx, true);
+            std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+            for (TxItems::iterator it = range.first; it != range.second; ++it)
+                if ((*it).second.first == &wtx)
+                {
+                    wtxOrdered.erase(it);
+                    break;
+                }
+        }
+        mapUnspentTx.erase(hash);
+        nWalletChanges++;
         if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+            QueueTxErase(hash);
     }
     return;
 }
 
+// Transaction records are not written under cs_main: they are copied into a
+// queue that ThreadCommitWalletTx() commits in one database transaction, so
+// a block touching many wallet transactions costs one commit instead of one
+// per record. Callers that need the record on disk use FlushTxQueue().
+bool CWallet::QueueTxWrite(const CWalletTx& wtx) const
+{
+    if (!fFileBacked)
+        return false;
+    uint256 hash = wtx.GetHash();
+    {
+        LOCK(cs_txqueue);
+        setTxQueueErase.erase(hash);
+        std::map<uint256, CWalletTx>::iterator mi = mapTxQueueWrite.find(hash);
+        if (mi == mapTxQueueWrite.end())
+            mapTxQueueWrite.insert(std::make_pair(hash, wtx));
+        else
+            (*mi).second = wtx;
+    }
+    nWalletDBUpdated++;
+    return true;
+}
+
+void CWallet::QueueTxErase(const uint256& hash) const
+{
+    if (!fFileBacked)
+        return;
+    {
+        LOCK(cs_txqueue);
+        mapTxQueueWrite.erase(hash);
+        setTxQueueErase.insert(hash);
+    }
+    nWalletDBUpdated++;
+}
+
+bool CWallet::FlushTxQueue(bool fSync)
+{
+    if (!fFileBacked)
+        return true;
+
+    LOCK(cs_txcommit);
+    std::map<uint256, CWalletTx> mapWrite;
+    std::set<uint256> setErase;
+    {
+        LOCK(cs_txqueue);
+        mapWrite.swap(mapTxQueueWrite);
+        setErase.swap(setTxQueueErase);
+    }
+    if (mapWrite.empty() && setErase.empty())
+    {
+        if (fSync)
+            bitdb.dbenv.log_flush(nullptr);
+        return true;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    bool fOk = true;
+    {
+        CWalletDB walletdb(strWalletFile);
+        if (!walletdb.TxnBegin())
+            fOk = false;
+        for (std::set<uint256>::iterator it = setErase.begin(); fOk && it != setErase.end(); ++it)
+            walletdb.EraseTx(*it);
+        for (std::map<uint256, CWalletTx>::iterator mi = mapWrite.begin(); fOk && mi != mapWrite.end(); ++mi)
+            fOk = walletdb.WriteTx((*mi).first, (*mi).second);
+        if (fOk)
+            fOk = walletdb.TxnCommit();
+        else
+            walletdb.TxnAbort();
+    }
+
+    if (!fOk)
+    {
+        // Put the batch back behind anything queued meanwhile, which is newer
+        LOCK(cs_txqueue);
+        for (std::set<uint256>::iterator it = setErase.begin(); it != setErase.end(); ++it)
+            if (!mapTxQueueWrite.count(*it))
+                setTxQueueErase.insert(*it);
+        for (std::map<uint256, CWalletTx>::iterator mi = mapWrite.begin(); mi != mapWrite.end(); ++mi)
+            if (!setTxQueueErase.count((*mi).first))
+                mapTxQueueWrite.insert(*mi);
+        return error("CWallet::FlushTxQueue() : failed to commit %u wallet transactions", mapWrite.size() + setErase.size());
+    }
+
+    if (fSync)
+        bitdb.dbenv.log_flush(nullptr);
+    LogPrint("db", "Committed %u wallet transactions %dms\n", mapWrite.size() + setErase.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+
+// Pay-to-pubkey-hash, pay-to-script-hash and pay-to-pubkey outputs are matched
+// by their byte layout against the cached ID sets; anything else goes through
+// the generic Solver() based check.
+bool CWallet::IsMine(const CScript& scriptPubKey) const
+{
+    const unsigned int nSize = scriptPubKey.size();
+    {
+        LOCK(cs_KeyStore);
+        if (nSize == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+            scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+        {
+            uint160 id;
+            memcpy(id.begin(), &scriptPubKey[3], 20);
+            return setMineKeyIds.count(id);
+        }
+        if (scriptPubKey.IsPayToScriptHash())
+        {
+            uint160 id;
+            memcpy(id.begin(), &scriptPubKey[2], 20);
+            return setMineScriptIds.count(id);
+        }
+        if (((nSize == 35 && scriptPubKey[0] == 33) || (nSize == 67 && scriptPubKey[0] == 65)) && scriptPubKey[nSize - 1] == OP_CHECKSIG)
+            return setMineKeyIds.count(Hash160(scriptPubKey.begin() + 1, scriptPubKey.end() - 1));
+    }
+    return ::IsMine(*this, scriptPubKey);
+}
 
 bool CWallet::IsMine(const CTxIn &txin) const
 {
@@ -857,38 +1183,208 @@ void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
 
 bool CWalletTx::WriteToDisk()
 {
-    return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
+    return pwallet->QueueTxWrite(*this);
 }
 
+// Maximum number of threads reading blocks during a rescan
+static const int MAX_RESCAN_THREADS = 8;
+
+// Number of blocks read ahead per thread before matches are applied to the wallet
+static const int RESCAN_BLOCKS_PER_THREAD = 64;
+
+/** Key and script IDs of a wallet, to cheaply rule out transaction outputs that
+ *  cannot be ours while rescanning. Any output IsMine() accepts passes the filter. */
+class CRescanFilter
+{
+private:
+    std::unordered_set<uint160, CIdHasher> setIds;
+
+public:
+    void Add(const uint160& id) { setIds.insert(id); }
+
+    bool MayBeMine(const CScript& scriptPubKey) const
+    {
+        std::vector<valtype> vSolutions;
+        txnouttype whichType;
+        if (!Solver(scriptPubKey, whichType, vSolutions))
+            return false;
+
+        switch (whichType)
+        {
+        case TX_PUBKEY:
+            return setIds.count(CPubKey(vSolutions[0]).GetID());
+        case TX_PUBKEYHASH:
+        case TX_SCRIPTHASH:
+            return setIds.count(uint160(vSolutions[0]));
+        case TX_MULTISIG:
+            for (unsigned int i = 1; i + 1 < vSolutions.size(); i++)
+                if (setIds.count(CPubKey(vSolutions[i]).GetID()))
+                    return true;
+            return false;
+        default:
+            return false;
+        }
+    }
+};
+
+/** A block read by a rescan worker, with the transactions whose outputs may be ours */
+struct CRescanBlock
+{
+    CBlock block;
+    std::vector<char> vfMatch;
+};
+
+// Rescan worker: read the blocks vScan[nNext...nEnd) not yet taken by another
+// worker, and flag the transactions that pay to one of the filter's IDs.
+static void RescanBlocks(const std::vector<CBlockIndex*>& vScan, std::atomic<size_t>& nNext, size_t nBegin, size_t nEnd,
+                         const CRescanFilter& filter, std::vector<CRescanBlock>& vResult)
+{
+    size_t n;
+    while ((n = nNext++) < nEnd)
+    {
+        CRescanBlock& result = vResult[n - nBegin];
+        result.block.ReadFromDisk(vScan[n], true);
+        result.vfMatch.assign(result.block.vtx.size(), false);
+        for (unsigned int i = 0; i < result.block.vtx.size(); i++)
+        {
+            for (const CTxOut& txout : result.block.vtx[i].vout)
+            {
+                if (filter.MayBeMine(txout.scriptPubKey))
+                {
+                    result.vfMatch[i] = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Claims fScanningWallet for one rescan, and gives it back even if the scan throws
+class CRescanReserver
+{
+private:
+    std::atomic<bool>& fScanning;
+    bool fReserved;
+
+public:
+    explicit CRescanReserver(std::atomic<bool>& fScanningIn) : fScanning(fScanningIn)
+    {
+        bool fExpected = false;
+        fReserved = fScanning.compare_exchange_strong(fExpected, true);
+    }
+
+    ~CRescanReserver()
+    {
+        if (fReserved)
+            fScanning = false;
+    }
+
+    bool IsReserved() const { return fReserved; }
+};
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
+//
+// Blocks are read and prefiltered against the wallet's key and script IDs
+// in parallel, without holding any lock; cs_main and cs_wallet are only
+// taken to apply each batch of results. AbortRescan() stops the scan early.
+// Only one rescan runs at a time; a second one returns -1 without scanning.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    CRescanReserver reserver(fScanningWallet);
+    if (!reserver.IsReserved())
+    {
+        LogPrintf("ScanForWalletTransactions() : a rescan is already running\n");
+        return -1;
+    }
+    fAbortRescan = false;
+
     int ret = 0;
 
-    CBlockIndex* pindex = pindexStart;
+    std::vector<CBlockIndex*> vScan;
+    CRescanFilter filter;
     {
         LOCK2(cs_main, cs_wallet);
-        while (pindex)
+        for (CBlockIndex* pindex = pindexStart; pindex; pindex = pindex->pnext)
         {
             // no need to read and scan block, if block was created before
             // our wallet birthday (as adjusted for block time variability)
-            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200))) {
-                pindex = pindex->pnext;
+            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200)))
                 continue;
-            }
+            vScan.push_back(pindex);
+        }
 
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            for (CTransaction& tx : block.vtx)
+        std::set<CKeyID> setKeys;
+        GetKeys(setKeys);
+        for (const CKeyID& keyid : setKeys)
+            filter.Add(keyid);
+        {
+            LOCK(cs_KeyStore);
+            for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+                filter.Add((*it).first);
+        }
+    }
+    if (vScan.empty())
+        return 0;
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_RESCAN_THREADS));
+    size_t nBatch = nThreads * RESCAN_BLOCKS_PER_THREAD;
+    std::vector<CRescanBlock> vResult(std::min(nBatch, vScan.size()));
+    int64_t nStart = GetTimeMillis();
+    int64_t nLastProgress = nStart;
+
+    for (size_t nBegin = 0; nBegin < vScan.size(); nBegin += nBatch)
+    {
+        if (fAbortRescan || ShutdownRequested())
+        {
+            LogPrintf("Rescan aborted at block %d\n", vScan[nBegin]->nHeight);
+            break;
+        }
+
+        size_t nEnd = std::min(vScan.size(), nBegin + nBatch);
+        std::atomic<size_t> nNext(nBegin);
+        boost::thread_group threadRescan;
+        for (int i = 0; i < nThreads; i++)
+            threadRescan.create_thread(boost::bind(&RescanBlocks, boost::cref(vScan), boost::ref(nNext), nBegin, nEnd,
+                                                   boost::cref(filter), boost::ref(vResult)));
+        threadRescan.join_all();
+
+        {
+            LOCK2(cs_main, cs_wallet);
+            for (size_t n = nBegin; n < nEnd; n++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                // the block was read without cs_main and may have been disconnected since
+                if (!vScan[n]->IsInMainChain())
+                    continue;
+
+                CRescanBlock& result = vResult[n - nBegin];
+                for (unsigned int i = 0; i < result.block.vtx.size(); i++)
+                {
+                    const CTransaction& tx = result.block.vtx[i];
+
+                    // Beyond outputs to our keys, a transaction concerns us if we already
+                    // know it or it spends one of our transactions (found earlier in the scan).
+                    bool fRelevant = result.vfMatch[i] || mapWallet.count(tx.GetHash());
+                    for (unsigned int j = 0; j < tx.vin.size() && !fRelevant; j++)
+                        fRelevant = mapWallet.count(tx.vin[j].prevout.hash);
+                    if (!fRelevant)
+                        continue;
+
+                    if (AddToWalletIfInvolvingMe(tx, &result.block, fUpdate))
+                        ret++;
+                }
             }
-            pindex = pindex->pnext;
+        }
+
+        if (GetTimeMillis() - nLastProgress > 10000 || nEnd == vScan.size())
+        {
+            nLastProgress = GetTimeMillis();
+            LogPrintf("Rescan: %u of %u blocks (%d%%), %d transactions found, %dms\n", nEnd, vScan.size(),
+                      (int)(nEnd * 100 / vScan.size()), ret, nLastProgress - nStart);
         }
     }
+
     return ret;
 }
 
@@ -932,6 +1428,7 @@ void CWallet::ReacceptWalletTransactions()
                 {
                     LogPrintf("ReacceptWalletTransactions found spent coin %s HONEY %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
                     wtx.MarkDirty();
+                    IndexUnspent(wtx);
                     wtx.WriteToDisk();
                 }
             }
@@ -945,7 +1442,7 @@ void CWallet::ReacceptWalletTransactions()
         if (!vMissingTx.empty())
         {
             // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(pindexGenesisBlock))
+            if (ScanForWalletTransactions(pindexGenesisBlock) > 0)
                 fRepeat = true;  // Found missing transactions: re-do re-accept.
         }
     }
@@ -1037,86 +1534,150 @@ void CWallet::ResendWalletTransactions(bool fForce)
 //
 
 
-int64_t CWallet::GetBalance() const
+// Compute all balances in one pass over the transactions with unspent outputs of
+// ours, and keep them until the best chain or the wallet's spent state changes.
+void CWallet::CacheBalances() const
 {
-    int64_t nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fBalancesCached && hashBalancesBlock == hashBestChain && nBalancesChanges == nWalletChanges)
+        return;
+
+    nBalanceCached = 0;
+    nUnconfirmedBalanceCached = 0;
+    nImmatureBalanceCached = 0;
+    nStakeCached = 0;
+    nNewMintCached = 0;
+    for (std::map<uint256, const CWalletTx*>::const_iterator it = mapUnspentTx.begin(); it != mapUnspentTx.end(); ++it)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const CWalletTx* pcoin = (*it).second;
+        int nDepth = pcoin->GetDepthInMainChain();
+        bool fTrusted = pcoin->IsTrusted();
+
+        if (fTrusted)
+            nBalanceCached += pcoin->GetAvailableCredit();
+        if (!IsFinalTx(*pcoin) || (!fTrusted && nDepth == 0))
+            nUnconfirmedBalanceCached += pcoin->GetAvailableCredit();
+
+        if (nDepth > 0 && pcoin->GetBlocksToMaturity() > 0)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            if (pcoin->IsCoinBase())
+            {
+                nImmatureBalanceCached += GetCredit(*pcoin);
+                nNewMintCached += GetCredit(*pcoin);
+            }
+            else if (pcoin->IsCoinStake())
+                nStakeCached += GetCredit(*pcoin);
         }
     }
 
-    return nTotal;
+    hashBalancesBlock = hashBestChain;
+    nBalancesChanges = nWalletChanges;
+    fBalancesCached = true;
+}
+
+int64_t CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    CacheBalances();
+    return nBalanceCached;
 }
 
 int64_t CWallet::GetUnconfirmedBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    CacheBalances();
+    return nUnconfirmedBalanceCached;
 }
 
 int64_t CWallet::GetImmatureBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx& pcoin = (*it).second;
-            if (pcoin.IsCoinBase() && pcoin.GetBlocksToMaturity() > 0 && pcoin.IsInMainChain())
-                nTotal += GetCredit(pcoin);
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    CacheBalances();
+    return nImmatureBalanceCached;
 }
 
-// populate vCoins with vector of spendable COutputs
+// Depth of a wallet transaction whose unspent outputs can be spent now, -1 if
+// they can't
+static int GetAvailableDepth(const CWalletTx* pcoin, bool fOnlyConfirmed)
+{
+    if (!IsFinalTx(*pcoin))
+        return -1;
+
+    if (fOnlyConfirmed && !pcoin->IsTrusted())
+        return -1;
+
+    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+        return -1;
+
+    if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
+        return -1;
+
+    return pcoin->GetDepthInMainChain();
+}
+
+// populate vCoins with vector of spendable COutputs, largest value first
 void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl) const
 {
     vCoins.clear();
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vCoins.reserve(setCoinsByValue.size());
+        for (std::set<std::pair<int64_t, std::pair<const CWalletTx*, unsigned int> > >::const_reverse_iterator it = setCoinsByValue.rbegin(); it != setCoinsByValue.rend(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second.first;
+            unsigned int i = (*it).second.second;
 
-            if (!IsFinalTx(*pcoin))
-                continue;
+            if ((*it).first < nMinimumInputValue)
+                break;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
+            int nDepth = GetAvailableDepth(pcoin, fOnlyConfirmed);
+            if (nDepth < 0)
                 continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+            if (coinControl && coinControl->HasSelected() && !coinControl->IsSelected(pcoin->GetHash(), i))
                 continue;
 
-            if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            vCoins.push_back(COutput(pcoin, i, nDepth));
+        }
+    }
+}
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
+void CWallet::AvailableCoinsTo(const std::set<CTxDestination>& setDestinations, std::vector<COutput>& vCoins) const
+{
+    vCoins.clear();
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        for (const CTxDestination& dest : setDestinations)
+        {
+            std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > >::const_iterator mi = mapOutputsByDestination.find(dest);
+            if (mi == mapOutputsByDestination.end())
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+            for (const std::pair<const CWalletTx*, unsigned int>& output : (*mi).second)
+            {
+                const CWalletTx* pcoin = output.first;
+                unsigned int i = output.second;
+
+                // setCoinsByValue holds exactly our unspent outputs
+                if (pcoin->vout[i].nValue < nMinimumInputValue || !setCoinsByValue.count(std::make_pair(pcoin->vout[i].nValue, output)))
+                    continue;
 
+                int nDepth = GetAvailableDepth(pcoin, false);
+                if (nDepth < 0)
+                    continue;
+
+                vCoins.push_back(COutput(pcoin, i, nDepth));
+            }
         }
     }
+
+    // Largest value first, like AvailableCoins()
+    std::sort(vCoins.begin(), vCoins.end(), [](const COutput& a, const COutput& b) {
+        return a.tx->vout[a.i].nValue > b.tx->vout[b.i].nValue;
+    });
 }
 
 void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins) const
@@ -1125,9 +1686,9 @@ void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins) const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (std::map<uint256, const CWalletTx*>::const_iterator it = mapUnspentTx.begin(); it != mapUnspentTx.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             int nDepth = pcoin->GetDepthInMainChain();
             if (nDepth < 1)
@@ -1146,7 +1707,56 @@ void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins) const
     }
 }
 
-static void ApproximateBestSubset(std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > >vValue, int64_t nTotalLower, int64_t nTargetValue,
+// Maximum number of branches SelectCoinsBnB() explores before giving up
+static const int BNB_MAX_TRIES = 100000;
+
+// Coin visits ApproximateBestSubset() may spend in total, so that its
+// iterations shrink as the number of candidate coins grows
+static const int64_t APPROXIMATE_MAX_VISITS = 2000000;
+
+// Depth-first search over vValue, sorted by descending value, for a subset
+// adding up to exactly nTargetValue. Branches that overshoot the target or
+// cannot reach it with the remaining coins are cut off, and coins equal to
+// an omitted one are omitted too since they would only repeat its branch.
+static bool SelectCoinsBnB(const std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > >& vValue, int64_t nTotalLower, int64_t nTargetValue,
+                           std::vector<char>& vfBest)
+{
+    std::vector<char> vfIncluded(vValue.size(), false);
+    int64_t nSelected = 0;
+    int64_t nRemaining = nTotalLower; // value of the coins from i on, not decided yet
+    unsigned int i = 0;
+
+    for (int nTries = 0; nTries < BNB_MAX_TRIES; nTries++)
+    {
+        if (nSelected == nTargetValue)
+        {
+            vfBest = vfIncluded;
+            return true;
+        }
+
+        if (nSelected > nTargetValue || nSelected + nRemaining < nTargetValue)
+        {
+            // Backtrack to the last included coin and omit it instead
+            while (i > 0 && !vfIncluded[i - 1])
+                nRemaining += vValue[--i].first;
+            if (i == 0)
+                return false;
+            vfIncluded[i - 1] = false;
+            nSelected -= vValue[i - 1].first;
+            while (i < vValue.size() && vValue[i].first == vValue[i - 1].first)
+                nRemaining -= vValue[i++].first;
+        }
+        else
+        {
+            nSelected += vValue[i].first;
+            nRemaining -= vValue[i].first;
+            vfIncluded[i++] = true;
+        }
+    }
+    return false;
+}
+
+static void ApproximateBestSubset(const std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > >& vValue, int64_t nTotalLower, int64_t nTargetValue,
                                   std::vector<char>& vfBest, int64_t& nBest, int iterations = 1000)
 {
     std::vector<char> vfIncluded;
@@ -1195,31 +1805,21 @@ static void ApproximateBestSubset(std::vector<std::pair<int64_t, std::pair<const
 // ppcoin: total coins staked (non-spendable until maturity)
 int64_t CWallet::GetStake() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    }
-    return nTotal;
+    CacheBalances();
+    return nStakeCached;
 }
 
 int64_t CWallet::GetNewMint() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    }
-    return nTotal;
+    CacheBalances();
+    return nNewMintCached;
 }
 
-bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
+// vCoins is expected largest value first, as AvailableCoins() returns it;
+// other orders are sorted here.
+bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -1231,9 +1831,11 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
     std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > > vValue;
     int64_t nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Among equally good coins one is picked at random
+    std::pair<const CWalletTx*,unsigned int> coinExact(nullptr, 0);
+    int nExact = 0, nLowestLarger = 0;
 
-    for (COutput output : vCoins)
+    for (const COutput& output : vCoins)
     {
         const CWalletTx *pcoin = output.tx;
 
@@ -1252,9 +1854,8 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
 
         if (n == nTargetValue)
         {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            return true;
+            if (GetRandInt(++nExact) == 0)
+                coinExact = coin.second;
         }
         else if (n < nTargetValue + CENT)
         {
@@ -1262,11 +1863,23 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
             nTotalLower += n;
         }
         else if (n < coinLowestLarger.first)
+        {
+            coinLowestLarger = coin;
+            nLowestLarger = 1;
+        }
+        else if (n == coinLowestLarger.first && GetRandInt(++nLowestLarger) == 0)
         {
             coinLowestLarger = coin;
         }
     }
 
+    if (nExact)
+    {
+        setCoinsRet.insert(coinExact);
+        nValueRet += nTargetValue;
+        return true;
+    }
+
     if (nTotalLower == nTargetValue)
     {
         for (unsigned int i = 0; i < vValue.size(); ++i)
@@ -1286,14 +1899,30 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    if (!std::is_sorted(vValue.rbegin(), vValue.rend(), CompareValueOnly()))
+        sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+    // Shuffle runs of equal values so that which of them get spent isn't predictable
+    for (unsigned int i = 0, j; i < vValue.size(); i = j)
+    {
+        for (j = i + 1; j < vValue.size() && vValue[j].first == vValue[i].first; j++);
+        if (j - i > 1)
+            random_shuffle(vValue.begin() + i, vValue.begin() + j, GetRandInt);
+    }
+
+    // An exact match needs no change output at all
     std::vector<char> vfBest;
     int64_t nBest;
-
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    if (SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest))
+        nBest = nTargetValue;
+    else
+    {
+        // Solve subset sum by stochastic approximation
+        int nIterations = std::max((int64_t)10, std::min((int64_t)1000, APPROXIMATE_MAX_VISITS / (int64_t)vValue.size()));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1321,15 +1950,14 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
     return true;
 }
 
-bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const std::vector<COutput>& vAvailable, int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl) const
 {
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected())
     {
-        for (const COutput& out : vCoins)
+        setCoinsRet.clear();
+        nValueRet = 0;
+        for (const COutput& out : vAvailable)
         {
             nValueRet += out.tx->vout[out.i].nValue;
             setCoinsRet.insert(std::make_pair(out.tx, out.i));
@@ -1337,11 +1965,9 @@ bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::se
         return (nValueRet >= nTargetValue);
     }
 
-    std::function<bool (const CWallet*, int64_t, unsigned int, int, int, std::vector<COutput>, std::set<std::pair<const CWalletTx*,unsigned int> >&, int64_t&)> f = &CWallet::SelectCoinsMinConf;
-
-    return (f(this, nTargetValue, nSpendTime, 1, 10, vCoins, setCoinsRet, nValueRet) ||
-            f(this, nTargetValue, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            f(this, nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet));
+    return (SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 10, vAvailable, setCoinsRet, nValueRet) ||
+            SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 1, vAvailable, setCoinsRet, nValueRet) ||
+            SelectCoinsMinConf(nTargetValue, nSpendTime, 0, 1, vAvailable, setCoinsRet, nValueRet));
 }
 
 // Select some coins without random shuffle or best subset approximation
@@ -1427,10 +2053,16 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
         CTxDB txdb("r");
         {
             nFeeRet = nTransactionFee;
+
+            // The candidates stay the same while the fee is adjusted
+            std::vector<COutput> vAvailable;
+            AvailableCoins(vAvailable, true, coinControl);
+
             while (true)
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.InvalidateHash();
                 wtxNew.fFromMe = true;
 
                 int64_t nTotalValue = nValue + nFeeRet;
@@ -1441,7 +2073,7 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                 // Choose coins to use
                 std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
                 int64_t nValueIn = 0;
-                if (!SelectCoins(nTotalValue, wtxNew.nTime, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailable, nTotalValue, wtxNew.nTime, setCoins, nValueIn, coinControl))
                     return false;
 
                 int64_t nChange = nValueIn - nValue - nFeeRet;
@@ -1492,10 +2124,12 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                                               std::numeric_limits<unsigned int>::max()-1));
 
                 // Sign
-                int nIn = 0;
+                std::vector<CScript> vFromPubKey;
+                vFromPubKey.reserve(setCoins.size());
                 for (const std::pair<const CWalletTx*,unsigned int>& coin : setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
-                        return false;
+                    vFromPubKey.push_back(coin.first->vout[coin.second].scriptPubKey);
+                if (!SignSignatures(*this, vFromPubKey, wtxNew))
+                    return false;
 
                 // Limit size
                 unsigned int nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -1515,6 +2149,7 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                 // Fill vtxPrev by copying from previous transactions vtxPrev
                 wtxNew.AddSupportingTransactions(txdb);
                 wtxNew.fTimeReceivedIsTxTime = true;
+                wtxNew.UpdateHash();
 
                 break;
             }
@@ -1569,6 +2204,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
     txNew.vin.clear();
     txNew.vout.clear();
+    txNew.InvalidateHash();
 
     // Mark coin stake transaction
     CScript scriptEmpty;
@@ -1673,6 +2309,14 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
 
+    int64_t nCombineThreshold, nSplitThreshold, nCombineMinAge, nMaxSplit;
+    GetStakeThresholds(nBalance - nReserveBalance, nCombineThreshold, nSplitThreshold);
+    {
+        LOCK(cs_stakeconfig);
+        nCombineMinAge = nStakeCombineMinAge;
+        nMaxSplit = nStakeSplitOutputs;
+    }
+
     for (std::pair<const CWalletTx*, unsigned int> pcoin : setCoins)
     {
         // Attempt to add more inputs
@@ -1687,7 +2331,10 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             if (nCredit + pcoin.first->vout[pcoin.second].nValue > nBalance - nReserveBalance)
                 break;
             // Do not add additional significant input
-            if (pcoin.first->vout[pcoin.second].nValue >= GetStakeCombineThreshold())
+            if (pcoin.first->vout[pcoin.second].nValue >= nCombineThreshold)
+                continue;
+            // Nor recently received ones
+            if (pcoin.first->nTime + nCombineMinAge > txNew.nTime)
                 continue;
 
             txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
@@ -1705,25 +2352,30 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         nCredit += nReward;
     }
 
-    if (nCredit >= GetStakeSplitThreshold())
-        txNew.vout.push_back(CTxOut(0, txNew.vout[1].scriptPubKey)); //split stake
+    // Split stake in two, or into up to -stakesplitoutputs outputs of at least
+    // half the split threshold, which also keeps them above the combine threshold
+    int64_t nSplit = 1;
+    if (nCredit >= nSplitThreshold)
+        nSplit = std::max((int64_t)1, std::min(nCredit / (nSplitThreshold / 2), nMaxSplit));
+    for (int64_t i = 1; i < nSplit; i++)
+        txNew.vout.push_back(CTxOut(0, txNew.vout[1].scriptPubKey));
 
     // Set output amount
-    if (txNew.vout.size() == 3)
+    int64_t nRemaining = nCredit;
+    for (unsigned int i = 1; i + 1 < txNew.vout.size(); i++)
     {
-        txNew.vout[1].nValue = (nCredit / 2 / CENT) * CENT;
-        txNew.vout[2].nValue = nCredit - txNew.vout[1].nValue;
+        txNew.vout[i].nValue = (nCredit / nSplit / CENT) * CENT;
+        nRemaining -= txNew.vout[i].nValue;
     }
-    else
-        txNew.vout[1].nValue = nCredit;
+    txNew.vout.back().nValue = nRemaining;
 
     // Sign
-    int nIn = 0;
-    for (const CWalletTx* pcoin : vwtxPrev)
-    {
-        if (!SignSignature(*this, *pcoin, txNew, nIn++))
-            return error("CreateCoinStake : failed to sign coinstake");
-    }
+    std::vector<CScript> vFromPubKey;
+    vFromPubKey.reserve(txNew.vin.size());
+    for (unsigned int i = 0; i < txNew.vin.size(); i++)
+        vFromPubKey.push_back(vwtxPrev[i]->vout[txNew.vin[i].prevout.n].scriptPubKey);
+    if (!SignSignatures(*this, vFromPubKey, txNew))
+        return error("CreateCoinStake : failed to sign coinstake");
 
     // Limit size
     unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -1731,9 +2383,96 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         return error("CreateCoinStake : exceeded coinstake size limit");
 
     // Successfully generated coinstake
+    txNew.UpdateHash();
     return true;
 }
 
+// Spend small stake outputs of one address back to it in one transaction, so
+// that the staker has fewer kernels to check. Called by the stake miner when
+// it found nothing to stake; runs at most every STAKE_CONSOLIDATE_INTERVAL.
+bool CWallet::ConsolidateStakeOutputs()
+{
+    bool fConsolidate;
+    int64_t nCombineMinAge;
+    {
+        LOCK(cs_stakeconfig);
+        fConsolidate = fStakeConsolidate;
+        nCombineMinAge = nStakeCombineMinAge;
+    }
+
+    // Unlocked for staking only means no spending the user didn't ask for
+    if (!fConsolidate || IsLocked() || fWalletUnlockStakingOnly || IsInitialBlockDownload())
+        return false;
+
+    int64_t nNow = GetAdjustedTime();
+    if (nNow - nLastStakeConsolidation < STAKE_CONSOLIDATE_INTERVAL)
+        return false;
+    nLastStakeConsolidation = nNow;
+
+    LOCK2(cs_main, cs_wallet);
+
+    int64_t nCombineThreshold, nSplitThreshold;
+    GetStakeThresholds(GetBalance() - nReserveBalance, nCombineThreshold, nSplitThreshold);
+
+    std::vector<COutput> vCoins;
+    AvailableCoinsForStaking(vCoins);
+
+    std::map<CScript, std::vector<COutput> > mapSmall;
+    for (const COutput& out : vCoins)
+    {
+        const CTxOut& txout = out.tx->vout[out.i];
+        if (txout.nValue < nCombineThreshold && out.tx->nTime + nCombineMinAge <= nNow)
+            mapSmall[txout.scriptPubKey].push_back(out);
+    }
+
+    const CScript* pscript = nullptr;
+    for (std::map<CScript, std::vector<COutput> >::const_iterator it = mapSmall.begin(); it != mapSmall.end(); ++it)
+        if ((*it).second.size() >= STAKE_CONSOLIDATE_MIN_INPUTS && (!pscript || (*it).second.size() > mapSmall[*pscript].size()))
+            pscript = &(*it).first;
+    if (!pscript)
+        return false;
+
+    // Smallest first, without producing an output that would be split again
+    std::vector<COutput>& vSmall = mapSmall[*pscript];
+    std::sort(vSmall.begin(), vSmall.end(), [](const COutput& a, const COutput& b) {
+        return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+    });
+    CCoinControl coinControl;
+    int64_t nTotal = 0;
+    unsigned int nInputs = 0;
+    for (const COutput& out : vSmall)
+    {
+        if (nInputs >= STAKE_CONSOLIDATE_MAX_INPUTS || nTotal + out.tx->vout[out.i].nValue >= nSplitThreshold)
+            break;
+        COutPoint outpt(out.tx->GetHash(), out.i);
+        coinControl.Select(outpt);
+        nTotal += out.tx->vout[out.i].nValue;
+        nInputs++;
+    }
+    if (nInputs < STAKE_CONSOLIDATE_MIN_INPUTS)
+        return false;
+
+    // The fee comes out of the consolidated amount; retry once it is known
+    CWalletTx wtx;
+    CReserveKey reservekey(this);
+    int64_t nFee = nTransactionFee;
+    for (int nTry = 0; nTry < 3 && nFee < nTotal; nTry++)
+    {
+        int64_t nFeeRequired = 0;
+        if (CreateTransaction(*pscript, nTotal - nFee, wtx, reservekey, nFeeRequired, &coinControl))
+        {
+            if (!CommitTransaction(wtx, reservekey))
+                return false;
+            LogPrint("coinstake", "ConsolidateStakeOutputs : combined %u outputs worth %s in %s\n", nInputs, FormatMoney(nTotal), wtx.GetHash().ToString());
+            return true;
+        }
+        if (nFeeRequired <= nFee)
+            break;
+        nFee = nFeeRequired;
+    }
+    LogPrint("coinstake", "ConsolidateStakeOutputs : failed to create transaction spending %u outputs\n", nInputs);
+    return false;
+}
 
 // Call after CreateTransaction unless you want to abort
 bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
@@ -1761,6 +2500,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 CWalletTx &coin = mapWallet[txin.prevout.hash];
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
+                IndexUnspent(coin);
                 coin.WriteToDisk();
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
@@ -1769,6 +2509,10 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 delete pwalletdb;
         }
 
+        // The spend must be on disk before it is broadcast
+        if (!FlushTxQueue(true))
+            LogPrintf("CommitTransaction() : Error: Failed to write transaction to wallet\n");
+
         // Track how many getdata requests our transaction gets
         mapRequestCount[wtxNew.GetHash()] = 0;
 
@@ -1866,6 +2610,10 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    RebuildMineCache();
+    ReindexUnspent();
+    ReindexTxOrder();
+
     return DB_LOAD_OK;
 }
 
@@ -1928,49 +2676,175 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64_t nKeys = std::max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
+        if (!TopUpKeyPool())
+            return false;
+        LogPrintf("CWallet::NewKeyPool wrote %u new keys\n", setKeyPool.size());
+    }
+    return true;
+}
+
+// Maximum number of threads generating keypool keys
+static const int MAX_KEYGEN_THREADS = 8;
+
+static void MakeNewKeys(std::vector<CKey>& vKeys, std::atomic<size_t>& nNext, bool fCompressed)
+{
+    for (size_t n = nNext++; n < vKeys.size(); n = nNext++)
+        vKeys[n].MakeNewKey(fCompressed);
+}
+
+// Add freshly generated keys to the keystore and the end of the keypool,
+// writing keys and pool entries in one database transaction
+bool CWallet::AddKeyPoolKeys(const std::vector<CKey>& vKeys)
+{
+    AssertLockHeld(cs_wallet);
+    if (IsLocked())
+        return false;
+
+    // Compressed public keys were introduced in version 0.6.0
+    if (CanSupportFeature(FEATURE_COMPRPUBKEY))
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile) : nullptr;
+    if (pwalletdb && !pwalletdb->TxnBegin())
+    {
+        delete pwalletdb;
+        return false;
+    }
+    pwalletdbBatch = pwalletdb;
+
+    int64_t nEnd = setKeyPool.empty() ? 1 : *setKeyPool.rbegin() + 1;
+    int64_t nCreationTime = GetTime();
+    bool fOk = true;
+    unsigned int nAdded = 0;
+    for (; nAdded < vKeys.size() && fOk; nAdded++)
+    {
+        CPubKey pubkey = vKeys[nAdded].GetPubKey();
+        mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
+        fOk = AddKeyPubKey(vKeys[nAdded], pubkey);
+        if (fOk && pwalletdb)
+            fOk = pwalletdb->WritePool(nEnd + nAdded, CKeyPool(pubkey));
+    }
+
+    pwalletdbBatch = nullptr;
+    if (pwalletdb)
+    {
+        if (fOk)
+            fOk = pwalletdb->TxnCommit();
+        else
+            pwalletdb->TxnAbort();
+        delete pwalletdb;
+    }
+    if (!fOk)
+    {
+        // Nothing was written, so the keys must not stay in memory either
+        for (unsigned int i = 0; i < nAdded; i++)
         {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
+            CKeyID keyid = vKeys[i].GetPubKey().GetID();
+            RemoveKey(keyid);
+            mapKeyMetadata.erase(keyid);
         }
-        LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
+        RebuildMineCache();
+        return false;
     }
+
+    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+        nTimeFirstKey = nCreationTime;
+
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        setKeyPool.insert(nEnd + i);
+    LogPrintf("keypool added keys %d-%d, size=%u\n", nEnd, nEnd + vKeys.size() - 1, setKeyPool.size());
     return true;
 }
 
+// Keys are generated in batches on several threads without holding cs_wallet
+// (unless the caller does), then added and written one batch at a time.
 bool CWallet::TopUpKeyPool(unsigned int nSize)
 {
-    {
-        LOCK(cs_wallet);
-
-        if (IsLocked())
-            return false;
+    unsigned int nTargetSize;
+    if (nSize > 0)
+        nTargetSize = nSize;
+    else
+        nTargetSize = std::max(GetArg("-keypool", 100), (int64_t)0);
 
-        CWalletDB walletdb(strWalletFile);
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_KEYGEN_THREADS));
+    while (true)
+    {
+        unsigned int nMissing;
+        bool fCompressed;
+        {
+            LOCK(cs_wallet);
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() >= nTargetSize + 1)
+                break;
+            nMissing = nTargetSize + 1 - setKeyPool.size();
+            fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+        }
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (nSize > 0)
-            nTargetSize = nSize;
+        RandAddSeedPerfmon();
+        std::vector<CKey> vKeys(std::min(nMissing, KEYPOOL_BATCH_SIZE));
+        std::atomic<size_t> nNext(0);
+        if (nThreads == 1 || vKeys.size() < 2)
+            MakeNewKeys(vKeys, nNext, fCompressed);
         else
-            nTargetSize = std::max(GetArg("-keypool", 100), (int64_t)0);
+        {
+            // The workers write to vKeys and nNext, so they must all be joined
+            // before an interruption at shutdown may unwind this frame
+            {
+                boost::this_thread::disable_interruption di;
+                boost::thread_group threadKeyGen;
+                try
+                {
+                    for (int i = 0; i < nThreads; i++)
+                        threadKeyGen.create_thread(boost::bind(&MakeNewKeys, boost::ref(vKeys), boost::ref(nNext), fCompressed));
+                }
+                catch (...)
+                {
+                    threadKeyGen.join_all();
+                    throw;
+                }
+                threadKeyGen.join_all();
+            }
+            boost::this_thread::interruption_point();
+        }
 
-        while (setKeyPool.size() < (nTargetSize + 1))
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw std::runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            LOCK(cs_wallet);
+            // Another refill may have run meanwhile
+            if (setKeyPool.size() >= nTargetSize + 1)
+                break;
+            if (IsLocked())
+                return false;
+            if (!AddKeyPoolKeys(vKeys))
+                throw std::runtime_error("TopUpKeyPool() : writing generated keys failed");
         }
     }
     return true;
 }
 
+void ThreadKeyPoolRefill(CWallet* pwallet)
+{
+    RenameThread("honey-keypool");
+
+    while (true)
+    {
+        MilliSleep(100);
+        if (!pwallet->KeyPoolRefillRequested())
+            continue;
+
+        // Failing to write keys is reported when the pool runs dry, it must
+        // not take the node down from here
+        try
+        {
+            pwallet->TopUpKeyPool();
+        }
+        catch (std::exception& e)
+        {
+            PrintExceptionContinue(&e, "ThreadKeyPoolRefill()");
+        }
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -1978,13 +2852,18 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
+        // Only an empty pool is refilled here, otherwise the background
+        // refill takes over once the low-water mark is reached
+        if (setKeyPool.empty() && !IsLocked())
             TopUpKeyPool();
 
         // Get the oldest key
         if(setKeyPool.empty())
             return;
 
+        if (setKeyPool.size() <= (uint64_t)std::max(GetArg("-keypool", 100), (int64_t)0) / 2 + 1)
+            RequestKeyPoolRefill();
+
         CWalletDB walletdb(strWalletFile);
 
         nIndex = *(setKeyPool.begin());
@@ -2219,6 +3098,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly)
                 {
                     pcoin->MarkUnspent(n);
+                    IndexUnspent(*pcoin);
                     pcoin->WriteToDisk();
                 }
             }
@@ -2231,6 +3111,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly)
                 {
                     pcoin->MarkSpent(n);
+                    IndexUnspent(*pcoin);
                     pcoin->WriteToDisk();
                 }
             }
@@ -2254,6 +3135,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             if (txin.prevout.n < prev.vout.size() && IsMine(prev.vout[txin.prevout.n]))
             {
                 prev.MarkUnspent(txin.prevout.n);
+                IndexUnspent(prev);
                 prev.WriteToDisk();
             }
         }
@@ -7,7 +7,9 @@
 
 #include <walletdb.h>
 
+#include <atomic>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <stdlib.h>
@@ -27,13 +29,52 @@ extern int64_t nMinimumInputValue;
 extern bool fWalletUnlockStakingOnly;
 extern bool fConfChange;
 
+// Stake output management; setstakingconfig changes these while the stake
+// miner reads them, so both sides hold cs_stakeconfig
+extern CCriticalSection cs_stakeconfig;
+extern int64_t nStakeCombineThreshold;
+extern int64_t nStakeSplitThreshold;
+extern int64_t nStakeCombineMinAge;
+extern unsigned int nStakeTargetOutputs;
+extern unsigned int nStakeSplitOutputs;
+extern bool fStakeConsolidate;
+
+static const int64_t DEFAULT_STAKE_COMBINE_THRESHOLD = 500 * COIN;
+static const int64_t DEFAULT_STAKE_SPLIT_THRESHOLD = 1000 * COIN;
+/** Number of stake outputs the thresholds are raised towards for large balances, 0 = off */
+static const unsigned int DEFAULT_STAKE_TARGET_OUTPUTS = 0;
+/** Largest -staketargetoutputs, beyond which outputs get too small to stake */
+static const unsigned int MAX_STAKE_TARGET_OUTPUTS = 1000;
+/** Number of outputs a coinstake above the split threshold is split into */
+static const unsigned int DEFAULT_STAKE_SPLIT_OUTPUTS = 2;
+/** Largest -stakesplitoutputs */
+static const unsigned int MAX_STAKE_SPLIT_OUTPUTS = 8;
+
+/** Thresholds are usable if splits stay above the combine threshold */
+inline bool ValidStakeThresholds(int64_t nCombine, int64_t nSplit) { return nCombine >= 0 && nSplit >= COIN && nSplit >= 2 * nCombine; }
+/** Combine and split thresholds in effect for a stakeable balance */
+void GetStakeThresholds(int64_t nStakeable, int64_t& nCombineRet, int64_t& nSplitRet);
+
+// Keys generated per keypool batch, written in one database transaction
+static const unsigned int KEYPOOL_BATCH_SIZE = 250;
+
 class CAccountingEntry;
 class CCoinControl;
+class CWallet;
 class CWalletTx;
 class CReserveKey;
 class COutput;
 class CWalletDB;
 
+// Refill the keypool in the background once it drops below its low-water mark
+void ThreadKeyPoolRefill(CWallet* pwallet);
+
+/** Hasher for key and script IDs, which are uniformly distributed already */
+struct CIdHasher
+{
+    size_t operator()(const uint160& id) const { return id.GetLow64(); }
+};
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -79,9 +120,16 @@ class CWallet : public CCryptoKeyStore, public CWalletInterface
 {
 private:
     bool SelectCoinsForStaking(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
-    bool SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl=nullptr) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailable, int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl=nullptr) const;
 
     CWalletDB *pwalletdbEncryption;
+    // open batch that AddKeyPubKey()/AddCryptedKey() write to, set by AddKeyPoolKeys()
+    CWalletDB *pwalletdbBatch;
+
+    // set when the keypool fell below its low-water mark or the wallet was unlocked
+    std::atomic<bool> fKeyPoolRefill;
+
+    bool AddKeyPoolKeys(const std::vector<CKey>& vKeys);
 
     // the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -89,6 +137,45 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // number of changes to the spent state of wallet transactions, used to invalidate cached balances
+    uint64_t nWalletChanges;
+
+    // balances computed by CacheBalances(), valid while hashBestChain and nWalletChanges stay the same
+    mutable bool fBalancesCached;
+    mutable uint256 hashBalancesBlock;
+    mutable uint64_t nBalancesChanges;
+    mutable int64_t nBalanceCached;
+    mutable int64_t nUnconfirmedBalanceCached;
+    mutable int64_t nImmatureBalanceCached;
+    mutable int64_t nStakeCached;
+    mutable int64_t nNewMintCached;
+
+    void CacheBalances() const;
+
+    // key and script IDs IsMine() accepts, so standard outputs are classified
+    // without running Solver() (protected by cs_KeyStore)
+    std::unordered_set<uint160, CIdHasher> setMineKeyIds;
+    std::unordered_set<uint160, CIdHasher> setMineScriptIds;
+
+    void CacheMineKey(const CKeyID& keyid);
+    void CacheMineScript(const CScript& redeemScript);
+
+    // time of the last ConsolidateStakeOutputs() attempt
+    int64_t nLastStakeConsolidation;
+
+    // Transaction records waiting to be committed to wallet.dat by FlushTxQueue(),
+    // coalesced per hash so a transaction touched several times in a block is
+    // written once (protected by cs_txqueue)
+    mutable CCriticalSection cs_txqueue;
+    mutable std::map<uint256, CWalletTx> mapTxQueueWrite;
+    mutable std::set<uint256> setTxQueueErase;
+    // held while a batch is written, so a barrier waits for a commit in flight
+    CCriticalSection cs_txcommit;
+
+    // set while ScanForWalletTransactions runs, and to ask it to stop early
+    std::atomic<bool> fScanningWallet;
+    std::atomic<bool> fAbortRescan;
+
 public:
     /// Main wallet lock.
     /// This lock protects all the fields added by CWallet
@@ -126,11 +213,28 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = nullptr;
+        pwalletdbBatch = nullptr;
+        fKeyPoolRefill = false;
         nOrderPosNext = 0;
         nTimeFirstKey = 0;
+        nWalletChanges = 0;
+        fBalancesCached = false;
+        fScanningWallet = false;
+        fAbortRescan = false;
+        nLastStakeConsolidation = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
+
+    // Wallet transactions with at least one unspent output of ours, in the same
+    // order as mapWallet. Balances and coin listings only need to look at these.
+    std::map<uint256, const CWalletTx*> mapUnspentTx;
+    // The same unspent outputs of ours ordered by value, so coin selection
+    // starts from a sorted pool instead of sorting every candidate set
+    std::set<std::pair<int64_t, std::pair<const CWalletTx*, unsigned int> > > setCoinsByValue;
+    // Every output of a wallet transaction, ours or not, by the destination it
+    // pays to, so per-address queries don't have to walk mapWallet
+    std::map<CTxDestination, std::set<std::pair<const CWalletTx*, unsigned int> > > mapOutputsByDestination;
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -144,7 +248,9 @@ public:
 
     void AvailableCoinsForStaking(std::vector<COutput>& vCoins) const;
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl=nullptr) const;
-    bool SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
+    // AvailableCoins(vCoins, false) restricted to outputs paying one of setDestinations
+    void AvailableCoinsTo(const std::set<CTxDestination>& setDestinations, std::vector<COutput>& vCoins) const;
+    bool SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
 
     // keystore implementation
     // Generate a new key
@@ -152,7 +258,7 @@ public:
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     // Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
 
@@ -164,6 +270,8 @@ public:
     bool LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript);
     bool LoadCScript(const CScript& redeemScript);
+    // Recompute the IsMine() ID sets from the keystore (after LoadWallet)
+    void RebuildMineCache();
 
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
@@ -180,19 +288,35 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
 
-    /** Get the wallet's activity log
-        @return std::multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
-     */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    // The wallet's activity log: transactions and accounting entries by nOrderPos
+    TxItems wtxOrdered;
+    std::list<CAccountingEntry> laccentries;
+
+    // Wallet transactions by the height of their block, -1 if not in the main chain
+    std::set<std::pair<int, CWalletTx*> > setTxByHeight;
+
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    void IndexTxHeight(CWalletTx& wtx, bool fInMainChain = true);
+    void IndexDestinations(const CWalletTx& wtx, bool fErase = false);
+    // Rebuild the activity log, height and destination indexes (after LoadWallet)
+    void ReindexTxOrder();
 
     void MarkDirty();
+    void IndexUnspent(const CWalletTx& wtx);
+    void ReindexUnspent();
     bool AddToWallet(const CWalletTx& wtxIn);
+    bool QueueTxWrite(const CWalletTx& wtx) const;
+    void QueueTxErase(const uint256& hash) const;
+    // Commit queued transaction records in one database transaction; with
+    // fSync the log is flushed to disk before returning
+    bool FlushTxQueue(bool fSync = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect = true);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
     void WalletUpdateSpent(const CTransaction& prevout, bool fBlock = false);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsScanning() const { return fScanningWallet; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(bool fForce = false);
     int64_t GetBalance() const;
@@ -206,12 +330,15 @@ public:
 
     uint64_t GetStakeWeight() const;
     bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key);
+    bool ConsolidateStakeOutputs();
 
     std::string SendMoney(CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, bool fAskFee=false);
     std::string SendMoneyToDestination(const CTxDestination &address, int64_t nValue, CWalletTx& wtxNew, bool fAskFee=false);
 
     bool NewKeyPool();
     bool TopUpKeyPool(unsigned int nSize = 0);
+    void RequestKeyPoolRefill() { fKeyPoolRefill = true; }
+    bool KeyPoolRefillRequested() { return fKeyPoolRefill.exchange(false); }
     int64_t AddReserveKey(const CKeyPool& keypool);
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
@@ -225,9 +352,10 @@ public:
 
     bool IsMine(const CTxIn& txin) const;
     int64_t GetDebit(const CTxIn& txin) const;
+    bool IsMine(const CScript& scriptPubKey) const;
     bool IsMine(const CTxOut& txout) const
     {
-        return ::IsMine(*this, txout.scriptPubKey);
+        return IsMine(txout.scriptPubKey);
     }
     int64_t GetCredit(const CTxOut& txout) const
     {
@@ -405,6 +533,7 @@ public:
     int64_t nOrderPos;  // position in ordered transaction list
 
     // memory only
+    int nIndexedHeight; // key in CWallet::setTxByHeight
     mutable bool fDebitCached;
     mutable bool fCreditCached;
     mutable bool fAvailableCreditCached;
@@ -455,6 +584,7 @@ public:
         nAvailableCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        nIndexedHeight = -1;
     }
 
     IMPLEMENT_SERIALIZE
@@ -717,10 +717,27 @@ void ThreadFlushWalletDB(const std::string& strFile)
     }
 }
 
-bool BackupWallet(const CWallet& wallet, const std::string& strDest)
+// Commit queued wallet transaction records in the background, at most
+// every WALLET_TX_COMMIT_INTERVAL milliseconds
+static const int WALLET_TX_COMMIT_INTERVAL = 250;
+
+void ThreadCommitWalletTx(CWallet* pwallet)
+{
+    RenameThread("honey-wallettx");
+
+    while (true)
+    {
+        MilliSleep(WALLET_TX_COMMIT_INTERVAL);
+        pwallet->FlushTxQueue();
+    }
+}
+
+bool BackupWallet(CWallet& wallet, const std::string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    if (!wallet.FlushTxQueue(true))
+        return false;
     while (true)
     {
         {
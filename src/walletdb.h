@@ -119,6 +119,7 @@ public:
     static bool Recover(CDBEnv& dbenv, std::string filename);
 };
 
-bool BackupWallet(const CWallet& wallet, const std::string& strDest);
+bool BackupWallet(CWallet& wallet, const std::string& strDest);
+void ThreadCommitWalletTx(CWallet* pwallet);
 
 #endif // HONEY_WALLETDB_H